@@ -0,0 +1,119 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "SfMFiles/Arena.hpp"
+
+// STD
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+SFMFILES_NAMESPACE_BEGIN
+
+class Arena::State
+{
+public:
+    class Block
+    {
+    public:
+        char *data;
+        size_t size;
+        std::atomic<size_t> used;
+    };
+
+    size_t blockSize;
+    std::atomic<Block *> current;
+    std::mutex mutex; // Taken only to add blocks
+    std::vector<Block *> blocks;
+    uint64_t nBytesReserved;
+
+    // Expects the mutex to be locked
+    Block *newBlock(size_t size)
+    {
+        Block *b = new Block;
+        b->data = (char *)std::malloc(size);
+        if(b->data == NULL) {
+            delete b;
+            throw std::bad_alloc();
+        }
+        b->size = size;
+        b->used = 0;
+        blocks.push_back(b);
+        nBytesReserved += size;
+        return b;
+    }
+};
+
+Arena::Arena(size_t blockSize): _state(new State)
+{
+    _state->blockSize = std::max(blockSize, 4 * ALIGNMENT);
+    _state->current = NULL;
+    _state->nBytesReserved = 0;
+}
+
+Arena::~Arena()
+{
+    for(size_t i = 0; i < _state->blocks.size(); i++) {
+        std::free(_state->blocks[i]->data);
+        delete _state->blocks[i];
+    }
+    delete _state;
+}
+
+void *
+Arena::allocate(size_t size)
+{
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if(size == 0) size = ALIGNMENT;
+
+    // Large requests get a block of their own so they don't waste what
+    // is left of the current one
+    if(size > _state->blockSize / 4) {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        State::Block *b = _state->newBlock(size);
+        b->used = size;
+        return b->data;
+    }
+
+    for(;;) {
+        State::Block *b = _state->current.load(std::memory_order_acquire);
+        if(b != NULL) {
+            size_t offset = b->used.fetch_add(size, std::memory_order_relaxed);
+            if(offset + size <= b->size) return b->data + offset;
+        }
+
+        // Block is full, the first thread to get here replaces it
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if(_state->current.load(std::memory_order_relaxed) == b) {
+            _state->current.store(_state->newBlock(_state->blockSize), std::memory_order_release);
+        }
+    }
+}
+
+uint64_t
+Arena::getNBytesReserved() const
+{
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    return _state->nBytesReserved;
+}
+
+SFMFILES_NAMESPACE_END
@@ -22,11 +22,21 @@
 #include "SfMFiles/Bundler.hpp"
 #include "utils.hpp"
 #include "io.hpp"
+#include "scanner.hpp"
+#include "formatter.hpp"
+#include "bundle_binary.hpp"
+#include "spatial.hpp"
+#include "projection.hpp"
 
 #include <iomanip>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/device/file.hpp>
+#include <boost/filesystem.hpp>
 
 static
 std::istream &
@@ -62,15 +72,6 @@ operator>>(std::istream &s, sfmf::Bundler::Color &c)
     return s;
 }
 
-static
-std::istream &
-operator>>(std::istream &s, Eigen::Vector2d &p)
-{
-    for(int i = 0; i < 2; i++) s >> p[i];
-
-    return s;
-}
-
 std::istream &
 operator>>(std::istream &s, sfmf::Bundler::Camera &cam)
 {
@@ -115,26 +116,44 @@ Camera::Camera()
 bool
 Camera::isValid() const
 {
+    if(cache.initialized) return cache.valid;
     return fabs(rotation.determinant() - 1.0) < 0.00001;
 }
 
 void
 Camera::im2world(const Eigen::Vector2d &im, Eigen::Vector3d &w,
-                 int imWidth, int imHeight) const
+                 int imWidth, int imHeight, bool removeRadialDistortion) const
 {
     Eigen::Vector3d c;
-
-    // TODO: radial distortion
-    im2cam(im, c, imWidth, imHeight);
+    im2cam(im, c, imWidth, imHeight, removeRadialDistortion);
     cam2world(c, w);
 }
 
 void
-Camera::im2cam(const Eigen::Vector2d &im, Eigen::Vector3d &c, int imWidth, int imHeight) const
+Camera::im2cam(const Eigen::Vector2d &im, Eigen::Vector3d &c, int imWidth, int imHeight,
+               bool removeRadialDistortion) const
+{
+    undistortPoints(ProjectionParams(*this, removeRadialDistortion, imWidth, imHeight), im.data(), 1, c.data(), NULL, SIMD_NONE);
+}
+
+void
+Camera::im2camBatch(const double *im, size_t n, double *c, int imWidth, int imHeight,
+                    bool removeRadialDistortion, const UndistortionTable *table) const
+{
+    undistortPoints(ProjectionParams(*this, removeRadialDistortion, imWidth, imHeight), im, n, c, table);
+}
+
+void
+Camera::im2worldBatch(const double *im, size_t n, double *w, int imWidth, int imHeight,
+                      bool removeRadialDistortion, const UndistortionTable *table) const
 {
-    c[0] =  (  imWidth / 2.0 - im[0]) / focalLength;
-    c[1] = -( imHeight / 2.0 - im[1]) / focalLength;
-    c[2] = -1.0;
+    im2camBatch(im, n, w, imWidth, imHeight, removeRadialDistortion, table);
+
+    const Eigen::Matrix3d Rt = rotation.transpose();
+    for(size_t i = 0; i < n; i++) {
+        Eigen::Map<Eigen::Vector3d> p(w + 3 * i);
+        p = Rt * (Eigen::Vector3d(p) - translation);
+    }
 }
 
 static
@@ -235,6 +254,13 @@ Camera::world2im(const Eigen::Vector4d &w, Eigen::Vector2d &im,
     return cam2im(c, im, applyRadialDistortion, imWidth, imHeight);
 }
 
+size_t
+Camera::world2imBatch(const double *w, size_t n, double *im, uint8_t *visible,
+                      bool applyRadialDistortion, int imWidth, int imHeight) const
+{
+    return projectPoints(ProjectionParams(*this, applyRadialDistortion, imWidth, imHeight), w, n, im, visible);
+}
+
 void
 Camera::cam2imPmvs(Eigen::Vector3d c, Eigen::Vector2d &im,
                    bool applyRadialDistortion,
@@ -274,6 +300,11 @@ Camera::world2cam(const Eigen::Vector4d &w, Eigen::Vector3d &c) const
 void
 Camera::intrinsicMatrix(int imWidth, int imHeight, Eigen::Matrix3d &K) const
 {
+    if(cache.initialized && cache.imWidth == imWidth && cache.imHeight == imHeight) {
+        K = cache.K;
+        return;
+    }
+
     K.setZero();
 
     // z: points to the back of the camera
@@ -290,6 +321,11 @@ Camera::intrinsicMatrix(int imWidth, int imHeight, Eigen::Matrix3d &K) const
 void
 Camera::invIntrinsicMatrix(int imWidth, int imHeight, Eigen::Matrix3d &invK) const
 {
+    if(cache.initialized && cache.imWidth == imWidth && cache.imHeight == imHeight) {
+        invK = cache.invK;
+        return;
+    }
+
     invK.setZero();
 
     // z: points to the back of the camera
@@ -306,31 +342,86 @@ Camera::invIntrinsicMatrix(int imWidth, int imHeight, Eigen::Matrix3d &invK) con
 void
 Camera::center(Eigen::Vector3d &centerW) const
 {
+    if(cache.initialized) {
+        centerW = cache.center;
+        return;
+    }
     cam2world(Eigen::Vector3d::Zero(), centerW);
 }
 
+// Directions are rotated only, the camera y axis in the world is the
+// second row of the rotation and the viewing direction the negated third
 void
 Camera::up(Eigen::Vector3d &upW) const
 {
-    Eigen::Vector3d upCam(0, 1, 0);
-    cam2world(upCam, upW);
-    Eigen::Vector3d centerW;
-    center(centerW);
-    upW -= centerW;
+    if(cache.initialized) {
+        upW = cache.up;
+        return;
+    }
+    upW = rotation.row(1).transpose();
     upW /= upW.norm();
 }
 
 void
 Camera::lookingAt(Eigen::Vector3d &lat) const
 {
-    Eigen::Vector3d imCenterC(0, 0, -1), imCenterW, camCenterW;
-    cam2world(imCenterC, imCenterW);
-    center(camCenterW);
-
-    lat = (imCenterW - camCenterW);
+    if(cache.initialized) {
+        lat = cache.direction;
+        return;
+    }
+    lat = -rotation.row(2).transpose();
     lat /= lat.norm();
 }
 
+void
+Camera::refreshCache()
+{
+    refreshCache(cache.imWidth, cache.imHeight);
+}
+
+void
+Camera::refreshCache(int imWidth, int imHeight)
+{
+    // The accessors read the cache once it is initialized
+    cache.initialized = false;
+    cache.valid = isValid();
+    center(cache.center);
+    lookingAt(cache.direction);
+    up(cache.up);
+
+    cache.imWidth = imWidth;
+    cache.imHeight = imHeight;
+    intrinsicMatrix(imWidth, imHeight, cache.K);
+    invIntrinsicMatrix(imWidth, imHeight, cache.invK);
+    cache.P.block<3, 3>(0, 0) = cache.K * rotation;
+    cache.P.col(3) = cache.K * translation;
+    cache.Pf = cache.P.cast<float>();
+
+    cache.initialized = true;
+}
+
+void
+Camera::transform(const Eigen::Matrix4d &trans)
+{
+    // Camera moves by the inverse, scale only affects the translation
+    Eigen::MatrixXd transInv = trans.inverse();
+    Eigen::Matrix3d transRot = transInv.block(0, 0, 3, 3);
+    double scale = std::pow(transRot.determinant(), 1.0 / 3.0);
+    transInv.block(0, 0, 3, 3) /= scale;
+
+    Eigen::MatrixXd camT(4, 4);
+    camT.block(0, 0, 3, 3) = rotation;
+    camT.block(0, 3, 3, 1) = translation;
+    camT.block(3, 0, 1, 3).setZero();
+    camT(3, 3) = 1;
+
+    camT *= transInv;
+
+    rotation = camT.block(0, 0, 3, 3);
+    translation = camT.block(0, 3, 3, 1) / scale;
+    refreshCache();
+}
+
 ViewListEntry::ViewListEntry(int camera_, int key_, Eigen::Vector2d keyPosition_):
     camera(camera_), key(key_), keyPosition(keyPosition_)
 {
@@ -348,17 +439,392 @@ ViewListEntry::ViewListEntry(const ViewListEntry &other)
     this->keyPosition = other.keyPosition;
 }
 
+void
+PointArrays::clear()
+{
+    positions.clear();
+    colors.clear();
+    offsets.assign(1, 0);
+    observations.clear();
+}
+
+void
+PointArrays::reserve(size_t nPoints, uint64_t nObservations)
+{
+    positions.reserve(3 * nPoints);
+    colors.reserve(3 * nPoints);
+    offsets.reserve(nPoints + 1);
+    observations.reserve(nObservations);
+}
+
+void
+PointArrays::swap(PointArrays &other)
+{
+    positions.swap(other.positions);
+    colors.swap(other.colors);
+    offsets.swap(other.offsets);
+    observations.swap(other.observations);
+}
+
+void
+PointArrays::getPoint(size_t pntIdx, Point &pnt) const
+{
+    pnt.position = getPosition(pntIdx);
+    pnt.color = getColor(pntIdx);
+
+    ArrayView<PackedViewListEntry> viewList = getViewList(pntIdx);
+    pnt.viewList.resize(viewList.size());
+    for(size_t i = 0; i < viewList.size(); i++) {
+        ViewListEntry &entry = pnt.viewList[i];
+        entry.camera = viewList[i].camera;
+        entry.key = viewList[i].key;
+        entry.keyPosition << viewList[i].keyPosition[0], viewList[i].keyPosition[1];
+    }
+}
+
+void
+PointArrays::push_back(const Point &pnt)
+{
+    positions.insert(positions.end(), &pnt.position[0], &pnt.position[0] + 3);
+    colors.push_back(pnt.color.r);
+    colors.push_back(pnt.color.g);
+    colors.push_back(pnt.color.b);
+
+    for(ViewListEntry::Vector::const_iterator it = pnt.viewList.begin(), itEnd = pnt.viewList.end(); it != itEnd; it++) {
+        PackedViewListEntry obs;
+        obs.camera = it->camera;
+        obs.key = it->key;
+        obs.keyPosition[0] = it->keyPosition(0);
+        obs.keyPosition[1] = it->keyPosition(1);
+        observations.push_back(obs);
+    }
+    offsets.push_back(observations.size());
+}
+
+void
+PointArrays::assign(const Point::Vector &points)
+{
+    const long long nPoints = points.size();
+
+    offsets.resize(nPoints + 1);
+    offsets[0] = 0;
+    for(long long i = 0; i < nPoints; i++) offsets[i + 1] = offsets[i] + points[i].viewList.size();
+
+    positions.resize(3 * nPoints);
+    colors.resize(3 * nPoints);
+    observations.resize(offsets[nPoints]);
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        const Point &pnt = points[i];
+        for(int k = 0; k < 3; k++) positions[3 * i + k] = pnt.position[k];
+        colors[3 * i] = pnt.color.r;
+        colors[3 * i + 1] = pnt.color.g;
+        colors[3 * i + 2] = pnt.color.b;
+
+        PackedViewListEntry *obs = &observations[0] + offsets[i];
+        for(ViewListEntry::Vector::const_iterator it = pnt.viewList.begin(), itEnd = pnt.viewList.end(); it != itEnd; it++, obs++) {
+            obs->camera = it->camera;
+            obs->key = it->key;
+            obs->keyPosition[0] = it->keyPosition(0);
+            obs->keyPosition[1] = it->keyPosition(1);
+        }
+    }
+}
+
+void
+PointArrays::toPoints(Point::Vector &points, const ViewListEntry::Allocator &allocator) const
+{
+    const long long nPoints = size();
+    points.resize(nPoints, Point(allocator));
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) getPoint(i, points[i]);
+}
+
+void
+PointArrays::transform(const Eigen::Matrix4d &trans)
+{
+    const double r00 = trans(0, 0), r01 = trans(0, 1), r02 = trans(0, 2), t0 = trans(0, 3);
+    const double r10 = trans(1, 0), r11 = trans(1, 1), r12 = trans(1, 2), t1 = trans(1, 3);
+    const double r20 = trans(2, 0), r21 = trans(2, 1), r22 = trans(2, 2), t2 = trans(2, 3);
+
+    double *p = positions.data();
+    const long long nPoints = size();
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        double *pos = p + 3 * i;
+        const double x = pos[0], y = pos[1], z = pos[2];
+        pos[0] = r00 * x + r01 * y + r02 * z + t0;
+        pos[1] = r10 * x + r11 * y + r12 * z + t1;
+        pos[2] = r20 * x + r21 * y + r22 * z + t2;
+    }
+}
+
+void
+PointArrays::boundingBox(Eigen::Vector3d &min, Eigen::Vector3d &max) const
+{
+    min.setConstant(std::numeric_limits<double>::infinity());
+    max.setConstant(-std::numeric_limits<double>::infinity());
+
+    const double *p = positions.data();
+    const long long nPoints = size();
+#pragma omp parallel
+    {
+        double lo[3] = {min[0], min[1], min[2]}, hi[3] = {max[0], max[1], max[2]};
+#pragma omp for schedule(static) nowait
+        for(long long i = 0; i < nPoints; i++) {
+            for(int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], p[3 * i + k]);
+                hi[k] = std::max(hi[k], p[3 * i + k]);
+            }
+        }
+#pragma omp critical
+        for(int k = 0; k < 3; k++) {
+            min[k] = std::min(min[k], lo[k]);
+            max[k] = std::max(max[k], hi[k]);
+        }
+    }
+}
+
+const double CompactPointArrays::TOLERANCE = 1.0 / (1 << 24);
+
+void
+CompactPointArrays::clear()
+{
+    origin.setZero();
+    positions.clear();
+    colors.clear();
+    offsets.assign(1, 0);
+    cameras16.clear();
+    cameras32.clear();
+    keys.clear();
+    keyPositions.clear();
+    wideCameras = false;
+}
+
+void
+CompactPointArrays::swap(CompactPointArrays &other)
+{
+    std::swap(origin, other.origin);
+    positions.swap(other.positions);
+    colors.swap(other.colors);
+    offsets.swap(other.offsets);
+    cameras16.swap(other.cameras16);
+    cameras32.swap(other.cameras32);
+    keys.swap(other.keys);
+    keyPositions.swap(other.keyPositions);
+    std::swap(wideCameras, other.wideCameras);
+}
+
+void
+CompactPointArrays::getPoint(size_t pntIdx, Point &pnt) const
+{
+    pnt.position = getPosition(pntIdx);
+    pnt.color = getColor(pntIdx);
+
+    uint64_t begin = offsets[pntIdx], end = offsets[pntIdx + 1];
+    pnt.viewList.resize(end - begin);
+    for(uint64_t j = begin; j < end; j++) {
+        ViewListEntry &entry = pnt.viewList[j - begin];
+        entry.camera = getCamera(j);
+        entry.key = keys[j];
+        entry.keyPosition << keyPositions[2 * j], keyPositions[2 * j + 1];
+    }
+}
+
+void
+CompactPointArrays::assign(const PointArrays &arrays)
+{
+    const long long nPoints = arrays.size();
+    const long long nObservations = arrays.getNObservations();
+
+    // Centroid keeps the relative positions as small as possible
+    double sx = 0, sy = 0, sz = 0;
+#pragma omp parallel for schedule(static) reduction(+:sx, sy, sz)
+    for(long long i = 0; i < nPoints; i++) {
+        sx += arrays.positions[3 * i];
+        sy += arrays.positions[3 * i + 1];
+        sz += arrays.positions[3 * i + 2];
+    }
+    origin = nPoints ? Eigen::Vector3d(sx / nPoints, sy / nPoints, sz / nPoints) : Eigen::Vector3d::Zero();
+
+    int maxCamera = 0;
+#pragma omp parallel for schedule(static) reduction(max:maxCamera)
+    for(long long j = 0; j < nObservations; j++) maxCamera = std::max(maxCamera, int(arrays.observations[j].camera));
+    wideCameras = maxCamera > std::numeric_limits<uint16_t>::max();
+
+    positions.resize(3 * nPoints);
+    colors = arrays.colors;
+    offsets = arrays.offsets;
+    std::vector<uint16_t>().swap(cameras16);
+    std::vector<uint32_t>().swap(cameras32);
+    if(wideCameras) cameras32.resize(nObservations);
+    else cameras16.resize(nObservations);
+    keys.resize(nObservations);
+    keyPositions.resize(2 * nObservations);
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        for(int k = 0; k < 3; k++) positions[3 * i + k] = float(arrays.positions[3 * i + k] - origin[k]);
+    }
+
+#pragma omp parallel for schedule(static)
+    for(long long j = 0; j < nObservations; j++) {
+        const PackedViewListEntry &obs = arrays.observations[j];
+        if(wideCameras) cameras32[j] = obs.camera;
+        else cameras16[j] = obs.camera;
+        keys[j] = obs.key;
+        keyPositions[2 * j] = float(obs.keyPosition[0]);
+        keyPositions[2 * j + 1] = float(obs.keyPosition[1]);
+    }
+}
+
+void
+CompactPointArrays::toArrays(PointArrays &arrays) const
+{
+    const long long nPoints = size();
+    const long long nObservations = getNObservations();
+
+    arrays.positions.resize(3 * nPoints);
+    arrays.colors = colors;
+    arrays.offsets = offsets;
+    arrays.observations.resize(nObservations);
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        for(int k = 0; k < 3; k++) arrays.positions[3 * i + k] = origin[k] + positions[3 * i + k];
+    }
+
+#pragma omp parallel for schedule(static)
+    for(long long j = 0; j < nObservations; j++) {
+        PackedViewListEntry &obs = arrays.observations[j];
+        obs.camera = getCamera(j);
+        obs.key = keys[j];
+        obs.keyPosition[0] = keyPositions[2 * j];
+        obs.keyPosition[1] = keyPositions[2 * j + 1];
+    }
+}
+
+void
+CompactPointArrays::toPoints(Point::Vector &points, const ViewListEntry::Allocator &allocator) const
+{
+    const long long nPoints = size();
+    points.resize(nPoints, Point(allocator));
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) getPoint(i, points[i]);
+}
+
 const char *Reconstruction::ASCII_SIGNATURE = "# Bundle file v";
 
-#if 0
+// Smallest number of points handed to a thread when parsing in parallel
+static const int MIN_POINTS_PER_CHUNK = 4096;
+
+static inline
+void
+expectToken(bool ok, const char *what)
+{
+    if(!ok) {
+        std::stringstream err;
+        err << "Malformed bundle file, could not read " << what;
+        throw sfmf::Error(err.str());
+    }
+}
+
+// Parses count consecutive point records
+static
+bool
+readPoints(TextScanner &in, Point *points, int64_t count, int nCameras)
+{
+    for(Point *pnt = points, *pntEnd = points + count; pnt != pntEnd; pnt++) {
+        // Position
+        bool ok = in.readDouble(pnt->position[0]) && in.readDouble(pnt->position[1]) && in.readDouble(pnt->position[2]);
+
+        // Color
+        float r, g, b;
+        ok = ok && in.readFloat(r) && in.readFloat(g) && in.readFloat(b);
+        pnt->color.r = (unsigned char)r;
+        pnt->color.g = (unsigned char)g;
+        pnt->color.b = (unsigned char)b;
+
+        // View list
+        int viewListSize = 0;
+        ok = ok && in.readInt(viewListSize) && viewListSize >= 0;
+        if(!ok) return false;
+
+        pnt->viewList.resize(viewListSize);
+        for(ViewListEntry::Vector::iterator it = pnt->viewList.begin(), itEnd = pnt->viewList.end(); it != itEnd; it++) {
+            ok = in.readInt(it->camera) && in.readInt(it->key) && in.readDouble(it->keyPosition(0)) && in.readDouble(it->keyPosition(1));
+            if(!ok || it->camera < 0 || it->camera >= nCameras) return false;
+        }
+    }
+
+    return true;
+}
+
+// Parses count consecutive point records into points first to first +
+// count - 1 of arrays (positions and colors must be allocated). The
+// size of each view list goes to offsets[i + 1] (see countsToOffsets)
+// and observations are appended to observations.
+static
+bool
+readPoints(TextScanner &in, PointArrays &arrays, int64_t first, int64_t count, std::vector<PackedViewListEntry> &observations, int nCameras)
+{
+    for(int64_t i = first; i < first + count; i++) {
+        // Position
+        double *pos = &arrays.positions[3 * i];
+        bool ok = in.readDouble(pos[0]) && in.readDouble(pos[1]) && in.readDouble(pos[2]);
+
+        // Color
+        float r, g, b;
+        ok = ok && in.readFloat(r) && in.readFloat(g) && in.readFloat(b);
+        uint8_t *color = &arrays.colors[3 * i];
+        color[0] = (unsigned char)r;
+        color[1] = (unsigned char)g;
+        color[2] = (unsigned char)b;
+
+        // View list
+        int viewListSize = 0;
+        ok = ok && in.readInt(viewListSize) && viewListSize >= 0;
+        if(!ok) return false;
+
+        arrays.offsets[i + 1] = viewListSize;
+        for(int j = 0; j < viewListSize; j++) {
+            PackedViewListEntry obs;
+            ok = in.readInt(obs.camera) && in.readInt(obs.key) && in.readDouble(obs.keyPosition[0]) && in.readDouble(obs.keyPosition[1]);
+            if(!ok || obs.camera < 0 || obs.camera >= nCameras) return false;
+            observations.push_back(obs);
+        }
+    }
+    return true;
+}
+
+// Turns the view list sizes stored by readPoints into offsets
+static
+void
+countsToOffsets(std::vector<uint64_t> &offsets)
+{
+    offsets[0] = 0;
+    for(size_t i = 1; i < offsets.size(); i++) offsets[i] += offsets[i - 1];
+}
+
 void
-Reconstruction::_readFileASCII(CompressedFileReader &in)
+Reconstruction::_readFileIStream(const char *bundlerFileName)
 {
+    CompressedFileReader in(bundlerFileName);
+
     // File signature
     char sig[200];
     in.read(sig, strlen(ASCII_SIGNATURE));
     sig[strlen(ASCII_SIGNATURE)] = '\0';
     if (strcmp(sig, ASCII_SIGNATURE) != 0) {
+        if(hasBinaryMagic(sig, strlen(sig) + 1)) {
+            // Binary files are always read in one go
+            _readFileBuffer(bundlerFileName, ReadOptions());
+            return;
+        }
+
         LOG_WARN("Bad signature in ASCII file: " << sig);
         throw sfmf::Error("Bad signature in binary file");
         return;
@@ -378,8 +844,10 @@ Reconstruction::_readFileASCII(CompressedFileReader &in)
     }
 
     // Get the number of points and cameras
-    int nCameras, nPoints;
+    int nCameras = 0;
+    int64_t nPoints = 0;
     in >> nCameras >> nPoints;
+    expectToken(!in.fail() && nCameras >= 0 && nPoints >= 0, "number of cameras and points");
 
     // Read the cameras
 
@@ -404,11 +872,12 @@ Reconstruction::_readFileASCII(CompressedFileReader &in)
         in >> t[0] >> t[1] >> t[2];
     }
     // Read the points
-    _points.resize(nPoints);
+    _pointLayout = POINTS_AOS;
+    _points.resize(nPoints, Point(_newViewListArena()));
     Point::Vector::iterator itPoint = _points.begin();
 
     PROGBAR_START("Read points");
-    for(int i = 0; i < nPoints; i++, itPoint++) {
+    for(int64_t i = 0; i < nPoints; i++, itPoint++) {
         PROGBAR_UPDATE(i, nPoints);
 
         // Position
@@ -435,111 +904,426 @@ Reconstruction::_readFileASCII(CompressedFileReader &in)
         }
     }
 }
-#endif
 
 void
-Reconstruction::readFile(const char *bundlerFileName, bool computeCamIndex)
+Reconstruction::_readFileBuffer(const char *bundlerFileName, const ReadOptions &opts)
 {
-    CompressedFileReader in(bundlerFileName);
+    std::vector<char> buffer;
+    readFileIntoBuffer(bundlerFileName, buffer, opts.useGzipIndex);
+
+    if(hasBinaryMagic(buffer.data(), buffer.size())) {
+        _readBinary(buffer.data(), buffer.size());
+        return;
+    }
+
+    TextScanner in(buffer.data(), buffer.data() + buffer.size());
 
     // File signature
-    char sig[200];
-    in.read(sig, strlen(ASCII_SIGNATURE));
-    sig[strlen(ASCII_SIGNATURE)] = '\0';
-    if (strcmp(sig, ASCII_SIGNATURE) != 0) {
+    if(!in.match(ASCII_SIGNATURE)) {
+        std::string sig(buffer.begin(), buffer.begin() + std::min(buffer.size(), strlen(ASCII_SIGNATURE)));
         LOG_WARN("Bad signature in ASCII file: " << sig);
         throw sfmf::Error("Bad signature in binary file");
-        return;
     }
 
-    //char firstLine[255];
-    //fgets(firstLine, sizeof(firstLine), file);
-
-    double version;
-    in >> version;
+    double version = 0;
+    expectToken(in.readDouble(version), "version");
     if (version != 0.3) {
         std::stringstream err;
         err << "Unsupported version " << version;
         LOG_WARN(err.str());
         throw sfmf::Error(err.str());
-        return;
     }
 
     // Get the number of points and cameras
-    int nCameras, nPoints;
-    in >> nCameras >> nPoints;
+    int nCameras = 0;
+    long long nPoints = 0;
+    expectToken(in.readInt(nCameras) && in.readInt64(nPoints) && nCameras >= 0 && nPoints >= 0,
+                "number of cameras and points");
 
     // Read the cameras
-
     _cameras.resize(nCameras);
     PROGBAR_START("Read cameras");
     for(int i = 0; i < nCameras; i++) {
         PROGBAR_UPDATE(i, nCameras);
 
         Camera &cam = _cameras[i];
+        bool ok = in.readDouble(cam.focalLength) && in.readDouble(cam.k1) && in.readDouble(cam.k2);
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++) ok = ok && in.readDouble(cam.rotation(r, c));
+        for(int r = 0; r < 3; r++) ok = ok && in.readDouble(cam.translation(r));
+        expectToken(ok, "camera");
+    }
 
-        // Focal length and radial distortion
-        in >> cam.focalLength >> cam.k1 >> cam.k2;
+    // Read the points
+    const bool soa = (_pointLayout == POINTS_SOA);
+    if(soa) {
+        _pointArrays.positions.resize(3 * size_t(nPoints));
+        _pointArrays.colors.resize(3 * size_t(nPoints));
+        _pointArrays.offsets.assign(nPoints + 1, 0);
+    } else {
+        _points.resize(nPoints, Point(_newViewListArena()));
+    }
 
-        // Rotation
-        double *R = &cam.rotation(0, 0);
-        in >> cam.rotation(0, 0) >> cam.rotation(0, 1) >> cam.rotation(0, 2);
-        in >> cam.rotation(1, 0) >> cam.rotation(1, 1) >> cam.rotation(1, 2);
-        in >> cam.rotation(2, 0) >> cam.rotation(2, 1) >> cam.rotation(2, 2);
+    int nThreads = opts.nThreads;
+#ifdef _OPENMP
+    if(nThreads <= 0) nThreads = omp_get_max_threads();
+#else
+    nThreads = 1;
+#endif
 
-        // Translation
-        double *t = &cam.translation(0, 0);
-        in >> t[0] >> t[1] >> t[2];
+    if(nThreads > 1 && nPoints >= MIN_POINTS_PER_CHUNK * 2) {
+        const char *pointsBegin = in.position();
+        in.skipLine();
+        if(_readPointsParallel(in.position(), buffer.data() + buffer.size(), nPoints, nThreads)) return;
+
+        LOG_INFO("Point section does not have one record every three lines, parsing it sequentially");
+        in.seek(pointsBegin);
     }
-    // Read the points
-    _points.resize(nPoints);
-    Point::Vector::iterator itPoint = _points.begin();
 
     PROGBAR_START("Read points");
-    for(int i = 0; i < nPoints; i++, itPoint++) {
+    if(soa) _pointArrays.observations.clear();
+    for(long long i = 0; i < nPoints; i += MIN_POINTS_PER_CHUNK) {
         PROGBAR_UPDATE(i, nPoints);
+        long long count = std::min<long long>(MIN_POINTS_PER_CHUNK, nPoints - i);
+        if(soa) expectToken(readPoints(in, _pointArrays, i, count, _pointArrays.observations, nCameras), "point");
+        else expectToken(readPoints(in, &_points[i], count, nCameras), "point");
+    }
+    if(soa) countsToOffsets(_pointArrays.offsets);
+}
 
-        // Position
-        double *pos = &itPoint->position[0];
-        in >> pos[0] >> pos[1] >> pos[2];
-
-        // Color
-        float r, g, b;
-        in >> r >> g >> b;
-        itPoint->color.r = (unsigned char)r;
-        itPoint->color.g = (unsigned char)g;
-        itPoint->color.b = (unsigned char)b;
-
-        // View list
-        int viewListSize;
-        in >> viewListSize;
-        itPoint->viewList.resize(viewListSize);
+bool
+Reconstruction::_readPointsParallel(const char *begin, const char *end, int64_t nPoints, int nThreads)
+{
+    const int nCameras = _cameras.size();
+    const bool soa = (_pointLayout == POINTS_SOA);
+
+    // Split the point section into byte ranges and count the lines in each of
+    // them. Since every point takes exactly three lines (position, color and
+    // view list) the line number tells where the point records start.
+    int nChunks = std::max<int64_t>(1, std::min<int64_t>(nThreads * 4, nPoints / MIN_POINTS_PER_CHUNK));
+    size_t chunkBytes = (end - begin) / nChunks + 1;
+
+    std::vector<long long> nLines(nChunks, 0);
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+    for(int c = 0; c < nChunks; c++) {
+        const char *p = std::min(end, begin + c * chunkBytes);
+        const char *pEnd = std::min(end, p + chunkBytes);
+        while((p = (const char *)memchr(p, '\n', pEnd - p)) != NULL) {
+            nLines[c]++;
+            p++;
+        }
+    }
 
-        ViewListEntry::Vector::iterator itEntry = itPoint->viewList.begin();
+    // The last line might not be terminated
+    long long totalLines = 0;
+    for(int c = 0; c < nChunks; c++) totalLines += nLines[c];
+    if(end != begin && end[-1] != '\n') totalLines++;
+    if(totalLines != 3LL * nPoints) return false;
+
+    // Move each split forward to the beginning of the next point record
+    std::vector<const char *> chunkBegin(nChunks + 1, end);
+    std::vector<int64_t> chunkFirstPoint(nChunks + 1, nPoints);
+    chunkBegin[0] = begin;
+    chunkFirstPoint[0] = 0;
+    long long linesBefore = nLines[0];
+    for(int c = 1; c < nChunks; linesBefore += nLines[c], c++) {
+        const char *p = begin + c * chunkBytes;
+        long long line = linesBefore;
+        if(p[-1] != '\n') {
+            p = (const char *)memchr(p, '\n', end - p);
+            p = (p == NULL) ? end : p + 1;
+            line++;
+        }
+        for(; line % 3 != 0 && p != end; line++) {
+            p = (const char *)memchr(p, '\n', end - p);
+            p = (p == NULL) ? end : p + 1;
+        }
 
-        for(int j = 0; j < viewListSize; j++, itEntry++) {
-            in >> itEntry->camera >> itEntry->key >> itEntry->keyPosition(0) >> itEntry->keyPosition(1);
-            assert(itEntry->camera < nCameras && itEntry->camera >= 0);
+        if(p < chunkBegin[c - 1]) {
+            // Previous split was moved past this one
+            p = chunkBegin[c - 1];
+            line = 3LL * chunkFirstPoint[c - 1];
         }
+        chunkBegin[c] = p;
+        chunkFirstPoint[c] = line / 3;
     }
 
-    _bundleFName = std::string(bundlerFileName);
+    // With PointArrays each chunk collects its observations, they are
+    // moved into place once the offsets are known
+    std::vector< std::vector<PackedViewListEntry> > chunkObservations(soa ? nChunks : 0);
+
+    int nFailed = 0;
+#pragma omp parallel for num_threads(nThreads) schedule(dynamic) reduction(+:nFailed)
+    for(int c = 0; c < nChunks; c++) {
+        TextScanner chunk(chunkBegin[c], chunkBegin[c + 1]);
+        int64_t first = chunkFirstPoint[c];
+        int64_t count = chunkFirstPoint[c + 1] - first;
+
+        bool ok = false;
+        try {
+            if(soa) ok = readPoints(chunk, _pointArrays, first, count, chunkObservations[c], nCameras);
+            else ok = readPoints(chunk, &_points[first], count, nCameras);
+            ok = ok && chunk.atEnd();
+        } catch (...) {
+            ok = false;
+        }
+        if(!ok) nFailed++;
+    }
 
-    // Figure out how many of these cameras are actually valid
-    _updateNValidCams();
+    if(nFailed != 0) return false;
+
+    if(soa) {
+        countsToOffsets(_pointArrays.offsets);
+        _pointArrays.observations.resize(_pointArrays.getNObservations());
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+        for(int c = 0; c < nChunks; c++) {
+            std::vector<PackedViewListEntry> &obs = chunkObservations[c];
+            if(obs.empty()) continue;
+            memcpy(&_pointArrays.observations[_pointArrays.offsets[chunkFirstPoint[c]]], obs.data(), obs.size() * sizeof(PackedViewListEntry));
+            std::vector<PackedViewListEntry>().swap(obs);
+        }
+    }
 
-    // Build camera to point index
-    if(computeCamIndex) buildCam2PointIndex();
+    return true;
 }
 
+// Sections of a binary file are copied as they are into the point arrays
+static
 void
-Reconstruction::_updateNValidCams()
+readBinaryArrays(const char *data, const BinaryHeader &header, PointArrays &arrays)
 {
-    _nValidCams = 0;
-    for(int i = 0; i < _cameras.size(); i++) {
-        if(_cameras[i].isValid()) _nValidCams++;
-    }
-}
+    BinaryLayout layout(header);
+    const size_t nPoints = header.nPoints;
+    const int nCameras = header.nCameras;
+
+    arrays.positions.resize(3 * nPoints);
+    memcpy(arrays.positions.data(), data + layout.positions, 3 * nPoints * sizeof(double));
+    swapToLittleEndian(arrays.positions.data(), 3 * nPoints);
+
+    arrays.colors.assign((const uint8_t *)data + layout.colors, (const uint8_t *)data + layout.colors + 3 * nPoints);
+
+    arrays.offsets.resize(nPoints + 1);
+    memcpy(arrays.offsets.data(), data + layout.offsets, (nPoints + 1) * sizeof(uint64_t));
+    swapToLittleEndian(arrays.offsets.data(), nPoints + 1);
+
+    bool bad = arrays.offsets[0] != 0 || arrays.offsets[nPoints] != header.nObservations;
+    for(size_t i = 0; i < nPoints && !bad; i++) bad = arrays.offsets[i] > arrays.offsets[i + 1];
+    if(bad) throw sfmf::Error("Corrupted binary bundle file, bad view list");
+
+    arrays.observations.resize(header.nObservations);
+    memcpy(arrays.observations.data(), data + layout.observations, header.nObservations * sizeof(BinaryObservation));
+    swapToLittleEndian(arrays.observations.data(), header.nObservations);
+
+    const long long nObservations = header.nObservations;
+    int nBad = 0;
+#pragma omp parallel for schedule(static) reduction(+:nBad)
+    for(long long j = 0; j < nObservations; j++) {
+        if(arrays.observations[j].camera < 0 || arrays.observations[j].camera >= nCameras) nBad++;
+    }
+    if(nBad) throw sfmf::Error("Corrupted binary bundle file, bad view list");
+}
+
+void
+Reconstruction::_readBinary(const char *data, size_t size)
+{
+    BinaryHeader header;
+    if(size < sizeof(header)) throw sfmf::Error("Truncated binary bundle file");
+    memcpy(&header, data, sizeof(header));
+    swapToLittleEndian(header);
+
+    if(header.version != BINARY_VERSION) {
+        std::stringstream err;
+        err << "Unsupported binary bundle version " << header.version;
+        throw sfmf::Error(err.str());
+    }
+
+    if(header.nCameras > uint64_t(std::numeric_limits<int>::max()) || header.nPoints > uint64_t(std::numeric_limits<int64_t>::max())) {
+        throw sfmf::Error("Binary bundle file has more cameras or points than supported");
+    }
+
+    if(!binaryCountsFit(header, size)) throw sfmf::Error("Truncated binary bundle file");
+    BinaryLayout layout(header);
+    if(size < layout.fileSize) throw sfmf::Error("Truncated binary bundle file");
+
+    const int nCameras = header.nCameras;
+    const int64_t nPoints = header.nPoints;
+
+    // Cameras
+    _cameras.resize(nCameras);
+    for(int i = 0; i < nCameras; i++) {
+        double v[15];
+        memcpy(v, data + layout.cameras + i * BinaryLayout::CAMERA_SIZE, sizeof(v));
+        swapToLittleEndian(v, 15);
+
+        Camera &cam = _cameras[i];
+        cam.focalLength = v[0];
+        cam.k1 = v[1];
+        cam.k2 = v[2];
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++) cam.rotation(r, c) = v[3 + r * 3 + c];
+        for(int r = 0; r < 3; r++) cam.translation(r) = v[12 + r];
+    }
+
+    if(_pointLayout == POINTS_SOA) {
+        readBinaryArrays(data, header, _pointArrays);
+        return;
+    }
+
+    // Points
+    _points.resize(nPoints, Point(_newViewListArena()));
+    int nBad = 0;
+#pragma omp parallel for schedule(static) reduction(+:nBad)
+    for(long long i = 0; i < nPoints; i++) {
+        Point &pnt = _points[i];
+
+        memcpy(&pnt.position[0], data + layout.positions + i * 3 * sizeof(double), 3 * sizeof(double));
+        swapToLittleEndian(&pnt.position[0], 3);
+
+        const uint8_t *color = (const uint8_t *)data + layout.colors + i * 3;
+        pnt.color = Color(color[0], color[1], color[2]);
+
+        uint64_t range[2];
+        memcpy(range, data + layout.offsets + i * sizeof(uint64_t), sizeof(range));
+        swapToLittleEndian(range, 2);
+        if(range[0] > range[1] || range[1] > header.nObservations) {
+            nBad++;
+            continue;
+        }
+
+        pnt.viewList.resize(range[1] - range[0]);
+        for(uint64_t j = range[0]; j < range[1]; j++) {
+            BinaryObservation obs;
+            memcpy(&obs, data + layout.observations + j * sizeof(BinaryObservation), sizeof(obs));
+            swapToLittleEndian(&obs, 1);
+
+            ViewListEntry &entry = pnt.viewList[j - range[0]];
+            entry.camera = obs.camera;
+            entry.key = obs.key;
+            entry.keyPosition << obs.keyPosition[0], obs.keyPosition[1];
+            if(obs.camera < 0 || obs.camera >= nCameras) nBad++;
+        }
+    }
+
+    if(nBad) throw sfmf::Error("Corrupted binary bundle file, bad view list");
+}
+
+void
+Reconstruction::setPointLayout(PointLayout layout)
+{
+    if(layout == _pointLayout) return;
+
+    // Storage of the old layout is released, compact points are
+    // converted from and to PointArrays
+    if(_pointLayout == POINTS_COMPACT) {
+        if(layout == POINTS_SOA) _compactPoints.toArrays(_pointArrays);
+        else _compactPoints.toPoints(_points, _newViewListArena());
+        CompactPointArrays().swap(_compactPoints);
+    } else if(layout == POINTS_COMPACT) {
+        setPointLayout(POINTS_SOA);
+        _compactPoints.assign(_pointArrays);
+        PointArrays().swap(_pointArrays);
+    } else if(layout == POINTS_SOA) {
+        _pointArrays.assign(_points);
+        Point::Vector().swap(_points);
+        _viewListArena.reset();
+    } else {
+        _pointArrays.toPoints(_points, _newViewListArena());
+        PointArrays().swap(_pointArrays);
+    }
+    _pointLayout = layout;
+}
+
+ViewListEntry::Allocator
+Reconstruction::_newViewListArena()
+{
+    _viewListArena.reset(new Arena());
+    return ViewListEntry::Allocator(_viewListArena);
+}
+
+int64_t
+Reconstruction::getNPoints() const
+{
+    switch(_pointLayout) {
+    case POINTS_SOA:
+        return _pointArrays.size();
+    case POINTS_COMPACT:
+        return _compactPoints.size();
+    default:
+        return _points.size();
+    }
+}
+
+void
+Reconstruction::_copyPoint(int64_t pntIdx, Point &pnt) const
+{
+    if(_pointLayout == POINTS_COMPACT) _compactPoints.getPoint(pntIdx, pnt);
+    else _pointArrays.getPoint(pntIdx, pnt);
+}
+
+void
+Reconstruction::readFile(const char *bundlerFileName, bool computeCamIndex)
+{
+    readFile(bundlerFileName, ReadOptions(), computeCamIndex);
+}
+
+void
+Reconstruction::readFile(const char *bundlerFileName, const ReadOptions &opts, bool computeCamIndex)
+{
+    Point::Vector().swap(_points);
+    _viewListArena.reset();
+    PointArrays().swap(_pointArrays);
+    CompactPointArrays().swap(_compactPoints);
+    // Compact points are made from PointArrays once the file is parsed
+    _pointLayout = (opts.pointLayout == POINTS_COMPACT) ? POINTS_SOA : opts.pointLayout;
+    _cam2PointIndexInitialized = false;
+
+    if(opts.camerasOnly) {
+        _readCameras(bundlerFileName);
+        _pointLayout = opts.pointLayout;
+    } else {
+        switch(opts.parser) {
+        case ReadOptions::PARSER_ISTREAM:
+            _readFileIStream(bundlerFileName);
+            break;
+        default:
+            _readFileBuffer(bundlerFileName, opts);
+            break;
+        }
+        // Some parsers only fill a Point::Vector
+        setPointLayout(opts.pointLayout);
+        _nPointsInFile = getNPoints();
+    }
+
+    _bundleFName = std::string(bundlerFileName);
+
+    refreshCameraCaches();
+    // Figure out how many of these cameras are actually valid
+    _updateNValidCams();
+
+    // Build camera to point index
+    if(computeCamIndex) buildCam2PointIndex();
+}
+
+// Only the beginning of the file is read (binary files are mapped)
+void
+Reconstruction::_readCameras(const char *bundlerFileName)
+{
+    StreamReader reader(bundlerFileName);
+    _cameras = reader.getCameras();
+    _points.clear();
+    _pointArrays.clear();
+    _compactPoints.clear();
+    _nPointsInFile = reader.getNPoints();
+}
+
+void
+Reconstruction::_updateNValidCams()
+{
+    _nValidCams = 0;
+    for(int i = 0; i < _cameras.size(); i++) {
+        if(_cameras[i].isValid()) _nValidCams++;
+    }
+}
 
 void
 Reconstruction::init(const char *bundlerFileName, bool computeCamIndex)
@@ -562,131 +1346,514 @@ Reconstruction::init(const Camera::Vector &cameras, const Point::Vector &points)
     _cam2PointIndexInitialized = false;
     _cameras = cameras;
     _points = points;
+    _pointArrays.clear();
+    _compactPoints.clear();
+    _pointLayout = POINTS_AOS;
+    _nPointsInFile = points.size();
+    refreshCameraCaches();
     _updateNValidCams();
 }
 
 void
-Reconstruction::writeFile(const char *bundlerFileName) const
+Reconstruction::writeFile(const char *bundlerFileName, FileFormat format) const
 {
-    std::ofstream f(bundlerFileName);
-    f << std::scientific;
-    f << std::setprecision(16);
+    if(format == FORMAT_BINARY) _writeFileBinary(bundlerFileName);
+    else _writeFileASCII(bundlerFileName);
+}
 
-    const int nCameras = getNCameras();
-    const int nPoints = getNPoints();
+// Number of points formatted by a thread in one go when writing text files
+static const int POINTS_PER_WRITE_CHUNK = 16384;
+
+static
+void
+formatCamera(TextFormatter &f, const Camera &cam)
+{
+    f.appendDouble(cam.focalLength); f.append(' ');
+    f.appendDouble(cam.k1); f.append(' ');
+    f.appendDouble(cam.k2); f.append('\n');
 
-    // Header
-    f << "# Bundle file v0.3\n";
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 3; j++) {
+            f.appendDouble(cam.rotation(i, j));
+            f.append(j < 2 ? ' ' : '\n');
+        }
+    }
 
-    // # of cameras and points
-    f << nCameras << " " << getNPoints() << "\n";
+    for(int i = 0; i < 3; i++) {
+        f.appendDouble(cam.translation(i));
+        f.append(i < 2 ? ' ' : '\n');
+    }
+}
 
-    // Cameras
-    PROGBAR_START("Writing cameras");
-    for(int i = 0; i < nCameras; i++) {
-        PROGBAR_UPDATE(i, nCameras);
-        f << _cameras[i];
+static
+void
+formatPoint(TextFormatter &f, const Point &pnt)
+{
+    f.appendDouble(pnt.position[0]); f.append(' ');
+    f.appendDouble(pnt.position[1]); f.append(' ');
+    f.appendDouble(pnt.position[2]); f.append('\n');
+
+    // Color
+    f.appendInt(pnt.color.r); f.append(' ');
+    f.appendInt(pnt.color.g); f.append(' ');
+    f.appendInt(pnt.color.b); f.append('\n');
+
+    // View list
+    f.appendInt(pnt.viewList.size()); f.append(' ');
+    for(ViewListEntry::Vector::const_iterator it = pnt.viewList.begin(), itEnd = pnt.viewList.end(); it != itEnd; it++) {
+        f.appendInt(it->camera); f.append(' ');
+        f.appendInt(it->key); f.append(' ');
+        f.appendDouble(it->keyPosition(0)); f.append(' ');
+        f.appendDouble(it->keyPosition(1)); f.append(' ');
     }
+    f.append('\n');
+}
+
+static
+void
+writeBuffer(std::ostream &f, const std::string &buffer)
+{
+    f.write(buffer.data(), buffer.size());
+    if(!f.good()) throw sfmf::Error("Could not write bundle file");
+}
+
+static
+void
+formatHeader(TextFormatter &f, const Camera::Vector &cameras, int64_t nPoints)
+{
+    f.append("# Bundle file v0.3\n");
+    f.appendInt(cameras.size()); f.append(' ');
+    f.appendInt(nPoints); f.append('\n');
+    for(size_t i = 0; i < cameras.size(); i++) formatCamera(f, cameras[i]);
+}
+
+void
+Reconstruction::_writeFileASCII(const char *bundlerFileName) const
+{
+    CompressedFileWriter f(bundlerFileName);
+
+    const int64_t nPoints = getNPoints();
+
+    // Header and cameras
+    std::string buffer;
+    TextFormatter fmt(buffer);
+    formatHeader(fmt, _cameras, nPoints);
+    writeBuffer(f, buffer);
+
+    // Points are formatted in chunks, one buffer per chunk, a batch of
+    // chunks at a time in parallel. Buffers are written in order.
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    const int64_t nChunks = (nPoints + POINTS_PER_WRITE_CHUNK - 1) / POINTS_PER_WRITE_CHUNK;
+    std::vector<std::string> chunkBuffers(nThreads);
 
-    // Points
     PROGBAR_START("Writing points");
-    for(int i = 0; i < nPoints; i++) {
-        PROGBAR_UPDATE(i, nPoints);
-        f << std::scientific
-          << std::setprecision(16)
-          << _points[i].position[0] << " "
-          << _points[i].position[1] << " "
-          << _points[i].position[2] << "\n"
-          // Color
-          << int(_points[i].color.r) << " "
-          << int(_points[i].color.g) << " "
-          << int(_points[i].color.b) << "\n"
-          // View list
-          << _points[i].viewList.size() << " ";
-
-        // The view list
-        for(int j = 0, jEnd = _points[i].viewList.size(); j < jEnd; j++) {
-            f  << _points[i].viewList[j].camera << " "
-               << _points[i].viewList[j].key << " "
-               << _points[i].viewList[j].keyPosition(0) << " " << _points[i].viewList[j].keyPosition(1) << " ";
-            assert(_points[i].viewList[j].camera >= 0 && _points[i].viewList[j].camera < nCameras);
-        }
-        f << "\n";
+    for(int64_t batchStart = 0; batchStart < nChunks; batchStart += nThreads) {
+        PROGBAR_UPDATE(batchStart, nChunks);
+        const int batchSize = std::min<int64_t>(nThreads, nChunks - batchStart);
+
+        #pragma omp parallel for schedule(static, 1)
+        for(int c = 0; c < batchSize; c++) {
+            std::string &chunkBuffer = chunkBuffers[c];
+            chunkBuffer.clear();
+            TextFormatter chunkFmt(chunkBuffer);
+
+            int64_t begin = (batchStart + c) * POINTS_PER_WRITE_CHUNK;
+            int64_t end = std::min<int64_t>(nPoints, begin + POINTS_PER_WRITE_CHUNK);
+            Point pnt;
+            for(int64_t i = begin; i < end; i++) {
+                if(_pointLayout == POINTS_AOS) {
+                    formatPoint(chunkFmt, _points[i]);
+                } else {
+                    _copyPoint(i, pnt);
+                    formatPoint(chunkFmt, pnt);
+                }
+            }
+        }
+
+        for(int c = 0; c < batchSize; c++) writeBuffer(f, chunkBuffers[c]);
     }
 
     f.close();
 }
 
+// Converts buffered values to little endian, writes them and empties the buffer
+template<typename T>
+static
 void
-Reconstruction::readListFile(const char *listFName)
+flushValues(std::ostream &f, std::vector<T> &values)
+{
+    swapToLittleEndian(values.data(), values.size());
+    f.write((const char *)values.data(), values.size() * sizeof(T));
+    if(!f.good()) throw sfmf::Error("Could not write binary bundle file");
+    values.clear();
+}
+
+// Writes an array in file byte order
+template<typename T>
+static
+void
+writeValues(std::ostream &f, const T *values, size_t n)
+{
+    const size_t chunkSize = 1 << 16;
+    std::vector<T> chunk;
+    for(size_t i = 0; i < n; i += chunkSize) {
+        chunk.assign(values + i, values + std::min(n, i + chunkSize));
+        flushValues(f, chunk);
+    }
+}
+
+void
+Reconstruction::_writeFileBinary(const char *bundlerFileName) const
 {
-    _imageFNames.resize(this->getNCameras());
+    const int nCameras = getNCameras();
+    const int64_t nPoints = getNPoints();
+    const int chunkSize = 1 << 16;
+
+    BinaryHeader header;
+    header.nCameras = nCameras;
+    header.nPoints = nPoints;
+    if(_pointLayout == POINTS_SOA) header.nObservations = _pointArrays.getNObservations();
+    else if(_pointLayout == POINTS_COMPACT) header.nObservations = _compactPoints.getNObservations();
+    else for(long long i = 0; i < nPoints; i++) header.nObservations += _points[i].viewList.size();
+    BinaryLayout layout(header);
+
+    CompressedFileWriter f(bundlerFileName);
+
+    BinaryHeader fileHeader = header;
+    swapToLittleEndian(fileHeader);
+    f.write((const char *)&fileHeader, sizeof(fileHeader));
+
+    // Cameras
+    std::vector<double> doubles;
+    for(int i = 0; i < nCameras; i++) {
+        const Camera &cam = _cameras[i];
+        doubles.push_back(cam.focalLength);
+        doubles.push_back(cam.k1);
+        doubles.push_back(cam.k2);
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++) doubles.push_back(cam.rotation(r, c));
+        for(int r = 0; r < 3; r++) doubles.push_back(cam.translation(r));
+    }
+    flushValues(f, doubles);
+
+    if(_pointLayout == POINTS_SOA) {
+        // Sections are the arrays as they are
+        const PointArrays &arrays = _pointArrays;
+        writeValues(f, arrays.positions.data(), arrays.positions.size());
+        std::vector<uint8_t> bytes(arrays.colors);
+        bytes.resize(bytes.size() + (layout.offsets - layout.colors - 3 * uint64_t(nPoints)), 0);
+        flushValues(f, bytes);
+        writeValues(f, arrays.offsets.data(), arrays.offsets.size());
+        writeValues(f, arrays.observations.data(), arrays.observations.size());
+        f.close();
+        return;
+    }
+
+    if(_pointLayout == POINTS_COMPACT) {
+        // Values are expanded to full precision a chunk at a time
+        const CompactPointArrays &compact = _compactPoints;
+        for(long long i = 0; i < nPoints; i++) {
+            Eigen::Vector3d pos = compact.getPosition(i);
+            doubles.insert(doubles.end(), &pos[0], &pos[0] + 3);
+            if(doubles.size() >= 3 * chunkSize) flushValues(f, doubles);
+        }
+        flushValues(f, doubles);
+
+        std::vector<uint8_t> bytes(compact.colors);
+        bytes.resize(bytes.size() + (layout.offsets - layout.colors - 3 * uint64_t(nPoints)), 0);
+        flushValues(f, bytes);
+        writeValues(f, compact.offsets.data(), compact.offsets.size());
+
+        std::vector<BinaryObservation> observations;
+        for(uint64_t j = 0; j < header.nObservations; j++) {
+            BinaryObservation obs;
+            obs.camera = compact.getCamera(j);
+            obs.key = compact.keys[j];
+            obs.keyPosition[0] = compact.keyPositions[2 * j];
+            obs.keyPosition[1] = compact.keyPositions[2 * j + 1];
+            observations.push_back(obs);
+            if(observations.size() >= chunkSize) flushValues(f, observations);
+        }
+        flushValues(f, observations);
+        f.close();
+        return;
+    }
+
+    // Positions
+    for(long long i = 0; i < nPoints; i++) {
+        doubles.insert(doubles.end(), &_points[i].position[0], &_points[i].position[0] + 3);
+        if(doubles.size() >= 3 * chunkSize) flushValues(f, doubles);
+    }
+    flushValues(f, doubles);
+
+    // Colors, padded so the next section is aligned
+    std::vector<uint8_t> bytes;
+    for(long long i = 0; i < nPoints; i++) {
+        bytes.push_back(_points[i].color.r);
+        bytes.push_back(_points[i].color.g);
+        bytes.push_back(_points[i].color.b);
+        if(bytes.size() >= 3 * chunkSize) flushValues(f, bytes);
+    }
+    bytes.resize(bytes.size() + (layout.offsets - layout.colors - 3 * uint64_t(nPoints)), 0);
+    flushValues(f, bytes);
+
+    // View list offsets
+    std::vector<uint64_t> offsets;
+    uint64_t offset = 0;
+    for(long long i = 0; i < nPoints; i++) {
+        offsets.push_back(offset);
+        offset += _points[i].viewList.size();
+        if(offsets.size() >= chunkSize) flushValues(f, offsets);
+    }
+    offsets.push_back(offset);
+    flushValues(f, offsets);
+
+    // Observations
+    std::vector<BinaryObservation> observations;
+    for(long long i = 0; i < nPoints; i++) {
+        for(ViewListEntry::Vector::const_iterator it = _points[i].viewList.begin(), itEnd = _points[i].viewList.end(); it != itEnd; it++) {
+            BinaryObservation obs;
+            obs.camera = it->camera;
+            obs.key = it->key;
+            obs.keyPosition[0] = it->keyPosition(0);
+            obs.keyPosition[1] = it->keyPosition(1);
+            observations.push_back(obs);
+        }
+        if(observations.size() >= chunkSize) flushValues(f, observations);
+    }
+    flushValues(f, observations);
 
-    std::ifstream listF(listFName);
-    int i = 0;
-    for(i = 0; listF.good(); i++) {
-        char line[1000];
-        listF.getline(line, 1000);
-        if(!listF.good()) break;
+    f.close();
+}
 
-        if(i >= this->getNCameras()) {
-            _imageFNames.resize(0);
+void
+ListFile::readFile(const char *listFName)
+{
+    std::vector<char> buffer;
+    readFileIntoBuffer(listFName, buffer);
+
+    std::vector<Entry> entries;
+    const char *begin = buffer.data(), *end = begin + buffer.size();
+    for(const char *line = begin; line != end; ) {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if(lineEnd == NULL) lineEnd = end;
+
+        // Name is the first token, extra columns are whatever follows it
+        const char *p = line;
+        while(p != lineEnd && isspace(*p)) p++;
+        const char *name = p;
+        while(p != lineEnd && !isspace(*p)) p++;
+        const char *nameEnd = p;
+        while(p != lineEnd && isspace(*p)) p++;
+        const char *extra = p, *extraEnd = lineEnd;
+        while(extraEnd != extra && isspace(extraEnd[-1])) extraEnd--;
+
+        if(nameEnd - name > UINT32_MAX || extraEnd - extra > UINT32_MAX) {
             std::stringstream errMsg;
-            errMsg << "Bad list file: number of filenames exceeds the number of cameras";
+            errMsg << "Bad list file " << listFName << ": line " << entries.size() + 1 << " is too long";
             throw sfmf::Error(errMsg.str());
         }
 
-        std::istringstream lineStream(line);
-        std::string fname;
-        lineStream >> fname;
-        _imageFNames[i] = fname;
+        Entry entry;
+        entry.name = name - begin;
+        entry.nameLength = nameEnd - name;
+        entry.extra = extra - begin;
+        entry.extraLength = extraEnd - extra;
+        entries.push_back(entry);
+
+        line = (lineEnd == end) ? end : lineEnd + 1;
     }
 
-    if( i < this->getNCameras() ) {
-        _imageFNames.resize(0);
+    _arena.swap(buffer);
+    _entries.swap(entries);
+    _buildIndex();
+}
+
+void
+ListFile::writeFile(const char *listFName) const
+{
+    CompressedFileWriter listF(listFName);
+    if(!listF.good()) {
         std::stringstream errMsg;
-        errMsg << "Bad list file: number of filenames smaller than number of cameras (" << i << " vs " << this->getNCameras() << ")";
+        errMsg << "Could not open file " << listFName << " for writting";
         throw sfmf::Error(errMsg.str());
     }
 
-    _listFName = std::string(listFName);
+    for(size_t i = 0; i < size(); i++) {
+        StringRef fname = getFileName(i), extra = getExtra(i);
+        listF.write(fname.data(), fname.size());
+        if(!extra.empty()) {
+            listF.put(' ');
+            listF.write(extra.data(), extra.size());
+        }
+        listF.put('\n');
+    }
+
+    listF.close();
+}
+
+ListFile &
+ListFile::operator=(const ListFile &other)
+{
+    if(this != &other) {
+        _arena = other._arena;
+        _entries = other._entries;
+        _indexValid = false;
+    }
+    return *this;
 }
 
 void
-Reconstruction::writeListFile(const char *listFName) const
+ListFile::clear()
 {
-    std::ofstream listF(listFName);
-    if(!listF.good()) {
+    _arena.clear();
+    _entries.clear();
+    _indexValid = false;
+}
+
+void
+ListFile::swap(ListFile &other)
+{
+    _arena.swap(other._arena);
+    _entries.swap(other._entries);
+    _byName.swap(other._byName);
+    _byBasename.swap(other._byBasename);
+    std::swap(_indexValid, other._indexValid);
+}
+
+double
+ListFile::getFocal(size_t idx) const
+{
+    // Extra columns are "0 focal"
+    StringRef extra = getExtra(idx);
+    TextScanner scanner(extra.data(), extra.data() + extra.size());
+    int zero;
+    double focal;
+    if(!scanner.readInt(zero) || !scanner.readDouble(focal)) return 0;
+    return focal;
+}
+
+void
+ListFile::push_back(StringRef fname, StringRef extra)
+{
+    Entry entry;
+    entry.name = _arena.size();
+    entry.nameLength = fname.size();
+    _arena.insert(_arena.end(), fname.begin(), fname.end());
+    entry.extra = _arena.size();
+    entry.extraLength = extra.size();
+    _arena.insert(_arena.end(), extra.begin(), extra.end());
+
+    _entries.push_back(entry);
+    _indexValid = false;
+}
+
+void
+ListFile::select(const std::vector<int> &idxs)
+{
+    ListFile selected;
+    size_t arenaSize = 0;
+    for(size_t i = 0; i < idxs.size(); i++) {
+        arenaSize += _entries[idxs[i]].nameLength + _entries[idxs[i]].extraLength;
+    }
+    selected._arena.reserve(arenaSize);
+    selected._entries.reserve(idxs.size());
+
+    for(size_t i = 0; i < idxs.size(); i++) {
+        selected.push_back(getFileName(idxs[i]), getExtra(idxs[i]));
+    }
+    swap(selected);
+}
+
+ListFile::StringRef
+ListFile::basename(StringRef fname)
+{
+    size_t slash = fname.find_last_of('/');
+    if(slash == StringRef::npos) return fname;
+    return fname.substr(slash + 1);
+}
+
+int
+ListFile::find(StringRef name) const
+{
+    if(!_indexValid) _buildIndex();
+
+    Index::const_iterator it = _byName.find(name);
+    if(it != _byName.end()) return it->second;
+
+    it = _byBasename.find(basename(name));
+    if(it != _byBasename.end()) return it->second;
+    return -1;
+}
+
+void
+ListFile::_buildIndex() const
+{
+    _byName.clear();
+    _byBasename.clear();
+    _byName.reserve(size());
+    _byBasename.reserve(size());
+
+    for(size_t i = 0; i < size(); i++) {
+        StringRef fname = getFileName(i);
+        // First occurrence of a name wins, shared basenames are ambiguous
+        _byName.insert(std::make_pair(fname, int(i)));
+        std::pair<Index::iterator, bool> res = _byBasename.insert(std::make_pair(basename(fname), int(i)));
+        if(!res.second) res.first->second = -1;
+    }
+    _indexValid = true;
+}
+
+void
+Reconstruction::readListFile(const char *listFName)
+{
+    ListFile list(listFName);
+
+    if(int(list.size()) > this->getNCameras()) {
         std::stringstream errMsg;
-        errMsg << "Could not open file " << listFName << " for writting";
+        errMsg << "Bad list file: number of filenames exceeds the number of cameras";
         throw sfmf::Error(errMsg.str());
     }
 
-    for(std::vector<std::string>::const_iterator fname = _imageFNames.begin(); fname != _imageFNames.end(); fname++ ) {
-        listF << (*fname) << "\n";
+    if(int(list.size()) < this->getNCameras()) {
+        std::stringstream errMsg;
+        errMsg << "Bad list file: number of filenames smaller than number of cameras (" << list.size() << " vs " << this->getNCameras() << ")";
+        throw sfmf::Error(errMsg.str());
     }
+
+    _imageList.swap(list);
+    _listFName = std::string(listFName);
+}
+
+void
+Reconstruction::writeListFile(const char *listFName) const
+{
+    _imageList.writeFile(listFName);
 }
 
 bool
 Reconstruction::listFileLoaded() const
 {
-    return _imageFNames.size() != 0;
+    return !_imageList.empty();
 }
 
 Reconstruction::Reconstruction(const char *bundlerFileName, const char *listFileName, bool computeCam2PointIndex):
-    _nValidCams(0)
+    _nValidCams(0), _nPointsInFile(0), _pointLayout(POINTS_AOS)
 {
     init(bundlerFileName, listFileName, computeCam2PointIndex);
 }
 
 Reconstruction::Reconstruction(const char *bundlerFileName, bool computeCam2PointIndex):
-    _nValidCams(0)
+    _nValidCams(0), _nPointsInFile(0), _pointLayout(POINTS_AOS)
 {
     init(bundlerFileName, computeCam2PointIndex);
 }
 
 Reconstruction::Reconstruction(const Camera::Vector &cameras, const Point::Vector &points):
-    _nValidCams(0)
+    _nValidCams(0), _nPointsInFile(0), _pointLayout(POINTS_AOS)
 {
     init(cameras, points);
 }
@@ -712,38 +1879,773 @@ Reconstruction::New(const char *bundleFileName, bool computeCam2PointIndex)
     return result;
 }
 
-void
-Reconstruction::buildCam2PointIndex()
+// Adapters that give the same view of the observations for both point layouts
+class PointVectorObservations
 {
-    if(_cam2PointIndexInitialized) return;
+public:
+    PointVectorObservations(const Point::Vector &points): _points(points) {}
+    size_t size() const { return _points.size(); }
+    size_t viewListSize(size_t pntIdx) const { return _points[pntIdx].viewList.size(); }
+    int camera(size_t pntIdx, size_t i) const { return _points[pntIdx].viewList[i].camera; }
+
+private:
+    const Point::Vector &_points;
+};
 
-    int pntIdx = 0;
-    for(Point::Vector::iterator pnt = _points.begin(), pntEnd = _points.end(); pnt != pntEnd; pnt++, pntIdx++) {
-        int peIdx = 0;
-        for(ViewListEntry::Vector::iterator pe = pnt->viewList.begin(), peEnd = pnt->viewList.end(); pe != peEnd; pe++, peIdx++) {
+class PointArraysObservations
+{
+public:
+    PointArraysObservations(const PointArrays &arrays): _arrays(arrays) {}
+    size_t size() const { return _arrays.size(); }
+    size_t viewListSize(size_t pntIdx) const { return _arrays.offsets[pntIdx + 1] - _arrays.offsets[pntIdx]; }
+    int camera(size_t pntIdx, size_t i) const { return _arrays.observations[_arrays.offsets[pntIdx] + i].camera; }
 
-            PointVisListIdxs entry;
-            entry.visibilityListIdx = peIdx;
-            entry.pointIdx = pntIdx;
+private:
+    const PointArrays &_arrays;
+};
 
-            _cameras[pe->camera].visiblePoints.push_back(entry);
+class CompactObservations
+{
+public:
+    CompactObservations(const CompactPointArrays &compact): _compact(compact) {}
+    size_t size() const { return _compact.size(); }
+    size_t viewListSize(size_t pntIdx) const { return _compact.offsets[pntIdx + 1] - _compact.offsets[pntIdx]; }
+    int camera(size_t pntIdx, size_t i) const { return _compact.getCamera(_compact.offsets[pntIdx] + i); }
+
+private:
+    const CompactPointArrays &_compact;
+};
+
+// Builds the camera to point index in two passes over the points. Each
+// thread takes a contiguous range of points and counts its observations
+// per camera, from the counts every thread gets its own output position
+// inside each camera row, then observations are scattered. Threads
+// handle ranges in order, so rows come out sorted by point index.
+template<typename Observations>
+static
+void
+buildCSRIndex(const Observations &obs, int nCameras, std::vector<uint64_t> &offsets, std::vector<PointVisListIdxs> &entries)
+{
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    const size_t nPoints = obs.size();
+    nThreads = std::max(1, std::min<int>(nThreads, nPoints / 1024));
+
+    // counts[t * nCameras + c]: observations of camera c in the range of thread t
+    std::vector<uint64_t> counts(size_t(nThreads) * nCameras, 0);
+#pragma omp parallel for num_threads(nThreads) schedule(static, 1)
+    for(int t = 0; t < nThreads; t++) {
+        uint64_t *tCounts = &counts[size_t(t) * nCameras];
+        for(size_t i = nPoints * t / nThreads, iEnd = nPoints * (t + 1) / nThreads; i < iEnd; i++) {
+            for(size_t j = 0, n = obs.viewListSize(i); j < n; j++) tCounts[obs.camera(i, j)]++;
         }
     }
 
-    _cam2PointIndexInitialized = true;
+    // Row offsets, counts become the first output position of each thread
+    offsets.assign(nCameras + 1, 0);
+    uint64_t total = 0;
+    for(int c = 0; c < nCameras; c++) {
+        offsets[c] = total;
+        for(int t = 0; t < nThreads; t++) {
+            uint64_t n = counts[size_t(t) * nCameras + c];
+            counts[size_t(t) * nCameras + c] = total;
+            total += n;
+        }
+    }
+    offsets[nCameras] = total;
+
+    entries.resize(total);
+#pragma omp parallel for num_threads(nThreads) schedule(static, 1)
+    for(int t = 0; t < nThreads; t++) {
+        uint64_t *cursor = &counts[size_t(t) * nCameras];
+        for(size_t i = nPoints * t / nThreads, iEnd = nPoints * (t + 1) / nThreads; i < iEnd; i++) {
+            for(size_t j = 0, n = obs.viewListSize(i); j < n; j++) {
+                PointVisListIdxs &entry = entries[cursor[obs.camera(i, j)]++];
+                entry.pointIdx = i;
+                entry.visibilityListIdx = j;
+            }
+        }
+    }
 }
 
-int
-Reconstruction::getImageSizeForCamera(int camIdx, int &width, int &height, bool throwException) const
+void
+Reconstruction::buildCam2PointIndex()
 {
-    assert(listFileLoaded());
-    return getImageSize(_imageFNames[camIdx].c_str(), width, height, throwException);
+    if(_cam2PointIndexInitialized) return;
+
+    if(_pointLayout == POINTS_SOA) {
+        buildCSRIndex(PointArraysObservations(_pointArrays), getNCameras(), _cam2PointOffsets, _cam2Point);
+    } else if(_pointLayout == POINTS_COMPACT) {
+        buildCSRIndex(CompactObservations(_compactPoints), getNCameras(), _cam2PointOffsets, _cam2Point);
+    } else {
+        buildCSRIndex(PointVectorObservations(_points), getNCameras(), _cam2PointOffsets, _cam2Point);
+    }
+
+    _cam2PointIndexInitialized = true;
 }
 
-int
+// Observations stored one view list after the other (PointArrays and
+// CompactPointArrays), seen through the same interface for editing
+class PackedObservationsEditor
+{
+public:
+    PackedObservationsEditor(std::vector<PackedViewListEntry> &obs): _obs(obs) {}
+    int camera(uint64_t obsIdx) const { return _obs[obsIdx].camera; }
+    void setCamera(uint64_t obsIdx, int camIdx) { _obs[obsIdx].camera = camIdx; }
+    void move(uint64_t dst, uint64_t src) { _obs[dst] = _obs[src]; }
+    void resize(uint64_t n) { _obs.resize(n); }
+
+private:
+    std::vector<PackedViewListEntry> &_obs;
+};
+
+class CompactObservationsEditor
+{
+public:
+    CompactObservationsEditor(CompactPointArrays &compact): _compact(compact) {}
+    int camera(uint64_t obsIdx) const { return _compact.getCamera(obsIdx); }
+
+    void setCamera(uint64_t obsIdx, int camIdx)
+    {
+        if(_compact.wideCameras) _compact.cameras32[obsIdx] = camIdx;
+        else _compact.cameras16[obsIdx] = camIdx;
+    }
+
+    void move(uint64_t dst, uint64_t src)
+    {
+        if(_compact.wideCameras) _compact.cameras32[dst] = _compact.cameras32[src];
+        else _compact.cameras16[dst] = _compact.cameras16[src];
+        _compact.keys[dst] = _compact.keys[src];
+        _compact.keyPositions[2 * dst] = _compact.keyPositions[2 * src];
+        _compact.keyPositions[2 * dst + 1] = _compact.keyPositions[2 * src + 1];
+    }
+
+    void resize(uint64_t n)
+    {
+        if(_compact.wideCameras) _compact.cameras32.resize(n);
+        else _compact.cameras16.resize(n);
+        _compact.keys.resize(n);
+        _compact.keyPositions.resize(2 * n);
+    }
+
+private:
+    CompactPointArrays &_compact;
+};
+
+// Every view list is compacted in place at the beginning of its range
+// in parallel, then the lists are moved down to close the gaps. Camera c
+// of observation j becomes camera remap(j, c), observations for which it
+// is negative are removed.
+template<typename Editor, typename Remap>
+static
+void
+remapObservations(Editor obs, std::vector<uint64_t> &offsets, Remap remap)
+{
+    const long long nPoints = offsets.size() - 1;
+    std::vector<uint64_t> counts(nPoints);
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        uint64_t dst = offsets[i];
+        for(uint64_t j = offsets[i]; j < offsets[i + 1]; j++) {
+            int camIdx = remap(j, obs.camera(j));
+            if(camIdx < 0) continue;
+            obs.move(dst, j);
+            obs.setCamera(dst, camIdx);
+            dst++;
+        }
+        counts[i] = dst - offsets[i];
+    }
+
+    uint64_t nObs = 0;
+    for(long long i = 0; i < nPoints; i++) {
+        const uint64_t begin = offsets[i];
+        offsets[i] = nObs;
+        if(begin != nObs) {
+            for(uint64_t j = 0; j < counts[i]; j++) obs.move(nObs + j, begin + j);
+        }
+        nObs += counts[i];
+    }
+    offsets[nPoints] = nObs;
+    obs.resize(nObs);
+}
+
+// Works on both PointArrays and CompactPointArrays, points that are
+// kept are moved down over the removed ones
+template<typename Arrays, typename Editor>
+static
+void
+removeArrayPoints(Arrays &arrays, Editor obs, const std::vector<char> &remove)
+{
+    const size_t nPoints = arrays.size();
+    size_t nKept = 0;
+    uint64_t nObs = 0;
+    for(size_t i = 0; i < nPoints; i++) {
+        if(remove[i]) continue;
+
+        const uint64_t begin = arrays.offsets[i], end = arrays.offsets[i + 1];
+        if(nKept != i) {
+            std::copy(&arrays.positions[3 * i], &arrays.positions[3 * i] + 3, &arrays.positions[3 * nKept]);
+            std::copy(&arrays.colors[3 * i], &arrays.colors[3 * i] + 3, &arrays.colors[3 * nKept]);
+            for(uint64_t j = begin; j < end; j++) obs.move(nObs + j - begin, j);
+        }
+        arrays.offsets[nKept] = nObs;
+        nObs += end - begin;
+        nKept++;
+    }
+    arrays.offsets[nKept] = nObs;
+
+    arrays.positions.resize(3 * nKept);
+    arrays.colors.resize(3 * nKept);
+    arrays.offsets.resize(nKept + 1);
+    obs.resize(nObs);
+}
+
+void
+Reconstruction::remapCameras(const std::vector<int> &table)
+{
+    if(table.size() != _cameras.size()) {
+        std::stringstream err;
+        err << "Camera remapping table has " << table.size() << " entries, expected " << _cameras.size();
+        throw sfmf::Error(err.str());
+    }
+
+    // Original index of each camera that is kept
+    int nKept = 0;
+    for(size_t i = 0; i < table.size(); i++) {
+        if(table[i] >= 0) nKept++;
+    }
+    std::vector<int> oldIdxs(nKept, -1);
+    for(size_t i = 0; i < table.size(); i++) {
+        if(table[i] < 0) continue;
+        if(table[i] >= nKept || oldIdxs[table[i]] != -1) {
+            std::stringstream err;
+            err << "Bad camera remapping table, new index " << table[i] << " of camera " << i << " is out of range or repeated";
+            throw sfmf::Error(err.str());
+        }
+        oldIdxs[table[i]] = i;
+    }
+
+    Camera::Vector cameras(nKept);
+    for(int i = 0; i < nKept; i++) cameras[i] = _cameras[oldIdxs[i]];
+    _cameras.swap(cameras);
+    if(listFileLoaded()) _imageList.select(oldIdxs);
+
+    _remapObservations([&](uint64_t, int camIdx) { return table[camIdx]; });
+    _updateNValidCams();
+}
+
+void
+Reconstruction::removeObservations(const std::vector<bool> &mask)
+{
+    _remapObservations([&](uint64_t obsIdx, int camIdx) { return (obsIdx < mask.size() && mask[obsIdx]) ? -1 : camIdx; });
+}
+
+template<typename Remap>
+void
+Reconstruction::_remapObservations(Remap remap)
+{
+    if(_pointLayout == POINTS_SOA) {
+        remapObservations(PackedObservationsEditor(_pointArrays.observations), _pointArrays.offsets, remap);
+    } else if(_pointLayout == POINTS_COMPACT) {
+        remapObservations(CompactObservationsEditor(_compactPoints), _compactPoints.offsets, remap);
+    } else {
+        // Observations are numbered across the view lists
+        const long long nPoints = _points.size();
+        std::vector<uint64_t> offsets(nPoints + 1, 0);
+        for(long long i = 0; i < nPoints; i++) offsets[i + 1] = offsets[i] + _points[i].viewList.size();
+
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i < nPoints; i++) {
+            ViewListEntry::Vector &viewList = _points[i].viewList;
+            size_t nEntries = 0;
+            for(size_t j = 0; j < viewList.size(); j++) {
+                int camIdx = remap(offsets[i] + j, viewList[j].camera);
+                if(camIdx < 0) continue;
+                viewList[nEntries] = viewList[j];
+                viewList[nEntries].camera = camIdx;
+                nEntries++;
+            }
+            viewList.resize(nEntries);
+        }
+    }
+
+    if(_cam2PointIndexInitialized) {
+        _cam2PointIndexInitialized = false;
+        buildCam2PointIndex();
+    }
+}
+
+void
+Reconstruction::removeCameras(const std::vector<bool> &mask)
+{
+    std::vector<int> table(_cameras.size(), -1);
+    for(int i = 0, newIdx = 0; i < int(table.size()); i++) {
+        if(i >= int(mask.size()) || !mask[i]) table[i] = newIdx++;
+    }
+    remapCameras(table);
+}
+
+void
+Reconstruction::removePoints(const std::vector<bool> &mask)
+{
+    std::vector<char> remove(getNPoints(), 0);
+    for(size_t i = 0; i < remove.size() && i < mask.size(); i++) remove[i] = mask[i];
+    _removePoints(remove);
+}
+
+void
+Reconstruction::_removePoints(const std::vector<char> &remove)
+{
+    if(_pointLayout == POINTS_SOA) {
+        removeArrayPoints(_pointArrays, PackedObservationsEditor(_pointArrays.observations), remove);
+    } else if(_pointLayout == POINTS_COMPACT) {
+        removeArrayPoints(_compactPoints, CompactObservationsEditor(_compactPoints), remove);
+    } else {
+        // Only the view list pointers move
+        size_t nKept = 0;
+        for(size_t i = 0; i < _points.size(); i++) {
+            if(remove[i]) continue;
+            if(nKept != i) {
+                _points[nKept].position = _points[i].position;
+                _points[nKept].color = _points[i].color;
+                _points[nKept].viewList.swap(_points[i].viewList);
+            }
+            nKept++;
+        }
+        _points.resize(nKept);
+    }
+
+    if(_cam2PointIndexInitialized) {
+        _cam2PointIndexInitialized = false;
+        buildCam2PointIndex();
+    }
+}
+
+// Helpers for permuteArrayPoints(), observations of PointArrays and
+// CompactPointArrays are stored differently
+static
+void
+resizeObservationsLike(PointArrays &dst, const PointArrays &src)
+{
+    dst.observations.resize(src.observations.size());
+}
+
+static
+void
+resizeObservationsLike(CompactPointArrays &dst, const CompactPointArrays &src)
+{
+    dst.origin = src.origin;
+    dst.wideCameras = src.wideCameras;
+    dst.cameras16.resize(src.cameras16.size());
+    dst.cameras32.resize(src.cameras32.size());
+    dst.keys.resize(src.keys.size());
+    dst.keyPositions.resize(src.keyPositions.size());
+}
+
+static
+void
+copyObservations(PointArrays &dst, uint64_t dstIdx, const PointArrays &src, uint64_t srcIdx, uint64_t n)
+{
+    std::copy(&src.observations[srcIdx], &src.observations[srcIdx] + n, &dst.observations[dstIdx]);
+}
+
+static
+void
+copyObservations(CompactPointArrays &dst, uint64_t dstIdx, const CompactPointArrays &src, uint64_t srcIdx, uint64_t n)
+{
+    if(src.wideCameras) std::copy(&src.cameras32[srcIdx], &src.cameras32[srcIdx] + n, &dst.cameras32[dstIdx]);
+    else std::copy(&src.cameras16[srcIdx], &src.cameras16[srcIdx] + n, &dst.cameras16[dstIdx]);
+    std::copy(&src.keys[srcIdx], &src.keys[srcIdx] + n, &dst.keys[dstIdx]);
+    std::copy(&src.keyPositions[2 * srcIdx], &src.keyPositions[2 * srcIdx] + 2 * n, &dst.keyPositions[2 * dstIdx]);
+}
+
+// Gathers the points in the given order (order[i] is the old index of
+// point i) into new arrays, each point is copied by one thread
+template<typename Arrays>
+static
+void
+permuteArrayPoints(Arrays &arrays, const std::vector<int64_t> &order)
+{
+    const long long nPoints = arrays.size();
+
+    Arrays sorted;
+    sorted.positions.resize(arrays.positions.size());
+    sorted.colors.resize(arrays.colors.size());
+    sorted.offsets.resize(nPoints + 1);
+    resizeObservationsLike(sorted, arrays);
+
+    sorted.offsets[0] = 0;
+    for(long long i = 0; i < nPoints; i++) {
+        sorted.offsets[i + 1] = sorted.offsets[i] + arrays.offsets[order[i] + 1] - arrays.offsets[order[i]];
+    }
+
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPoints; i++) {
+        const int64_t j = order[i];
+        std::copy(&arrays.positions[3 * j], &arrays.positions[3 * j] + 3, &sorted.positions[3 * i]);
+        std::copy(&arrays.colors[3 * j], &arrays.colors[3 * j] + 3, &sorted.colors[3 * i]);
+        copyObservations(sorted, sorted.offsets[i], arrays, arrays.offsets[j], arrays.offsets[j + 1] - arrays.offsets[j]);
+    }
+
+    arrays.swap(sorted);
+}
+
+std::vector<int64_t>
+Reconstruction::reorderSpatially(SpaceFillingCurve curve)
+{
+    const int64_t nPoints = getNPoints();
+    std::vector<int64_t> order;
+
+    if(_pointLayout == POINTS_SOA) {
+        const double *positions = _pointArrays.positions.data();
+        spatialOrder(nPoints, [positions](int64_t i) { return positions + 3 * i; }, curve, order);
+        permuteArrayPoints(_pointArrays, order);
+    } else if(_pointLayout == POINTS_COMPACT) {
+        // Relative positions, the origin does not change the order
+        const float *positions = _compactPoints.positions.data();
+        spatialOrder(nPoints, [positions](int64_t i) { return positions + 3 * i; }, curve, order);
+        permuteArrayPoints(_compactPoints, order);
+    } else {
+        const Point::Vector &points = _points;
+        spatialOrder(nPoints, [&points](int64_t i) -> const Eigen::Vector3d & { return points[i].position; }, curve, order);
+
+        // Only the view list pointers move
+        Point::Vector sorted(nPoints);
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i < nPoints; i++) {
+            Point &pnt = _points[order[i]];
+            sorted[i].position = pnt.position;
+            sorted[i].color = pnt.color;
+            sorted[i].viewList.swap(pnt.viewList);
+        }
+        _points.swap(sorted);
+    }
+
+    if(_cam2PointIndexInitialized) {
+        _cam2PointIndexInitialized = false;
+        buildCam2PointIndex();
+    }
+
+    std::vector<int64_t> table;
+    invertPermutation(order, table);
+    return table;
+}
+
+void
+Reconstruction::transform(const Eigen::Matrix4d &trans)
+{
+    if(_pointLayout == POINTS_SOA) {
+        _pointArrays.transform(trans);
+    } else if(_pointLayout == POINTS_COMPACT) {
+        // Positions are relative to the origin, only the linear part applies to them
+        const Eigen::Matrix3f linear = trans.block<3, 3>(0, 0).cast<float>();
+        _compactPoints.origin = trans.block<3, 3>(0, 0) * _compactPoints.origin + trans.block<3, 1>(0, 3);
+        float *p = _compactPoints.positions.data();
+        const long long nPoints = _compactPoints.size();
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i < nPoints; i++) {
+            Eigen::Map<Eigen::Vector3f> pos(p + 3 * i);
+            pos = linear * Eigen::Vector3f(pos);
+        }
+    } else {
+        const long long nPoints = _points.size();
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i < nPoints; i++) {
+            Eigen::Vector4d p(_points[i].position[0], _points[i].position[1], _points[i].position[2], 1.0);
+            p = trans * p;
+            for(int j = 0; j < 3; j++) _points[i].position[j] = p[j];
+        }
+    }
+
+    for(size_t i = 0; i < _cameras.size(); i++) _cameras[i].transform(trans);
+}
+
+void
+Reconstruction::refreshCameraCaches()
+{
+    const long long nCams = _cameras.size();
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nCams; i++) _cameras[i].refreshCache();
+}
+
+void
+Reconstruction::refreshCameraCaches(const std::vector<Eigen::Vector2i> &imageSizes)
+{
+    if(imageSizes.size() != _cameras.size()) {
+        std::stringstream err;
+        err << "Got " << imageSizes.size() << " image sizes for " << _cameras.size() << " cameras";
+        throw sfmf::Error(err.str());
+    }
+
+    const long long nCams = _cameras.size();
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nCams; i++) _cameras[i].refreshCache(imageSizes[i][0], imageSizes[i][1]);
+}
+
+const double *
+Reconstruction::_getPositions(int64_t first, int64_t n, std::vector<double> &buffer) const
+{
+    if(_pointLayout == POINTS_SOA) return &_pointArrays.positions[3 * first];
+
+    buffer.resize(3 * n);
+    if(_pointLayout == POINTS_COMPACT) {
+        for(int64_t i = 0; i < n; i++) {
+            const Eigen::Vector3d pos = _compactPoints.getPosition(first + i);
+            std::copy(pos.data(), pos.data() + 3, &buffer[3 * i]);
+        }
+    } else {
+        for(int64_t i = 0; i < n; i++) {
+            const Eigen::Vector3d &pos = _points[first + i].position;
+            std::copy(pos.data(), pos.data() + 3, &buffer[3 * i]);
+        }
+    }
+    return buffer.data();
+}
+
+void
+Reconstruction::computeVisibility(Visibility &vis, const VisibilityOptions &opts) const
+{
+    const int nCams = getNCameras();
+    const int64_t nPoints = getNPoints();
+    const int64_t blockSize = std::max(1, opts.blockSize);
+    const int64_t nBlocks = (nPoints + blockSize - 1) / blockSize;
+
+    std::vector<Eigen::Vector2i> sizes(nCams, Eigen::Vector2i(0, 0));
+    if(!opts.imageSizes.empty()) {
+        if(int(opts.imageSizes.size()) != nCams) {
+            std::stringstream err;
+            err << "Got " << opts.imageSizes.size() << " image sizes for " << nCams << " cameras";
+            throw sfmf::Error(err.str());
+        }
+        sizes = opts.imageSizes;
+    } else if(listFileLoaded()) {
+        int nUnknown = 0;
+        for(int c = 0; c < nCams; c++) {
+            if(!getImageSizeForCamera(c, sizes[c][0], sizes[c][1], false)) {
+                sizes[c].setZero();
+                nUnknown++;
+            }
+        }
+        if(nUnknown > 0) LOG_WARN("Could not read the size of " << nUnknown << " images, their cameras see everything in front of them");
+    }
+
+    // Bounding box of each block, non finite coordinates are left out
+    // (those points are never visible)
+    std::vector<double> boxes(6 * nBlocks);
+#pragma omp parallel
+    {
+        std::vector<double> buffer;
+#pragma omp for schedule(static)
+        for(long long b = 0; b < nBlocks; b++) {
+            const int64_t first = b * blockSize, n = std::min(blockSize, nPoints - first);
+            const double *pos = _getPositions(first, n, buffer);
+            double *box = &boxes[6 * b];
+            for(int j = 0; j < 3; j++) {
+                box[j] = std::numeric_limits<double>::max();
+                box[3 + j] = -std::numeric_limits<double>::max();
+            }
+            for(int64_t i = 0; i < n; i++) {
+                for(int j = 0; j < 3; j++) {
+                    if(pos[3 * i + j] < box[j]) box[j] = pos[3 * i + j];
+                    if(pos[3 * i + j] > box[3 + j]) box[3 + j] = pos[3 * i + j];
+                }
+            }
+        }
+    }
+
+    // One task per camera and range of blocks, so there is enough work
+    // for every thread even with few cameras
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    const int64_t nRanges = std::max<int64_t>(1, std::min<int64_t>(nBlocks, (4 * nThreads + nCams - 1) / std::max(1, nCams)));
+    const long long nTasks = nCams * nRanges;
+    std::vector<std::vector<int64_t> > found(nTasks);
+
+#pragma omp parallel
+    {
+        std::vector<double> buffer, im;
+        std::vector<uint8_t> visible;
+#pragma omp for schedule(dynamic, 1)
+        for(long long task = 0; task < nTasks; task++) {
+            const int c = task / nRanges;
+            const int64_t r = task % nRanges;
+            if(!_cameras[c].isValid()) continue;
+
+            ProjectionParams params(_cameras[c], opts.applyRadialDistortion, sizes[c][0], sizes[c][1]);
+            Frustum frustum(params);
+            for(int64_t b = nBlocks * r / nRanges, bEnd = nBlocks * (r + 1) / nRanges; b < bEnd; b++) {
+                if(frustum.boxOutside(&boxes[6 * b])) continue;
+
+                const int64_t first = b * blockSize, n = std::min(blockSize, nPoints - first);
+                im.resize(2 * n);
+                visible.resize(n);
+                if(projectPoints(params, _getPositions(first, n, buffer), n, im.data(), visible.data()) == 0) continue;
+                for(int64_t i = 0; i < n; i++) {
+                    if(visible[i]) found[task].push_back(first + i);
+                }
+            }
+        }
+    }
+
+    vis.offsets.assign(nCams + 1, 0);
+    std::vector<uint64_t> taskOffsets(nTasks + 1, 0);
+    for(long long task = 0; task < nTasks; task++) taskOffsets[task + 1] = taskOffsets[task] + found[task].size();
+    for(int c = 0; c <= nCams; c++) vis.offsets[c] = taskOffsets[c * nRanges];
+
+    vis.points.resize(taskOffsets[nTasks]);
+#pragma omp parallel for schedule(dynamic, 1)
+    for(long long task = 0; task < nTasks; task++) {
+        std::copy(found[task].begin(), found[task].end(), vis.points.begin() + taskOffsets[task]);
+    }
+}
+
+// Running sums behind a ReprojectionErrors::Summary
+class ErrorAccumulator
+{
+public:
+    uint64_t n, nBehind;
+    double sum, sum2, max;
+
+    ErrorAccumulator(): n(0), nBehind(0), sum(0), sum2(0), max(0) {}
+
+    void add(double err, bool inFront)
+    {
+        if(inFront) {
+            n++;
+            sum += err;
+            sum2 += err * err;
+        } else {
+            nBehind++;
+        }
+        if(err > max) max = err;
+    }
+
+    void add(const ErrorAccumulator &other)
+    {
+        n += other.n;
+        nBehind += other.nBehind;
+        sum += other.sum;
+        sum2 += other.sum2;
+        max = std::max(max, other.max);
+    }
+
+    void get(ReprojectionErrors::Summary &summary) const
+    {
+        summary.nObservations = n;
+        summary.nBehind = nBehind;
+        summary.mean = n > 0 ? sum / n : 0.0;
+        summary.rms = n > 0 ? std::sqrt(sum2 / n) : 0.0;
+        summary.max = max;
+    }
+};
+
+void
+Reconstruction::computeReprojectionErrors(ReprojectionErrors &errors, bool applyRadialDistortion) const
+{
+    const int nCams = getNCameras();
+    const long long nPoints = getNPoints();
+
+    errors.offsets.resize(nPoints + 1);
+    if(_pointLayout == POINTS_SOA) {
+        errors.offsets = _pointArrays.offsets;
+    } else if(_pointLayout == POINTS_COMPACT) {
+        errors.offsets = _compactPoints.offsets;
+    } else {
+        errors.offsets[0] = 0;
+        for(long long i = 0; i < nPoints; i++) errors.offsets[i + 1] = errors.offsets[i] + _points[i].viewList.size();
+    }
+    const uint64_t nObs = errors.offsets[nPoints];
+    errors.residuals.resize(2 * nObs);
+    errors.errors.resize(nObs);
+    errors.points.resize(nPoints);
+
+    // Centered image coordinates, no bounds to check
+    std::vector<ProjectionParams> params;
+    params.reserve(nCams);
+    for(int c = 0; c < nCams; c++) params.push_back(ProjectionParams(_cameras[c], applyRadialDistortion, 0, 0));
+
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    std::vector<std::vector<ErrorAccumulator> > camAccs(nThreads);
+
+#pragma omp parallel
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        std::vector<ErrorAccumulator> &camAcc = camAccs[thread];
+        camAcc.resize(nCams);
+        std::vector<double> buffer;
+
+#pragma omp for schedule(static)
+        for(long long i = 0; i < nPoints; i++) {
+            const double *pos = _getPositions(i, 1, buffer);
+            ErrorAccumulator pntAcc;
+            for(uint64_t j = errors.offsets[i], k = 0; j < errors.offsets[i + 1]; j++, k++) {
+                int camIdx;
+                double key[2];
+                if(_pointLayout == POINTS_SOA) {
+                    const PackedViewListEntry &obs = _pointArrays.observations[j];
+                    camIdx = obs.camera;
+                    key[0] = obs.keyPosition[0];
+                    key[1] = obs.keyPosition[1];
+                } else if(_pointLayout == POINTS_COMPACT) {
+                    camIdx = _compactPoints.getCamera(j);
+                    key[0] = _compactPoints.keyPositions[2 * j];
+                    key[1] = _compactPoints.keyPositions[2 * j + 1];
+                } else {
+                    const ViewListEntry &obs = _points[i].viewList[k];
+                    camIdx = obs.camera;
+                    key[0] = obs.keyPosition[0];
+                    key[1] = obs.keyPosition[1];
+                }
+
+                double *res = &errors.residuals[2 * j];
+                const bool inFront = projectPoint(params[camIdx], pos, res);
+                res[0] -= key[0];
+                res[1] -= key[1];
+                const double err = inFront ? std::sqrt(res[0] * res[0] + res[1] * res[1]) : std::numeric_limits<double>::infinity();
+                errors.errors[j] = err;
+
+                pntAcc.add(err, inFront);
+                camAcc[camIdx].add(err, inFront);
+            }
+            pntAcc.get(errors.points[i]);
+        }
+    }
+
+    errors.cameras.resize(nCams);
+    ErrorAccumulator total;
+    for(int c = 0; c < nCams; c++) {
+        ErrorAccumulator acc;
+        for(int t = 0; t < nThreads; t++) {
+            if(!camAccs[t].empty()) acc.add(camAccs[t][c]);
+        }
+        acc.get(errors.cameras[c]);
+        total.add(acc);
+    }
+    total.get(errors.total);
+}
+
+int
+Reconstruction::getImageSizeForCamera(int camIdx, int &width, int &height, bool throwException) const
+{
+    assert(listFileLoaded());
+    return getImageSize(getImageFileName(camIdx).c_str(), width, height, throwException);
+}
+
+int
 Reconstruction::loadSIFTFeaturesForCamera(int camIdx, std::vector<SIFTFeature> &sift, bool throwException) const
 {
-    std::string fname = _imageFNames[camIdx];
+    std::string fname = getImageFileName(camIdx);
     int dotIdx = fname.find_last_of(".");
 
     std::string bname = fname.substr(0, dotIdx);
@@ -766,4 +2668,416 @@ Reconstruction::loadSIFTFeaturesForCamera(int camIdx, std::vector<SIFTFeature> &
     return 1;
 }
 
+ReconstructionView::ReconstructionView(const char *bundleFName, const char *cacheFName):
+    _nCameras(0), _nPoints(0), _nObservations(0)
+{
+    namespace fs = boost::filesystem;
+
+    if(!isLittleEndianHost()) throw sfmf::Error("Mapping binary bundle files requires a little endian host");
+
+    // Binary files (not compressed) can be mapped directly. The view
+    // works in place, so it always uses the mmap backend.
+    InputFile::Ptr file = InputFile::open(bundleFName, IO_BACKEND_MMAP);
+    char magic[sizeof(BINARY_MAGIC)];
+    size_t nRead = file->readAt(0, magic, sizeof(magic));
+    if(hasBinaryMagic(magic, nRead)) {
+        _map(file);
+        return;
+    }
+    file.reset();
+
+    std::string cachePath = cacheFName ? std::string(cacheFName) : std::string(bundleFName) + ".bin";
+    if(fs::exists(cachePath) && fs::last_write_time(cachePath) >= fs::last_write_time(bundleFName)) {
+        try {
+            _map(InputFile::open(cachePath.c_str(), IO_BACKEND_MMAP));
+            return;
+        } catch (sfmf::Error &e) {
+            LOG_WARN("Ignoring bad cache file " << cachePath << ": " << e.what());
+        }
+    }
+
+    // Write to a temporary file first so other processes never see a
+    // partially written cache.
+    LOG_INFO("Writing binary cache " << cachePath);
+    std::stringstream tmpPath;
+    tmpPath << cachePath << ".tmp" << getpid();
+
+    Reconstruction bundle(bundleFName);
+    bundle.writeFile(tmpPath.str().c_str(), Reconstruction::FORMAT_BINARY);
+    fs::rename(tmpPath.str(), cachePath);
+
+    _map(InputFile::open(cachePath.c_str(), IO_BACKEND_MMAP));
+}
+
+void
+ReconstructionView::_map(InputFile::Ptr file)
+{
+    const char *data = file->data();
+    size_t size = file->getSize();
+
+    // Files that are not regular can not be mapped
+    if(data == NULL && size > 0) {
+        std::stringstream errMsg;
+        errMsg << "Could not map " << file->getFileName();
+        throw sfmf::Error(errMsg.str());
+    }
+
+    BinaryHeader header;
+    if(size < sizeof(header) || !hasBinaryMagic(data, size)) throw sfmf::Error("Not a binary bundle file");
+    memcpy(&header, data, sizeof(header));
+
+    if(header.version != BINARY_VERSION || !binaryCountsFit(header, size) || size < BinaryLayout(header).fileSize) {
+        throw sfmf::Error("Unsupported or truncated binary bundle file");
+    }
+    BinaryLayout layout(header);
+
+    _file = file;
+    _mappedFName = file->getFileName();
+
+    _nCameras = header.nCameras;
+    _nPoints = header.nPoints;
+    _nObservations = header.nObservations;
+
+    _cameras = (const double *)(data + layout.cameras);
+    _positions = (const double *)(data + layout.positions);
+    _colors = (const uint8_t *)(data + layout.colors);
+    _offsets = (const uint64_t *)(data + layout.offsets);
+    _observations = (const PackedViewListEntry *)(data + layout.observations);
+}
+
+Camera
+ReconstructionView::getCamera(size_t camIdx) const
+{
+    const double *v = _cameras + 15 * camIdx;
+
+    Camera cam;
+    cam.focalLength = v[0];
+    cam.k1 = v[1];
+    cam.k2 = v[2];
+    for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 3; c++) cam.rotation(r, c) = v[3 + r * 3 + c];
+    for(int r = 0; r < 3; r++) cam.translation(r) = v[12 + r];
+    cam.refreshCache();
+
+    return cam;
+}
+
+void
+ReconstructionView::getPoint(size_t pntIdx, Point &pnt) const
+{
+    pnt.position = getPosition(pntIdx);
+    pnt.color = getColor(pntIdx);
+
+    ArrayView<PackedViewListEntry> viewList = getViewList(pntIdx);
+    pnt.viewList.resize(viewList.size());
+    for(size_t i = 0; i < viewList.size(); i++) {
+        pnt.viewList[i] = ViewListEntry(viewList[i].camera, viewList[i].key,
+                                        Eigen::Vector2d(viewList[i].keyPosition[0], viewList[i].keyPosition[1]));
+    }
+}
+
+StreamReader::StreamReader(const char *bundleFName):
+    _nPoints(0), _nextPoint(0), _pos(0), _size(0), _eof(false), _nObservations(0), _nextObservation(0)
+{
+    InputFile::Ptr file = InputFile::open(bundleFName);
+    _in.reset(new CompressedFileReader(file));
+    _buffer.resize(1 << 22);
+    _refill();
+
+    if(hasBinaryMagic(_buffer.data(), _size)) {
+        _file = file;
+        _readBinaryHeader();
+        _in.reset();
+        _buffer = std::vector<char>();
+    } else {
+        _readHeader();
+    }
+    for(int i = 0; i < getNCameras(); i++) _cameras[i].refreshCache();
+}
+
+static
+void
+readSection(std::istream &in, void *data, size_t size)
+{
+    in.read((char *)data, size);
+    if(size_t(in.gcount()) != size) throw sfmf::Error("Truncated binary bundle file");
+}
+
+// Sections of plain files are read from where they start, compressed
+// ones are decompressed from the beginning and skipped up to the section
+boost::shared_ptr<std::istream>
+StreamReader::_openSection(uint64_t offset) const
+{
+    const bool compressed = detectCompression(*_file) != COMPRESSION_NONE;
+    boost::shared_ptr<std::istream> in(new CompressedFileReader(InputFile::cursor(_file, compressed ? 0 : offset)));
+    if(compressed) {
+        in->ignore(offset);
+        if(uint64_t(in->gcount()) != offset) throw sfmf::Error("Truncated binary bundle file");
+    }
+    return in;
+}
+
+void
+StreamReader::_readBinaryHeader()
+{
+    BinaryHeader header;
+    if(_size < sizeof(header)) throw sfmf::Error("Truncated binary bundle file");
+    memcpy(&header, _buffer.data(), sizeof(header));
+    swapToLittleEndian(header);
+
+    if(header.version != BINARY_VERSION) {
+        std::stringstream err;
+        err << "Unsupported binary bundle version " << header.version;
+        throw sfmf::Error(err.str());
+    }
+
+    // Counts that can not fit in the file (or in 64 bit offsets when the
+    // size of the decompressed file is not known) are rejected before
+    // anything is computed from them
+    const uint64_t maxCount = std::numeric_limits<uint64_t>::max() / 64;
+    if(header.nCameras > uint64_t(std::numeric_limits<int>::max()) || header.nPoints > maxCount ||
+       header.nObservations > maxCount) {
+        throw sfmf::Error("Binary bundle file has more cameras or points than supported");
+    }
+    if(detectCompression(*_file) == COMPRESSION_NONE && !binaryCountsFit(header, _file->getSize())) {
+        throw sfmf::Error("Truncated binary bundle file");
+    }
+
+    BinaryLayout layout(header);
+    _nPoints = header.nPoints;
+    _nObservations = header.nObservations;
+    _sectionBegin[0] = layout.positions;
+    _sectionBegin[1] = layout.colors;
+    _sectionBegin[2] = layout.offsets;
+    _sectionBegin[3] = layout.observations;
+
+    boost::shared_ptr<std::istream> in = _openSection(layout.cameras);
+    _cameras.resize(header.nCameras);
+    for(int i = 0; i < getNCameras(); i++) {
+        double v[15];
+        readSection(*in, v, sizeof(v));
+        swapToLittleEndian(v, 15);
+
+        Camera &cam = _cameras[i];
+        cam.focalLength = v[0];
+        cam.k1 = v[1];
+        cam.k2 = v[2];
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++) cam.rotation(r, c) = v[3 + r * 3 + c];
+        for(int r = 0; r < 3; r++) cam.translation(r) = v[12 + r];
+    }
+}
+
+void
+StreamReader::_refill()
+{
+    // Keep what was not consumed yet, grow the buffer if that fills it up
+    size_t unread = _size - _pos;
+    memmove(_buffer.data(), _buffer.data() + _pos, unread);
+    _pos = 0;
+    _size = unread;
+    if(_size == _buffer.size()) _buffer.resize(_buffer.size() * 2);
+
+    while(_size < _buffer.size() && !_eof) {
+        _in->read(_buffer.data() + _size, _buffer.size() - _size);
+        _size += _in->gcount();
+        if(!_in->good()) _eof = true;
+    }
+}
+
+void
+StreamReader::_readHeader()
+{
+    for(;;) {
+        TextScanner in(_buffer.data(), _buffer.data() + _size, _eof);
+
+        if(!in.match(Reconstruction::ASCII_SIGNATURE)) throw sfmf::Error("Bad signature in bundle file");
+
+        double version = 0;
+        int nCameras = 0;
+        long long nPoints = 0;
+        bool ok = in.readDouble(version) && in.readInt(nCameras) && in.readInt64(nPoints);
+        if(ok) expectToken(nCameras >= 0 && nPoints >= 0, "number of cameras and points");
+        _nPoints = nPoints;
+
+        _cameras.resize(std::max(nCameras, 0));
+        for(int i = 0; ok && i < nCameras; i++) {
+            Camera &cam = _cameras[i];
+            ok = in.readDouble(cam.focalLength) && in.readDouble(cam.k1) && in.readDouble(cam.k2);
+            for(int r = 0; r < 3; r++)
+                for(int c = 0; c < 3; c++) ok = ok && in.readDouble(cam.rotation(r, c));
+            for(int r = 0; r < 3; r++) ok = ok && in.readDouble(cam.translation(r));
+        }
+
+        if(ok) {
+            if(version != 0.3) {
+                std::stringstream err;
+                err << "Unsupported version " << version;
+                throw sfmf::Error(err.str());
+            }
+            _pos = in.position() - _buffer.data();
+            return;
+        }
+
+        expectToken(in.starved(), "header");
+        _refill();
+    }
+}
+
+bool
+StreamReader::readPoint(Point &pnt)
+{
+    if(_nextPoint >= _nPoints) return false;
+
+    if(_file) {
+        if(!_positions) {
+            _positions = _openSection(_sectionBegin[0]);
+            _colors = _openSection(_sectionBegin[1]);
+            _offsets = _openSection(_sectionBegin[2]);
+            _observations = _openSection(_sectionBegin[3]);
+            readSection(*_offsets, &_nextObservation, sizeof(_nextObservation));
+            swapToLittleEndian(&_nextObservation, 1);
+        }
+
+        double position[3];
+        uint8_t color[3];
+        uint64_t end;
+        readSection(*_positions, position, sizeof(position));
+        readSection(*_colors, color, sizeof(color));
+        readSection(*_offsets, &end, sizeof(end));
+        swapToLittleEndian(position, 3);
+        swapToLittleEndian(&end, 1);
+        if(_nextObservation > end || end > _nObservations) throw sfmf::Error("Corrupted binary bundle file, bad view list");
+
+        pnt.position << position[0], position[1], position[2];
+        pnt.color = Color(color[0], color[1], color[2]);
+        pnt.viewList.resize(end - _nextObservation);
+        for(size_t j = 0; j < pnt.viewList.size(); j++) {
+            BinaryObservation obs;
+            readSection(*_observations, &obs, sizeof(obs));
+            swapToLittleEndian(&obs, 1);
+            if(obs.camera < 0 || obs.camera >= getNCameras()) throw sfmf::Error("Corrupted binary bundle file, bad view list");
+
+            ViewListEntry &entry = pnt.viewList[j];
+            entry.camera = obs.camera;
+            entry.key = obs.key;
+            entry.keyPosition << obs.keyPosition[0], obs.keyPosition[1];
+        }
+
+        _nextObservation = end;
+        _nextPoint++;
+        return true;
+    }
+
+    for(;;) {
+        TextScanner in(_buffer.data() + _pos, _buffer.data() + _size, _eof);
+        if(readPoints(in, &pnt, 1, getNCameras())) {
+            _pos = in.position() - _buffer.data();
+            _nextPoint++;
+            return true;
+        }
+
+        expectToken(in.starved(), "point");
+        _refill();
+    }
+}
+
+void
+visitPoints(const char *bundleFName, PointVisitor &visitor)
+{
+    StreamReader reader(bundleFName);
+    visitor.visitCameras(reader.getCameras(), reader.getNPoints());
+
+    Point pnt;
+    PROGBAR_START("Streaming points");
+    for(int64_t i = 0; reader.readPoint(pnt); i++) {
+        if((i & 0xfff) == 0) PROGBAR_UPDATE(i, reader.getNPoints());
+        visitor.visitPoint(i, pnt);
+    }
+}
+
+StreamWriter::StreamWriter(const char *bundleFName, const Camera::Vector &cameras, int64_t nPoints):
+    _fname(bundleFName), _nPointsExpected(nPoints), _nPoints(0), _closed(false)
+{
+    if(nPoints >= 0) {
+        _out.reset(new CompressedFileWriter(bundleFName));
+        TextFormatter fmt(_buffer);
+        formatHeader(fmt, cameras, nPoints);
+        return;
+    }
+
+    // Compressed files can not be patched afterwards, the header is
+    // written by close() once the number of points is known
+    std::stringstream spoolFName;
+    spoolFName << bundleFName << ".tmp" << getpid();
+    _spoolFName = spoolFName.str();
+    _out.reset(new CompressedFileWriter(_spoolFName.c_str()));
+    _cameras = cameras;
+}
+
+StreamWriter::~StreamWriter()
+{
+    // Destructors should not throw, errors are only reported by close()
+    try {
+        close();
+    } catch (sfmf::Error &e) {
+        LOG_WARN(e.what());
+    }
+}
+
+void
+StreamWriter::writePoint(const Point &pnt)
+{
+    TextFormatter fmt(_buffer);
+    formatPoint(fmt, pnt);
+    _nPoints++;
+
+    if(_buffer.size() >= (1 << 20)) {
+        writeBuffer(*_out, _buffer);
+        _buffer.clear();
+    }
+}
+
+void
+StreamWriter::close()
+{
+    if(_closed) return;
+    _closed = true;
+
+    try {
+        writeBuffer(*_out, _buffer);
+        _buffer.clear();
+        _out->close();
+        _out.reset();
+
+        if(_nPointsExpected >= 0 && _nPoints != _nPointsExpected) {
+            std::stringstream errMsg;
+            errMsg << "Wrote " << _nPoints << " points to " << _fname << ", its header says " << _nPointsExpected;
+            throw sfmf::Error(errMsg.str());
+        }
+
+        if(_spoolFName.size()) {
+            CompressedFileWriter out(_fname.c_str());
+            TextFormatter fmt(_buffer);
+            formatHeader(fmt, _cameras, _nPoints);
+            writeBuffer(out, _buffer);
+            _buffer.clear();
+
+            InputFile::Ptr spool = InputFile::open(_spoolFName.c_str());
+            std::vector<char> chunk(1 << 22);
+            for(size_t n; (n = spool->read(chunk.data(), chunk.size())) > 0;) {
+                out.write(chunk.data(), n);
+            }
+            out.close();
+        }
+    } catch (sfmf::Error &e) {
+        _out.reset();
+        if(_spoolFName.size()) unlink(_spoolFName.c_str());
+        throw;
+    }
+
+    if(_spoolFName.size()) unlink(_spoolFName.c_str());
+    Camera::Vector().swap(_cameras);
+}
+
 BUNDLER_NAMESPACE_END
\ No newline at end of file
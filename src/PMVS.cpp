@@ -21,6 +21,7 @@
 
 #include "SfMFiles/PMVS.hpp"
 #include "io.hpp"
+#include "spatial.hpp"
 
 // STD
 #include <fstream>
@@ -196,15 +197,16 @@ Reconstruction::init(const char *pmvsFileName, bool tryLoadOptionsFile)
     // Fist line contains the string PATCHES
     f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-    unsigned int nPatches = 0;
+    uint64_t nPatches = 0;
     f >> nPatches;
 
     LOG_INFO("PMVS file: " << pmvsFileName);
     PROGBAR_START("Loading in progress");
 
-    _patches.resize(nPatches);
+    _cameraListArena.reset(new Arena());
+    Patch::Vector(nPatches, Patch(Patch::CameraAllocator(_cameraListArena))).swap(_patches);
     assert(_patches.size() == nPatches);
-    for (unsigned int i = 0; i < nPatches; i++) {
+    for (uint64_t i = 0; i < nPatches; i++) {
         PROGBAR_UPDATE(i, nPatches);
         f >> _patches[i];
 
@@ -247,7 +249,7 @@ Reconstruction::init(const char *pmvsFileName, bool tryLoadOptionsFile)
 #if 1
             LOG_INFO("Remapping indexes");
             for (Patch::Vector::iterator p = _patches.begin(); p != _patches.end(); p++) {
-                for (std::vector<uint32_t>::iterator cam = p->goodCameras.begin(); cam != p->goodCameras.end(); cam++) {
+                for (Patch::CameraList::iterator cam = p->goodCameras.begin(); cam != p->goodCameras.end(); cam++) {
                     assert((*cam) >= 0);
 
                     if(opt.timages.size() > (*cam)) {
@@ -257,7 +259,7 @@ Reconstruction::init(const char *pmvsFileName, bool tryLoadOptionsFile)
                     *cam = opt.timages[*cam];
                 }
                 // not entirelly sure about this part, maybe should use oimages here
-                for (std::vector<uint32_t>::iterator cam = p->badCameras.begin(); cam != p->badCameras.end(); cam++) {
+                for (Patch::CameraList::iterator cam = p->badCameras.begin(); cam != p->badCameras.end(); cam++) {
                     *cam = opt.timages[*cam];
                 }
             }
@@ -326,11 +328,11 @@ Reconstruction::loadCamerasAndImageFilenames(const char *basedir, bool loadOnlyU
 
         if (loadOnlyUsedCameras) {
             for (Patch::Vector::iterator p = _patches.begin(); p != _patches.end(); p++) {
-                for (std::vector<uint32_t>::iterator cam = p->goodCameras.begin(); cam != p->goodCameras.end(); cam++) {
+                for (Patch::CameraList::iterator cam = p->goodCameras.begin(); cam != p->goodCameras.end(); cam++) {
                     allCams.insert(*cam);
                 }
                 // not entirelly sure about this part, maybe should use oimages here
-                for (std::vector<uint32_t>::iterator cam = p->badCameras.begin(); cam != p->badCameras.end(); cam++) {
+                for (Patch::CameraList::iterator cam = p->badCameras.begin(); cam != p->badCameras.end(); cam++) {
                     allCams.insert(*cam);
                 }
             }
@@ -376,13 +378,15 @@ Reconstruction::loadCamerasAndImageFilenames(const char *basedir, bool loadOnlyU
 void
 Reconstruction::writeFile(const char *patchesFileName) const
 {
-    std::ofstream patchesF(patchesFileName);
+    // Compressed if the name ends in .gz
+    CompressedFileWriter patchesF(patchesFileName);
 
     patchesF << "PATCHES\n" << this->getNPatches() << "\n";
 
     for (Patch::Vector::const_iterator p = _patches.begin(); p != _patches.end(); p++) {
         patchesF << *p << "\n";
     }
+    patchesF.close();
 }
 
 void
@@ -394,6 +398,37 @@ Reconstruction::mergeWith(const Reconstruction &other)
     this->_imageFNames.insert(other._imageFNames.begin(), other._imageFNames.end());
 }
 
+std::vector<int64_t>
+Reconstruction::reorderSpatially(SpaceFillingCurve curve)
+{
+    const int64_t nPatches = _patches.size();
+    const Patch::Vector &patches = _patches;
+    std::vector<int64_t> order;
+    spatialOrder(nPatches, [&patches](int64_t i) -> const Eigen::Vector4d & { return patches[i].position; }, curve, order);
+
+    // Patches can not be assigned, fields are copied and camera lists swapped
+    Patch::Vector sorted(nPatches);
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < nPatches; i++) {
+        Patch &src = _patches[order[i]], &dst = sorted[i];
+        dst.position = src.position;
+        dst.normal = src.normal;
+        dst.score = src.score;
+        dst.debug1 = src.debug1;
+        dst.debug2 = src.debug2;
+        dst.goodCameras.swap(src.goodCameras);
+        dst.badCameras.swap(src.badCameras);
+        dst.color = src.color;
+        dst.reconstructionAccuracy = src.reconstructionAccuracy;
+        dst.reconstructionSLevel = src.reconstructionSLevel;
+    }
+    _patches.swap(sorted);
+
+    std::vector<int64_t> table;
+    invertPermutation(order, table);
+    return table;
+}
+
 Reconstruction::Ptr
 Reconstruction::New(const char *pmvsFileName, bool tryLoadOptionsFile)
 {
@@ -0,0 +1,118 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <SfMFiles/sfmfiles>
+
+#ifndef __SFMF_ARENA_HPP__
+#define __SFMF_ARENA_HPP__
+
+#include <new>
+#include <cstddef>
+#include <type_traits>
+
+SFMFILES_NAMESPACE_BEGIN
+
+// Monotonic memory arena. Memory is handed out by bumping a pointer
+// inside large blocks and only goes back to the system, all at once,
+// when the arena is destroyed, deallocation does nothing. Meant for the
+// many small lists created when a file is loaded (view lists of bundler
+// points, camera lists of PMVS patches): loading makes a few large
+// allocations instead of one per list and throwing the reconstruction
+// away frees a handful of blocks. allocate() can be called from several
+// threads at the same time.
+class Arena
+{
+public:
+    typedef boost::shared_ptr<Arena> Ptr;
+
+    static const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+    static const size_t ALIGNMENT = 16;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    /// Memory aligned to ALIGNMENT bytes, throws std::bad_alloc
+    void *allocate(size_t size);
+
+    /// Bytes requested from the system so far
+    uint64_t getNBytesReserved() const;
+
+private:
+    class State;
+    State *_state;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+// Standard allocator on top of an Arena, containers keep a reference to
+// the arena so it lives as long as they do. A default constructed
+// allocator uses the heap, containers that were not created by a
+// reader behave as usual. Copies of a container allocate from the same
+// arena and moving or swapping a container carries the arena along.
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() {}
+    ArenaAllocator(const Arena::Ptr &arena): _arena(arena) {}
+    template<typename U> ArenaAllocator(const ArenaAllocator<U> &other): _arena(other.getArena()) {}
+
+    const Arena::Ptr &getArena() const { return _arena; }
+
+    T *allocate(size_t n)
+    {
+        if(_arena) return (T *)_arena->allocate(n * sizeof(T));
+        return (T *)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if(!_arena) ::operator delete(p);
+    }
+
+    size_t max_size() const { return size_t(-1) / sizeof(T); }
+
+    template<typename U> bool operator==(const ArenaAllocator<U> &other) const { return _arena == other.getArena(); }
+    template<typename U> bool operator!=(const ArenaAllocator<U> &other) const { return _arena != other.getArena(); }
+
+private:
+    Arena::Ptr _arena;
+};
+
+SFMFILES_NAMESPACE_END
+
+#endif // __SFMF_ARENA_HPP__
@@ -25,6 +25,11 @@
 
 #include <SfMFiles/sfmfiles>
 #include <SfMFiles/FeatureDescriptors.hpp>
+#include <SfMFiles/Arena.hpp>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
 
 // Author: Daniel Hauagge <hauagge@cs.cornell.edu>
 //   Date: 2011-04-03
@@ -37,6 +42,11 @@
 // Cam: camera points towards -Z, Y points up, X points right
 //  Im: Y points up, X points right, origin is lower left corner
 
+SFMFILES_NAMESPACE_BEGIN
+class InputFile;
+class CompressedFileWriter;
+SFMFILES_NAMESPACE_END
+
 BUNDLER_NAMESPACE_BEGIN
 
 class Color
@@ -47,11 +57,42 @@ public:
     uint8_t r, g, b;
 };
 
+// Counts and indexes of points and observations are 64 bit, camera,
+// key and view list indexes are not (a view list has at most one
+// entry per camera).
 typedef struct {
-    int pointIdx;
-    int visibilityListIdx;
+    int64_t pointIdx;
+    int32_t visibilityListIdx;
 } PointVisListIdxs;
 
+class UndistortionTable;
+
+// Quantities derived from the parameters of a camera, filled by
+// Camera::refreshCache(). They are not updated when the parameters
+// change. Once initialized, the accessors named below return the cached
+// values (intrinsicMatrix() only for the cached image size). Matrices are unaligned so the layout does not depend on how
+// Eigen was configured by the code including this file.
+class CameraCache
+{
+public:
+    typedef Eigen::Matrix<double, 3, 4, Eigen::DontAlign> Matrix34d;
+    typedef Eigen::Matrix<float, 3, 4, Eigen::DontAlign> Matrix34f;
+
+    bool initialized;
+    bool valid;                // Camera::isValid()
+    Eigen::Vector3d center;    // Camera::center()
+    Eigen::Vector3d direction; // Camera::lookingAt()
+    Eigen::Vector3d up;        // Camera::up()
+
+    int imWidth, imHeight;     // Image size K and P were computed for
+    Eigen::Matrix3d K;         // Camera::intrinsicMatrix()
+    Eigen::Matrix3d invK;      // Camera::invIntrinsicMatrix()
+    Matrix34d P;               // K [R | t], y points down like in K (world2im() gives imHeight - y)
+    Matrix34f Pf;              // P in single precision
+
+    CameraCache(): initialized(false), valid(false), imWidth(0), imHeight(0) {}
+};
+
 // Stores intrinsic and extrinsic camera parameters
 class Camera
 {
@@ -60,11 +101,6 @@ public:
 
     Camera();
 
-    // Indexes of visible points, not stored in bundle file and only
-    // computed if extra flag is passed to Reconstruction constructor or
-    // function buildCam2PointIndex is called.
-    std::vector<PointVisListIdxs> visiblePoints;
-
     // Extrinsic parameters
     Eigen::Vector3d translation;
     Eigen::Matrix3d rotation;
@@ -73,9 +109,29 @@ public:
     double focalLength; // Focal length
     double k1, k2; // Radial distortion parameters
 
-    // Coordinate transforms
-    void im2world(const Eigen::Vector2d &im, Eigen::Vector3d &w, int imWidth = 0, int imHeight = 0) const;
-    void im2cam(const Eigen::Vector2d &im, Eigen::Vector3d &c, int imWidth = 0, int imHeight = 0) const;
+    /// Derived quantities, valid after refreshCache(). Reconstruction
+    /// refreshes the caches of its cameras when it loads or transforms
+    /// them, cameras edited by hand have to be refreshed again (or their
+    /// cache reset) since center(), isValid() etc. read it.
+    CameraCache cache;
+
+    /// Recomputes the cache, K and P for the given image size (0 for
+    /// the principal point at the origin). Without arguments the size of
+    /// the previous refresh is kept.
+    void refreshCache();
+    void refreshCache(int imWidth, int imHeight);
+
+    /// Moves the camera along with a similarity transform of the world
+    /// (point p becomes trans * p), the cache is refreshed
+    void transform(const Eigen::Matrix4d &trans);
+
+    // Coordinate transforms, im2cam() and im2world() invert cam2im()
+    // (point on the plane z = -1 of the camera), radial distortion is
+    // removed with Newton's method
+    void im2world(const Eigen::Vector2d &im, Eigen::Vector3d &w, int imWidth = 0, int imHeight = 0,
+                  bool removeRadialDistortion = true) const;
+    void im2cam(const Eigen::Vector2d &im, Eigen::Vector3d &c, int imWidth = 0, int imHeight = 0,
+                bool removeRadialDistortion = true) const;
     void cam2world(const Eigen::Vector3d &c, Eigen::Vector3d &w) const;
     void world2cam(const Eigen::Vector3d &w, Eigen::Vector3d &c) const;
     void world2cam(const Eigen::Vector4d &w, Eigen::Vector3d &c) const;
@@ -86,9 +142,27 @@ public:
     /// @returns true if point lies inside image (if width or height were given) and is in front of camera
     bool world2im(const Eigen::Vector4d &w, Eigen::Vector2d &im, bool applyRadialDistortion = false, int imWidth = 0, int imHeight = 0) const;
 
+    /// Projects n points at once, same as calling world2im() on each one
+    /// (up to rounding) but several points per instruction (SSE2 or
+    /// AVX2, picked at run time). w holds x, y, z of every point one
+    /// after the other, im gets x, y of every point and visible[i] is
+    /// what world2im() returns for point i.
+    /// @returns number of visible points
+    size_t world2imBatch(const double *w, size_t n, double *im, uint8_t *visible,
+                         bool applyRadialDistortion = false, int imWidth = 0, int imHeight = 0) const;
+
     /// @returns true if point lies inside image (if width or height were given) and is in front of camera
     bool cam2im(Eigen::Vector3d c, Eigen::Vector2d &im, bool applyRadialDistortion, int imWidth = 0, int imHeight = 0) const;
 
+    /// im2cam() and im2world() for n points (x, y of each one after the
+    /// other), c and w get x, y, z of each point. Points are undistorted
+    /// several at a time with SIMD instructions, or interpolated from
+    /// table if one is given (it has to be built for this camera).
+    void im2camBatch(const double *im, size_t n, double *c, int imWidth = 0, int imHeight = 0,
+                     bool removeRadialDistortion = true, const UndistortionTable *table = NULL) const;
+    void im2worldBatch(const double *im, size_t n, double *w, int imWidth = 0, int imHeight = 0,
+                       bool removeRadialDistortion = true, const UndistortionTable *table = NULL) const;
+
     // Outputs image coordinates that agree with PMVS (origin at upper left of image, x points right, y points down, pixel centered at (0.5, 0.5))
     void world2imPmvs(const Eigen::Vector3d &w, Eigen::Vector2d &im, bool applyRadialDistortion, int imWidth, int imHeight) const;
     void cam2imPmvs(Eigen::Vector3d c, Eigen::Vector2d &im, bool applyRadialDistortion, int imWidth, int imHeight) const;
@@ -110,10 +184,46 @@ public:
     bool isValid() const;
 };
 
+// Undistortion scale sampled along the squared radius (normalized
+// coordinates) of an image, the undistorted point is the distorted one
+// times the scale. Interpolating is cheaper than solving for every pixel
+// of a dense grid, and the error of the default table stays within a
+// few millionths of a pixel. The table depends on k1 and k2 only, cameras that
+// share them and are not larger can share it.
+class UndistortionTable
+{
+public:
+    static const int DEFAULT_N_SAMPLES = 4096;
+
+    double k1, k2;
+    double maxRadius2; // Squared radius of the image corners
+    double invStep;    // Samples per unit of squared radius
+    std::vector<double> scales; // From radius 0, the last two go past maxRadius2
+
+    UndistortionTable(): k1(0), k2(0), maxRadius2(0), invStep(0) {}
+
+    /// Covers the corners of an image of the given size, throws
+    /// sfmf::Error if the size is unknown
+    UndistortionTable(const Camera &cam, int imWidth, int imHeight, int nSamples = DEFAULT_N_SAMPLES);
+
+    bool empty() const { return scales.size() < 2; }
+
+    /// @returns false if rd2 is not covered by the table
+    bool lookup(double rd2, double &scale) const
+    {
+        const double t = rd2 * invStep;
+        if(empty() || !(t < double(scales.size() - 1))) return false;
+        const size_t i = size_t(t);
+        scale = scales[i] + (t - i) * (scales[i + 1] - scales[i]);
+        return true;
+    }
+};
+
 class ViewListEntry // formely PointEntry
 {
 public:
-    typedef std::vector<ViewListEntry> Vector;
+    typedef ArenaAllocator<ViewListEntry> Allocator;
+    typedef std::vector<ViewListEntry, Allocator> Vector;
 
     int camera; /// Camera index
     int key; /// Keypoint index (into the .key file)
@@ -122,6 +232,39 @@ public:
     ViewListEntry();
     ViewListEntry(int camera, int key = -1, Eigen::Vector2d keyPosition = Eigen::Vector2d(0, 0));
     ViewListEntry(const ViewListEntry &other);
+    ViewListEntry &operator=(const ViewListEntry &) = default;
+};
+
+// Read-only view over a contiguous array that belongs to someone else
+template<typename T>
+class ArrayView
+{
+public:
+    typedef const T *const_iterator;
+
+    ArrayView(): _data(NULL), _size(0) {}
+    ArrayView(const T *data, size_t size): _data(data), _size(size) {}
+
+    const T &operator[](size_t i) const { return _data[i]; }
+    const T *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _size; }
+
+private:
+    const T *_data;
+    size_t _size;
+};
+
+// View list entry as laid out in binary bundle files
+class PackedViewListEntry
+{
+public:
+    int32_t camera;
+    int32_t key;
+    double keyPosition[2];
 };
 
 // Stores point location, color and list of cameras that can view this point
@@ -133,6 +276,298 @@ public:
     Eigen::Vector3d position;
     Color color;
     ViewListEntry::Vector viewList;
+
+    Point() {}
+    /// View list allocated from allocator's arena
+    explicit Point(const ViewListEntry::Allocator &allocator): viewList(allocator) {}
+};
+
+// Points stored as a structure of arrays, the same layout used by
+// binary bundle files: positions, colors and view lists each live in
+// their own contiguous array, view lists one after the other with
+// offsets[i] pointing to the first observation of point i. Loops over
+// a single attribute (positions for a transform or a bounding box)
+// stream through memory and vectorize, and the whole reconstruction
+// takes four allocations instead of one per point.
+class PointArrays
+{
+public:
+    std::vector<double> positions;                // x, y, z of each point
+    std::vector<uint8_t> colors;                  // r, g, b of each point
+    std::vector<uint64_t> offsets;                // size() + 1 entries
+    std::vector<PackedViewListEntry> observations;
+
+    PointArrays(): offsets(1, 0) {}
+
+    size_t size() const { return offsets.size() - 1; }
+    bool empty() const { return size() == 0; }
+    uint64_t getNObservations() const { return offsets.back(); }
+
+    void clear();
+    void reserve(size_t nPoints, uint64_t nObservations = 0);
+    void swap(PointArrays &other);
+
+    Eigen::Map<Eigen::Vector3d> getPosition(size_t pntIdx) { return Eigen::Map<Eigen::Vector3d>(&positions[3 * pntIdx]); }
+    Eigen::Map<const Eigen::Vector3d> getPosition(size_t pntIdx) const { return Eigen::Map<const Eigen::Vector3d>(&positions[3 * pntIdx]); }
+
+    Color getColor(size_t pntIdx) const { return Color(colors[3 * pntIdx], colors[3 * pntIdx + 1], colors[3 * pntIdx + 2]); }
+
+    ArrayView<PackedViewListEntry> getViewList(size_t pntIdx) const
+    {
+        return ArrayView<PackedViewListEntry>(observations.data() + offsets[pntIdx], offsets[pntIdx + 1] - offsets[pntIdx]);
+    }
+
+    /// Conversion from and to the one object per point layout
+    void getPoint(size_t pntIdx, Point &pnt) const;
+    void push_back(const Point &pnt);
+    void assign(const Point::Vector &points);
+    void toPoints(Point::Vector &points, const ViewListEntry::Allocator &allocator = ViewListEntry::Allocator()) const;
+
+    /// Applies the affine part of trans (top 3 x 4 block) to every position
+    void transform(const Eigen::Matrix4d &trans);
+
+    /// Axis aligned bounding box of the positions (min > max if there are no points)
+    void boundingBox(Eigen::Vector3d &min, Eigen::Vector3d &max) const;
+};
+
+// Reduced precision PointArrays for very large reconstructions.
+// Positions are floats relative to a double precision origin (the
+// centroid of the points), keypoint positions are floats and camera
+// indices take 16 bits if there are at most 65536 cameras (32 bits
+// otherwise). An observation takes 14 bytes (16 with 32 bit camera
+// indices) instead of 24.
+//
+// Tolerance: values are rounded to the nearest float, so each
+// coordinate of a position is off by at most TOLERANCE * |p - origin|
+// and each keypoint coordinate by at most TOLERANCE * |x| (below 0.001
+// pixels for images up to 16384 pixels). Colors, keys, camera indices
+// and view lists are exact.
+class CompactPointArrays
+{
+public:
+    static const double TOLERANCE; // 2^-24, relative rounding error of a float
+
+    Eigen::Vector3d origin;
+    std::vector<float> positions;    // x, y, z of each point relative to origin
+    std::vector<uint8_t> colors;     // r, g, b of each point
+    std::vector<uint64_t> offsets;   // size() + 1 entries
+    std::vector<uint16_t> cameras16; // Camera of each observation if !wideCameras
+    std::vector<uint32_t> cameras32; // Camera of each observation if wideCameras
+    std::vector<int32_t> keys;
+    std::vector<float> keyPositions; // x, y of each observation
+    bool wideCameras;
+
+    CompactPointArrays(): origin(0, 0, 0), offsets(1, 0), wideCameras(false) {}
+
+    size_t size() const { return offsets.size() - 1; }
+    bool empty() const { return size() == 0; }
+    uint64_t getNObservations() const { return offsets.back(); }
+
+    void clear();
+    void swap(CompactPointArrays &other);
+
+    Eigen::Vector3d getPosition(size_t pntIdx) const
+    {
+        const float *p = &positions[3 * pntIdx];
+        return origin + Eigen::Vector3d(p[0], p[1], p[2]);
+    }
+
+    Color getColor(size_t pntIdx) const { return Color(colors[3 * pntIdx], colors[3 * pntIdx + 1], colors[3 * pntIdx + 2]); }
+
+    /// Camera of an observation (index into all the observations)
+    int getCamera(uint64_t obsIdx) const { return wideCameras ? int(cameras32[obsIdx]) : int(cameras16[obsIdx]); }
+
+    /// Conversion from and to full precision
+    void getPoint(size_t pntIdx, Point &pnt) const;
+    void assign(const PointArrays &arrays);
+    void toArrays(PointArrays &arrays) const;
+    void toPoints(Point::Vector &points, const ViewListEntry::Allocator &allocator = ViewListEntry::Allocator()) const;
+};
+
+// How Reconstruction keeps the points in memory
+enum PointLayout {
+    POINTS_AOS,    // Point::Vector, see Reconstruction::getPoints()
+    POINTS_SOA,    // PointArrays, see Reconstruction::getPointArrays()
+    POINTS_COMPACT // CompactPointArrays, see Reconstruction::getCompactPoints()
+};
+
+// Image list of a reconstruction: one image per line, optionally
+// followed by extra columns ("0 focal" with the focal length in pixels,
+// as written by bundler_focal2list). The whole file is kept in a single
+// buffer and names are handed out as references into it, so a list
+// costs one allocation no matter how many images it has. Lines are
+// matched to cameras by their position.
+class ListFile
+{
+public:
+    typedef boost::string_ref StringRef;
+
+    ListFile(): _indexValid(false) {}
+    explicit ListFile(const char *listFName): _indexValid(false) { readFile(listFName); }
+
+    // Lookup tables point into the arena, copies build their own
+    ListFile(const ListFile &other): _arena(other._arena), _entries(other._entries), _indexValid(false) {}
+    ListFile &operator=(const ListFile &other);
+
+    /// Reads a list file (possibly compressed), throws sfmf::Error on failure
+    void readFile(const char *listFName);
+    /// Writes name and extra columns of every image, one per line
+    void writeFile(const char *listFName) const;
+
+    size_t size() const { return _entries.size(); }
+    bool empty() const { return _entries.empty(); }
+    void clear();
+    void swap(ListFile &other);
+
+    /// Image file name, valid until the list is modified
+    StringRef getFileName(size_t idx) const { return StringRef(_arena.data() + _entries[idx].name, _entries[idx].nameLength); }
+    /// Columns that followed the file name (empty if none)
+    StringRef getExtra(size_t idx) const { return StringRef(_arena.data() + _entries[idx].extra, _entries[idx].extraLength); }
+    /// Focal length from the extra columns, 0 if it is not there
+    double getFocal(size_t idx) const;
+
+    /// Adds an image to the end of the list, extra is written after the name as is
+    void push_back(StringRef fname, StringRef extra = StringRef());
+
+    /// Keeps only the images in idxs, in that order
+    void select(const std::vector<int> &idxs);
+
+    /// @returns index of the image with this name, if there is none the
+    /// one with the same basename, -1 if not found (or if several images
+    /// share the basename). The lookup tables are built by readFile() or
+    /// on the first call after a modification.
+    int find(StringRef name) const;
+
+    /// Part of fname after the last '/'
+    static StringRef basename(StringRef fname);
+
+private:
+    class Entry
+    {
+    public:
+        size_t name, extra; // Offsets into _arena
+        uint32_t nameLength, extraLength;
+    };
+
+    class StringRefHash
+    {
+    public:
+        size_t operator()(StringRef s) const { return boost::hash_range(s.begin(), s.end()); }
+    };
+    typedef boost::unordered_map<StringRef, int, StringRefHash> Index;
+
+    std::vector<char> _arena;
+    std::vector<Entry> _entries;
+
+    mutable Index _byName, _byBasename;
+    mutable bool _indexValid;
+
+    void _buildIndex() const;
+};
+
+// Options that control how a bundle file is loaded
+class ReadOptions
+{
+public:
+    enum Parser {
+        PARSER_BUFFER, // Loads the file into memory and tokenizes it in place (default)
+        PARSER_ISTREAM // Reads values one by one with operator>>, slow but kept as a fallback
+    };
+
+    Parser parser;
+
+    /// Number of threads used to parse the points (PARSER_BUFFER only),
+    /// 0 uses all available cores.
+    int nThreads;
+
+    /// Only read the header and the cameras, points are left empty and
+    /// their number is available through getNPointsInFile()
+    bool camerasOnly;
+
+    /// Decompress gzipped files in parallel through a sidecar index
+    /// (file.gz.gzi, built and saved the first time), see GzipIndex.
+    bool useGzipIndex;
+
+    /// Layout of the points once loaded
+    PointLayout pointLayout;
+
+    ReadOptions(): parser(PARSER_BUFFER), nThreads(0), camerasOnly(false), useGzipIndex(false), pointLayout(POINTS_AOS) {}
+};
+
+// Options of Reconstruction::computeVisibility()
+class VisibilityOptions
+{
+public:
+    bool applyRadialDistortion;
+
+    /// Width and height of the image of every camera. If empty they are
+    /// read from the headers of the images in the list file (if it was
+    /// loaded). Cameras without a size (or with width or height 0) see
+    /// every point in front of them.
+    std::vector<Eigen::Vector2i> imageSizes;
+
+    /// Points are handled in blocks of this many points, blocks whose
+    /// bounding box lies outside the frustum of a camera are skipped
+    /// without projecting their points (works best on points sorted by
+    /// Reconstruction::reorderSpatially()).
+    int blockSize;
+
+    VisibilityOptions(): applyRadialDistortion(true), blockSize(1024) {}
+};
+
+// Points that project inside the image of each camera, as compressed
+// sparse rows (all rows in one array, sorted by camera)
+class Visibility
+{
+public:
+    std::vector<uint64_t> offsets; // nCameras + 1 entries
+    std::vector<int64_t> points;   // Point indexes, sorted within each row
+
+    Visibility(): offsets(1, 0) {}
+
+    int getNCameras() const { return offsets.size() - 1; }
+    uint64_t size() const { return points.size(); }
+
+    ArrayView<int64_t> getVisiblePoints(int camIdx) const
+    {
+        return ArrayView<int64_t>(points.data() + offsets[camIdx], offsets[camIdx + 1] - offsets[camIdx]);
+    }
+};
+
+// Reprojection errors of all the observations, see
+// Reconstruction::computeReprojectionErrors(). Observations are numbered
+// point by point in view list order.
+class ReprojectionErrors
+{
+public:
+    // Errors of a group of observations. Observations of points behind
+    // the camera have an infinite error, they only count in nBehind and
+    // max.
+    class Summary
+    {
+    public:
+        uint64_t nObservations; // In front of the camera
+        uint64_t nBehind;
+        double mean, rms, max;  // Pixels, 0 if there are no observations
+
+        Summary(): nObservations(0), nBehind(0), mean(0), rms(0), max(0) {}
+    };
+
+    std::vector<uint64_t> offsets; // nPoints + 1 entries, first observation of each point
+    std::vector<double> residuals; // x, y of each observation, projection minus key position
+    std::vector<double> errors;    // Length of each residual
+    std::vector<Summary> points;   // One per point
+    std::vector<Summary> cameras;  // One per camera
+    Summary total;
+
+    ReprojectionErrors(): offsets(1, 0) {}
+
+    uint64_t size() const { return errors.size(); }
+
+    ArrayView<double> getErrors(int64_t pntIdx) const
+    {
+        return ArrayView<double>(errors.data() + offsets[pntIdx], offsets[pntIdx + 1] - offsets[pntIdx]);
+    }
 };
 
 // Class that represents bundler output, encapsulating
@@ -142,10 +577,15 @@ class Reconstruction // formely BundlerData
 public:
     static const char *ASCII_SIGNATURE;
 
+    enum FileFormat {
+        FORMAT_ASCII,  // Text format written by Bundler
+        FORMAT_BINARY  // Little endian binary format, see bundle_binary.hpp
+    };
+
     typedef boost::shared_ptr<Reconstruction> Ptr;
     static Reconstruction::Ptr New(const char *bundlerFileName, bool computeCam2PointIndex = false);
 
-    Reconstruction(): _nValidCams(0), _cam2PointIndexInitialized(false) {};
+    Reconstruction(): _nValidCams(0), _nPointsInFile(0), _cam2PointIndexInitialized(false), _pointLayout(POINTS_AOS) {};
     Reconstruction(const char *bundleFileName, const char *listFName, bool computeCam2PointIndex = false);
     Reconstruction(const char *bundleFileName, bool computeCam2PointIndex = false);
     Reconstruction(const Camera::Vector &cameras, const Point::Vector &points);
@@ -154,7 +594,8 @@ public:
     void init(const char *bundleFileName, bool computeCam2PointIndex = false);
     void init(const Camera::Vector &cameras, const Point::Vector &points);
 
-    /// Load file with image filenames
+    /// Load file with image filenames, the number of images must match
+    /// the number of cameras
     void readListFile(const char *listFName);
     void writeListFile(const char *listFName) const;
     bool listFileLoaded() const;
@@ -164,13 +605,91 @@ public:
 
     /// Input/Output
     void readFile(const char *bundlerFileName, bool computeCam2PointIndex = false);
-    void writeFile(const char *bundlerFileName) const;
+    void readFile(const char *bundlerFileName, const ReadOptions &opts, bool computeCam2PointIndex = false);
+    /// Binary files are detected by their magic number on read. Text files
+    /// are formatted in parallel with the shortest digits that round trip.
+    void writeFile(const char *bundlerFileName, FileFormat format = FORMAT_ASCII) const;
 
     int getNCameras() const { return _cameras.size(); }
     int getNValidCameras() const { return _nValidCams; } // TODO: get rid of this
-    int getNPoints() const { return _points.size(); }
-
+    int64_t getNPoints() const;
+    /// Number of points in the last file read, even if they were not loaded
+    int64_t getNPointsInFile() const { return _nPointsInFile; }
+
+    /// Builds the camera to point index, not stored in bundle file and
+    /// only computed if extra flag is passed to the constructor or
+    /// readFile(). All the entries are kept in a single array sorted by
+    /// camera (compressed sparse rows), built in parallel.
     void buildCam2PointIndex();
+    bool cam2PointIndexBuilt() const { return _cam2PointIndexInitialized; }
+
+    /// Points seen by a camera (point index and position in the view
+    /// list of the point), sorted by point index. Requires the camera to
+    /// point index.
+    ArrayView<PointVisListIdxs> getVisiblePoints(int camIdx) const
+    {
+        assert(_cam2PointIndexInitialized);
+        return ArrayView<PointVisListIdxs>(_cam2Point.data() + _cam2PointOffsets[camIdx], _cam2PointOffsets[camIdx + 1] - _cam2PointOffsets[camIdx]);
+    }
+
+    /// In place editing, the points are never copied. View lists are
+    /// edited in parallel, the list file and the camera to point index
+    /// (if they were loaded or built) are kept up to date.
+    ///
+    /// Camera i becomes camera table[i], cameras with table[i] < 0 are
+    /// removed along with their observations. Throws sfmf::Error if the
+    /// new indexes are not 0 to (number of cameras kept - 1).
+    void remapCameras(const std::vector<int> &table);
+    /// Removes the cameras with mask[i] set, the others keep their order
+    void removeCameras(const std::vector<bool> &mask);
+    /// Removes the observations with mask[i] set, observations are
+    /// numbered point by point in view list order (like in
+    /// ReprojectionErrors). Points are kept even if they are left with
+    /// no observations.
+    void removeObservations(const std::vector<bool> &mask);
+    /// Removes the points with mask[i] set, the others keep their order
+    void removePoints(const std::vector<bool> &mask);
+    /// Removes the points for which pred(pntIdx) returns true, pred is
+    /// called from several threads
+    template<typename Predicate>
+    void removePoints(Predicate pred)
+    {
+        const int64_t nPoints = getNPoints();
+        std::vector<char> remove(nPoints);
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i < nPoints; i++) remove[i] = pred(i);
+        _removePoints(remove);
+    }
+
+    /// Sorts the points along a space filling curve through their
+    /// bounding box, so points that are close in space are also close in
+    /// memory (solver order scatters them). All the data of a point moves
+    /// together, in parallel, in whatever layout the points are. A second
+    /// copy of the points is needed while they are moved. The camera to
+    /// point index is rebuilt if it was built.
+    /// @returns table, point i is now point table[i]
+    std::vector<int64_t> reorderSpatially(SpaceFillingCurve curve = CURVE_MORTON);
+
+    /// Applies a similarity transform to points and cameras (point p
+    /// becomes trans * p), camera caches are refreshed
+    void transform(const Eigen::Matrix4d &trans);
+
+    /// Recomputes the derived quantities of every camera (see
+    /// CameraCache), done after loading or transforming. The second
+    /// version also sets the image sizes K and P are computed for.
+    void refreshCameraCaches();
+    void refreshCameraCaches(const std::vector<Eigen::Vector2i> &imageSizes);
+
+    /// Projects every point into every camera, in parallel over cameras
+    /// and ranges of points, the result agrees with Camera::world2im()
+    /// (up to rounding). Invalid cameras see no points.
+    void computeVisibility(Visibility &vis, const VisibilityOptions &opts = VisibilityOptions()) const;
+
+    /// Projects every point into the cameras that observe it and
+    /// compares the result with the key positions, in parallel over
+    /// points. Key positions are centered on the image with y pointing
+    /// up (Bundler's convention), no image size is needed.
+    void computeReprojectionErrors(ReprojectionErrors &errors, bool applyRadialDistortion = true) const;
 
     /// Returns size of image by looking at the header of the image file
     /// Assumes that the list file was loaded.
@@ -183,25 +702,213 @@ public:
     /// @returns 0 for failure and non zero otherwise
     int loadSIFTFeaturesForCamera(int camIdx, std::vector<SIFTFeature> &sift, bool throwException = false) const;
 
+    /// Points are kept either as a Point::Vector or as PointArrays
+    /// (ReadOptions::pointLayout). The non const accessors convert the
+    /// points to the layout they return, the const ones require the
+    /// points to be in that layout already.
+    PointLayout getPointLayout() const { return _pointLayout; }
+    void setPointLayout(PointLayout layout);
+
     /// Accessors
-    const Point::Vector &getPoints() const { return _points; };
+    const Point::Vector &getPoints() const { assert(_pointLayout == POINTS_AOS); return _points; };
+    const PointArrays &getPointArrays() const { assert(_pointLayout == POINTS_SOA); return _pointArrays; };
+    const CompactPointArrays &getCompactPoints() const { assert(_pointLayout == POINTS_COMPACT); return _compactPoints; };
     const Camera::Vector &getCameras() const { return _cameras; };
-    const std::vector<std::string> &getImageFileNames() const { return _imageFNames; };
-    Point::Vector &getPoints() { return _points; };
+    const ListFile &getImageList() const { return _imageList; };
+    Point::Vector &getPoints() { setPointLayout(POINTS_AOS); return _points; };
+    PointArrays &getPointArrays() { setPointLayout(POINTS_SOA); return _pointArrays; };
+    CompactPointArrays &getCompactPoints() { setPointLayout(POINTS_COMPACT); return _compactPoints; };
     Camera::Vector &getCameras() { return _cameras; };
-    std::vector<std::string> &getImageFileNames() { return _imageFNames; };
+    ListFile &getImageList() { return _imageList; };
+
+    /// Image file name of a camera, assumes that the list file was loaded
+    std::string getImageFileName(int camIdx) const { return _imageList.getFileName(camIdx).to_string(); }
 
 protected:
     void _updateNValidCams(); // TODO: get rid of this
 
+    void _readFileIStream(const char *bundlerFileName);
+    void _readFileBuffer(const char *bundlerFileName, const ReadOptions &opts);
+    void _readBinary(const char *data, size_t size);
+    void _readCameras(const char *bundlerFileName);
+    void _writeFileASCII(const char *bundlerFileName) const;
+    void _writeFileBinary(const char *bundlerFileName) const;
+    bool _readPointsParallel(const char *begin, const char *end, int64_t nPoints, int nThreads);
+    /// Copies a point out of PointArrays or CompactPointArrays
+    void _copyPoint(int64_t pntIdx, Point &pnt) const;
+    /// Starts a new arena for the view lists of _points, the old one is
+    /// released once the lists allocated from it are gone
+    ViewListEntry::Allocator _newViewListArena();
+    void _removePoints(const std::vector<char> &remove);
+    /// Camera c of observation j becomes remap(j, c), observations
+    /// mapped to a negative index are removed
+    template<typename Remap>
+    void _remapObservations(Remap remap);
+    /// Positions of points first to first + n - 1 (x, y, z of each one),
+    /// either in place or copied into buffer
+    const double *_getPositions(int64_t first, int64_t n, std::vector<double> &buffer) const;
+
 private:
     Camera::Vector _cameras;
     Point::Vector _points;
+    Arena::Ptr _viewListArena; // View lists of _points read from a file
+    PointArrays _pointArrays;
+    CompactPointArrays _compactPoints;
     int _nValidCams;  // TODO: get rid of this
+    int64_t _nPointsInFile;
     bool _cam2PointIndexInitialized;
+    std::vector<uint64_t> _cam2PointOffsets; // nCameras + 1 entries
+    std::vector<PointVisListIdxs> _cam2Point;
+    PointLayout _pointLayout;
 
     std::string _listFName, _bundleFName;
-    std::vector<std::string> _imageFNames;
+    ListFile _imageList;
+};
+
+// Read-only access to a reconstruction stored in the binary format
+// without loading it. The file is memory mapped, so opening it is
+// instant, any point can be accessed in O(1) and processes that open
+// the same file share the pages. Text bundle files are converted to a
+// binary cache file (by default the bundle filename followed by .bin)
+// the first time they are opened.
+class ReconstructionView
+{
+public:
+    typedef boost::shared_ptr<ReconstructionView> Ptr;
+
+    /// @param cacheFName where the binary version of a text bundle file is stored
+    ReconstructionView(const char *bundleFName, const char *cacheFName = NULL);
+
+    size_t getNCameras() const { return _nCameras; }
+    size_t getNPoints() const { return _nPoints; }
+    uint64_t getNObservations() const { return _nObservations; }
+
+    Camera getCamera(size_t camIdx) const;
+
+    Eigen::Map<const Eigen::Vector3d> getPosition(size_t pntIdx) const
+    {
+        return Eigen::Map<const Eigen::Vector3d>(_positions + 3 * pntIdx);
+    }
+
+    Color getColor(size_t pntIdx) const
+    {
+        const uint8_t *c = _colors + 3 * pntIdx;
+        return Color(c[0], c[1], c[2]);
+    }
+
+    ArrayView<PackedViewListEntry> getViewList(size_t pntIdx) const
+    {
+        return ArrayView<PackedViewListEntry>(_observations + _offsets[pntIdx], _offsets[pntIdx + 1] - _offsets[pntIdx]);
+    }
+
+    /// All positions (x, y, z of point 0 followed by the ones of point 1 and so on)
+    ArrayView<double> getPositions() const { return ArrayView<double>(_positions, 3 * _nPoints); }
+
+    /// Copies a point out of the mapping
+    void getPoint(size_t pntIdx, Point &pnt) const;
+
+    const char *getMappedFileName() const { return _mappedFName.c_str(); }
+
+private:
+    boost::shared_ptr<InputFile> _file;
+    std::string _mappedFName;
+
+    size_t _nCameras, _nPoints;
+    uint64_t _nObservations;
+
+    const double *_cameras;
+    const double *_positions;
+    const uint8_t *_colors;
+    const uint64_t *_offsets;
+    const PackedViewListEntry *_observations;
+
+    void _map(boost::shared_ptr<InputFile> file);
+};
+
+// Reads a bundle file one point at a time so files larger than the
+// available memory can be processed. The header and the cameras are
+// read when the file is opened. Text and binary files can be
+// compressed; each section of a binary file (positions, colors,
+// offsets and observations) is read sequentially by its own stream.
+class StreamReader
+{
+public:
+    StreamReader(const char *bundleFName);
+
+    const Camera::Vector &getCameras() const { return _cameras; }
+    int getNCameras() const { return _cameras.size(); }
+    int64_t getNPoints() const { return _nPoints; }
+
+    /// Reads the next point into pnt, reusing the memory it already holds
+    /// @returns false once all points have been read
+    bool readPoint(Point &pnt);
+
+private:
+    Camera::Vector _cameras;
+    int64_t _nPoints, _nextPoint;
+
+    // Text files
+    boost::shared_ptr<std::istream> _in;
+    std::vector<char> _buffer;
+    size_t _pos, _size;
+    bool _eof;
+
+    // Binary files, the section streams are opened by the first readPoint()
+    boost::shared_ptr<InputFile> _file;
+    uint64_t _sectionBegin[4];
+    boost::shared_ptr<std::istream> _positions, _colors, _offsets, _observations;
+    uint64_t _nObservations, _nextObservation;
+
+    void _refill();
+    void _readHeader();
+    void _readBinaryHeader();
+    boost::shared_ptr<std::istream> _openSection(uint64_t offset) const;
+};
+
+// Callback interface for visitPoints
+class PointVisitor
+{
+public:
+    virtual ~PointVisitor() {}
+
+    /// Called once before any point
+    virtual void visitCameras(const Camera::Vector & /*cameras*/, int64_t /*nPoints*/) {}
+
+    /// The point is only valid during the call
+    virtual void visitPoint(int64_t pntIdx, const Point &pnt) = 0;
+};
+
+/// Streams all points of a bundle file through visitor (memory use does
+/// not depend on the number of points)
+void visitPoints(const char *bundleFName, PointVisitor &visitor);
+
+// Writes a text bundle file one point at a time, compressed if the file
+// name asks for it (see CompressedFileWriter). When the number of points
+// is known in advance the file is written directly, otherwise the points
+// wait in a temporary file next to the output until close() can write
+// the header.
+class StreamWriter
+{
+public:
+    /// @param nPoints number of points that will be written, -1 if unknown
+    StreamWriter(const char *bundleFName, const Camera::Vector &cameras, int64_t nPoints = -1);
+    ~StreamWriter();
+
+    void writePoint(const Point &pnt);
+
+    /// Completes and closes the file, throws if nPoints was given and a
+    /// different number of points was written
+    void close();
+
+    int64_t getNPoints() const { return _nPoints; }
+
+private:
+    std::string _fname, _spoolFName;
+    boost::shared_ptr<CompressedFileWriter> _out;
+    std::string _buffer;
+    Camera::Vector _cameras; // Only kept until the header is written
+    int64_t _nPointsExpected, _nPoints;
+    bool _closed;
 };
 
 BUNDLER_NAMESPACE_END
@@ -24,6 +24,7 @@
 #define __SFMF_PMVS_HPP__
 
 #include <SfMFiles/sfmfiles>
+#include <SfMFiles/Arena.hpp>
 
 // File format reference:
 // http://grail.cs.washington.edu/software/pmvs/documentation.html
@@ -67,50 +68,36 @@ class Patch
 {
 public:
     typedef std::vector<Patch> Vector;
+    typedef ArenaAllocator<uint32_t> CameraAllocator;
+    typedef std::vector<uint32_t, CameraAllocator> CameraList;
 
     Eigen::Vector4d position, normal;
     double score; // Photometric consistency score, stays within -1 and 1 (good score)
     double debug1, debug2; // Numbers contained in the .patch file that are for debugging purposes
-    std::vector<uint32_t> goodCameras; // Which cameras see this point?
-    std::vector<uint32_t> badCameras;
+    CameraList goodCameras; // Which cameras see this point?
+    CameraList badCameras;
 
     Eigen::Vector3f color;
     float reconstructionAccuracy;
     float reconstructionSLevel;
 
     Patch() {};
-    Patch &operator = ( const Patch &source )
+    /// Camera lists allocated from allocator's arena
+    explicit Patch(const CameraAllocator &allocator): goodCameras(allocator), badCameras(allocator) {};
+    Patch &operator = ( const Patch & /*source*/ )
     {
         assert(0);
         return *this;
     }
 
-    Patch(const Patch &p)
+    Patch(const Patch &p):
+        position(p.position), normal(p.normal),
+        score(p.score), debug1(p.debug1), debug2(p.debug2),
+        goodCameras(p.goodCameras), badCameras(p.badCameras),
+        color(p.color),
+        reconstructionAccuracy(p.reconstructionAccuracy),
+        reconstructionSLevel(p.reconstructionSLevel)
     {
-        this->score = p.score;
-        this->debug1 = p.debug1;
-        this->debug2 = p.debug2;
-        this->position = p.position;
-        this->normal = p.normal;
-        this->goodCameras = p.goodCameras;
-        this->badCameras = p.badCameras;
-        this->color = p.color;
-        this->reconstructionAccuracy = p.reconstructionAccuracy;
-        this->reconstructionSLevel = p.reconstructionSLevel;
-    }
-
-    Patch(Patch &p)
-    {
-        this->score = p.score;
-        this->debug1 = p.debug1;
-        this->debug2 = p.debug2;
-        this->position = p.position;
-        this->normal = p.normal;
-        this->goodCameras = p.goodCameras;
-        this->badCameras = p.badCameras;
-        this->color = p.color;
-        this->reconstructionAccuracy = p.reconstructionAccuracy;
-        this->reconstructionSLevel = p.reconstructionSLevel;
     }
 };
 
@@ -121,6 +108,7 @@ private:
     //std::vector<uint32_t> _camIndexMapping;
 
     Patch::Vector _patches;
+    Arena::Ptr _cameraListArena; // Camera lists of the patches read from the file
     std::string _patchesFName; // Name of file containing patches data
 
     std::map<uint32_t, std::string> _imageFNames;
@@ -210,6 +198,12 @@ public:
 
     void mergeWith(const Reconstruction &other);
 
+    /// Sorts the patches along a space filling curve through their
+    /// bounding box so patches close in space are close in memory, see
+    /// Bundler::Reconstruction::reorderSpatially()
+    /// @returns table, patch i is now patch table[i]
+    std::vector<int64_t> reorderSpatially(SpaceFillingCurve curve = CURVE_MORTON);
+
     static std::string defaultOptionsFileForPatchFile(const std::string &patchFName);
 };
 
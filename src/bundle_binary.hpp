@@ -0,0 +1,158 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <SfMFiles/sfmfiles>
+#include <SfMFiles/Bundler.hpp>
+
+#ifndef __SFMF_BUNDLE_BINARY_HPP__
+#define __SFMF_BUNDLE_BINARY_HPP__
+
+#include <cstring>
+#include <algorithm>
+
+// Binary bundle file layout. All values are little endian and every
+// section starts at a multiple of 8 bytes so the file can be mapped
+// and used in place.
+//
+//   BinaryHeader                                   64 bytes
+//   Cameras       nCameras x 15 doubles            focal length, k1, k2,
+//                                                  rotation (row major), translation
+//   Positions     nPoints x 3 doubles
+//   Colors        nPoints x 3 bytes                r, g, b
+//   Offsets       (nPoints + 1) x uint64           first observation of each point
+//   Observations  nObservations x BinaryObservation
+
+BUNDLER_NAMESPACE_BEGIN
+
+static const char BINARY_MAGIC[8] = {'S', 'f', 'M', 'F', 'B', 'u', 'n', '\0'};
+static const uint32_t BINARY_VERSION = 1;
+
+class BinaryHeader
+{
+public:
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // Unused, must be 0
+    uint64_t nCameras;
+    uint64_t nPoints;
+    uint64_t nObservations;
+    uint64_t reserved[3];
+
+    BinaryHeader(): version(BINARY_VERSION), flags(0), nCameras(0), nPoints(0), nObservations(0)
+    {
+        memcpy(magic, BINARY_MAGIC, sizeof(magic));
+        memset(reserved, 0, sizeof(reserved));
+    }
+};
+
+typedef PackedViewListEntry BinaryObservation;
+
+// Byte offsets of each section, computed from the counts in the header
+class BinaryLayout
+{
+public:
+    static const int CAMERA_SIZE = 15 * sizeof(double);
+
+    uint64_t cameras, positions, colors, offsets, observations, fileSize;
+
+    BinaryLayout(const BinaryHeader &h)
+    {
+        cameras      = sizeof(BinaryHeader);
+        positions    = cameras + h.nCameras * CAMERA_SIZE;
+        colors       = positions + h.nPoints * 3 * sizeof(double);
+        offsets      = _align(colors + h.nPoints * 3);
+        observations = offsets + (h.nPoints + 1) * sizeof(uint64_t);
+        fileSize     = observations + h.nObservations * sizeof(BinaryObservation);
+    }
+
+private:
+    static uint64_t _align(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+};
+
+// Whether a file of the given size can hold the counts in the header,
+// checked before computing a BinaryLayout so the offsets of a damaged
+// header can not wrap around
+inline
+bool
+binaryCountsFit(const BinaryHeader &h, uint64_t size)
+{
+    const uint64_t pointSize = 3 * sizeof(double) + 3 + sizeof(uint64_t);
+    return h.nCameras <= size / BinaryLayout::CAMERA_SIZE && h.nPoints < size / pointSize &&
+           h.nObservations <= size / sizeof(BinaryObservation);
+}
+
+inline
+bool
+isLittleEndianHost()
+{
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+/// Converts values between host and file byte order (no op on little endian hosts)
+template<typename T>
+inline
+void
+swapToLittleEndian(T *values, size_t n)
+{
+    if(isLittleEndianHost()) return;
+
+    for(size_t i = 0; i < n; i++) {
+        uint8_t *b = (uint8_t *)&values[i];
+        std::reverse(b, b + sizeof(T));
+    }
+}
+
+inline
+void
+swapToLittleEndian(BinaryHeader &h)
+{
+    swapToLittleEndian(&h.version, 1);
+    swapToLittleEndian(&h.flags, 1);
+    swapToLittleEndian(&h.nCameras, 1);
+    swapToLittleEndian(&h.nPoints, 1);
+    swapToLittleEndian(&h.nObservations, 1);
+}
+
+inline
+void
+swapToLittleEndian(BinaryObservation *obs, size_t n)
+{
+    if(isLittleEndianHost()) return;
+
+    for(size_t i = 0; i < n; i++) {
+        swapToLittleEndian(&obs[i].camera, 1);
+        swapToLittleEndian(&obs[i].key, 1);
+        swapToLittleEndian(obs[i].keyPosition, 2);
+    }
+}
+
+/// @returns true if the buffer starts with the binary bundle magic number
+inline
+bool
+hasBinaryMagic(const char *buffer, size_t size)
+{
+    return size >= sizeof(BINARY_MAGIC) && memcmp(buffer, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+BUNDLER_NAMESPACE_END
+
+#endif // __SFMF_BUNDLE_BINARY_HPP__
@@ -0,0 +1,81 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <SfMFiles/sfmfiles>
+
+#ifndef __SFMF_FORMATTER_HPP__
+#define __SFMF_FORMATTER_HPP__
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L && !defined(SFMF_HAVE_CHARCONV)
+#define SFMF_HAVE_CHARCONV
+#endif
+
+SFMFILES_NAMESPACE_BEGIN
+
+// Counterpart of TextScanner, appends numbers as text to a string
+// without going through a stream. Doubles are written with the fewest
+// digits that read back to the same value (std::to_chars), so files are
+// smaller than with setprecision(16) and values survive a round trip
+// bit for bit. Without <charconv> support "%.17g" is used, which also
+// round trips but is not as short.
+class TextFormatter
+{
+public:
+    TextFormatter(std::string &out): _out(out) {}
+
+    void append(char c) { _out.push_back(c); }
+    void append(const char *s) { _out.append(s); }
+
+    void appendInt(long long v)
+    {
+        char buf[32];
+#ifdef SFMF_HAVE_CHARCONV
+        _out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+#else
+        _out.append(buf, snprintf(buf, sizeof(buf), "%lld", v));
+#endif
+    }
+
+    void appendDouble(double v)
+    {
+        char buf[32];
+#ifdef SFMF_HAVE_CHARCONV
+        _out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+#else
+        _out.append(buf, snprintf(buf, sizeof(buf), "%.17g", v));
+#endif
+    }
+
+private:
+    std::string &_out;
+};
+
+SFMFILES_NAMESPACE_END
+
+#endif // __SFMF_FORMATTER_HPP__
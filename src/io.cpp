@@ -1,33 +1,654 @@
 #include "io.hpp"
 
 #include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/device/file.hpp>
+
+#include <zlib.h>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#ifdef SFMF_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef SFMF_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 SFMFILES_NAMESPACE_BEGIN
 
-CompressedFileReader::CompressedFileReader(const char *fname, bool throwException)
+void
+InputFile::_error() const
 {
-    FILE *file = fopen(fname, "rb");
-    if(file == NULL) {
-        if(throwException) {
-            std::stringstream errMsg;
-            errMsg << "Could not open " << fname << " for reading";
-            throw sfmf::Error(errMsg.str().c_str());
-        } else return;
+    std::stringstream errMsg;
+    errMsg << "Could not read file " << _fname << ": " << strerror(errno);
+    throw sfmf::Error(errMsg.str());
+}
+
+// Whole file mapped in memory, pages are brought in by the kernel
+class MmapInputFile : public InputFile
+{
+public:
+    MmapInputFile(const char *fname, int fd, uint64_t size): InputFile(fname, fd, size), _map(NULL), _pos(0)
+    {
+        if(size == 0) return; // Empty files can not be mapped
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            // The destructor does not run if the constructor throws
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            _error();
+        }
+        _map = (const char *)map;
+#ifdef MADV_SEQUENTIAL
+        madvise(map, size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    ~MmapInputFile()
+    {
+        if(_map) munmap((void *)_map, _size);
+        ::close(_fd);
+    }
+
+    size_t read(char *buffer, size_t size)
+    {
+        size_t n = readAt(_pos, buffer, size);
+        _pos += n;
+        return n;
+    }
+
+    size_t readAt(uint64_t offset, char *buffer, size_t size)
+    {
+        if(offset >= _size) return 0;
+        size = std::min<uint64_t>(size, _size - offset);
+        memcpy(buffer, _map + offset, size);
+        return size;
+    }
+
+    const char *data() const { return _map; }
+
+private:
+    const char *_map;
+    uint64_t _pos;
+};
+
+// Reads are served from a block of PREAD_BLOCK_SIZE bytes, so the disk
+// sees few large requests no matter how the caller reads
+class PreadInputFile : public InputFile
+{
+public:
+    PreadInputFile(const char *fname, int fd, uint64_t size):
+        InputFile(fname, fd, size), _offset(0), _blockPos(0), _blockSize(0) {}
+
+    ~PreadInputFile() { ::close(_fd); }
+
+    size_t read(char *buffer, size_t size)
+    {
+        size_t nRead = 0;
+        while(nRead < size) {
+            if(_blockPos == _blockSize) {
+                // Large requests skip the block
+                if(size - nRead >= PREAD_BLOCK_SIZE) {
+                    size_t n = readAt(_offset, buffer + nRead, size - nRead);
+                    _offset += n;
+                    nRead += n;
+                    break;
+                }
+                if(_block.empty()) _block.resize(PREAD_BLOCK_SIZE);
+                _blockSize = readAt(_offset, _block.data(), _block.size());
+                _offset += _blockSize;
+                _blockPos = 0;
+                if(_blockSize == 0) break;
+            }
+            size_t n = std::min(size - nRead, _blockSize - _blockPos);
+            memcpy(buffer + nRead, _block.data() + _blockPos, n);
+            _blockPos += n;
+            nRead += n;
+        }
+        return nRead;
+    }
+
+    size_t readAt(uint64_t offset, char *buffer, size_t size)
+    {
+        size_t nRead = 0;
+        while(nRead < size) {
+            ssize_t n = pread(_fd, buffer + nRead, size - nRead, offset + nRead);
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                _error();
+            }
+            if(n == 0) break;
+            nRead += n;
+        }
+        return nRead;
+    }
+
+private:
+    std::vector<char> _block;
+    uint64_t _offset;
+    size_t _blockPos, _blockSize;
+};
+
+// stdio with a STREAM_BUFFER_SIZE buffer
+class StreamInputFile : public InputFile
+{
+public:
+    StreamInputFile(const char *fname, int fd, uint64_t size): InputFile(fname, fd, size)
+    {
+        _file = fdopen(fd, "rb");
+        if(_file == NULL) {
+            ::close(fd);
+            _error();
+        }
+        setvbuf(_file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+    }
+
+    ~StreamInputFile() { fclose(_file); }
+
+    size_t read(char *buffer, size_t size)
+    {
+        size_t n = fread(buffer, 1, size, _file);
+        if(n < size && ferror(_file)) _error();
+        return n;
+    }
+
+    size_t readAt(uint64_t offset, char *buffer, size_t size)
+    {
+        // pread does not touch the stream position
+        size_t nRead = 0;
+        while(nRead < size) {
+            ssize_t n = pread(_fd, buffer + nRead, size - nRead, offset + nRead);
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                _error();
+            }
+            if(n == 0) break;
+            nRead += n;
+        }
+        return nRead;
+    }
+
+private:
+    FILE *_file;
+};
+
+// Sequential reads on top of readAt() of another file
+class CursorInputFile : public InputFile
+{
+public:
+    CursorInputFile(InputFile::Ptr file, uint64_t offset):
+        InputFile(file->getFileName().c_str(), -1, file->getSize()), _file(file), _pos(offset) {}
+
+    size_t read(char *buffer, size_t size)
+    {
+        size_t n = _file->readAt(_pos, buffer, size);
+        _pos += n;
+        return n;
     }
 
-    // Read the first two bites
-    char fileType[3];
-    fread(fileType, sizeof(char), sizeof(fileType) - 1, file);
-    fileType[2] = '\0';
-    fclose(file);
+    size_t readAt(uint64_t offset, char *buffer, size_t size) { return _file->readAt(offset, buffer, size); }
+
+    const char *data() const { return _file->data(); }
+
+private:
+    InputFile::Ptr _file;
+    uint64_t _pos;
+};
+
+InputFile::Ptr
+InputFile::cursor(Ptr file, uint64_t offset)
+{
+    return Ptr(new CursorInputFile(file, offset));
+}
 
-    // Is this a GZiped file?
-    if (strcmp(fileType, "\x1f\x8b") == 0) {
-        this->push(boost::iostreams::gzip_decompressor());
+IOBackend
+InputFile::defaultBackend()
+{
+    const char *name = getenv("SFMF_IO_BACKEND");
+    if(name == NULL || *name == '\0') return IO_BACKEND_PREAD;
+    if(strcmp(name, "mmap") == 0) return IO_BACKEND_MMAP;
+    if(strcmp(name, "pread") == 0) return IO_BACKEND_PREAD;
+    if(strcmp(name, "stream") == 0) return IO_BACKEND_STREAM;
+
+    LOG_WARN("Unknown SFMF_IO_BACKEND " << name << ", using pread");
+    return IO_BACKEND_PREAD;
+}
+
+InputFile::Ptr
+InputFile::open(const char *fname, IOBackend backend)
+{
+    int fd = ::open(fname, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        if(fd >= 0) ::close(fd);
+        std::stringstream errMsg;
+        errMsg << "Could not open " << fname << " for reading";
+        throw sfmf::Error(errMsg.str());
     }
 
-    this->push(boost::iostreams::file_source(fname));
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if(backend == IO_BACKEND_DEFAULT) backend = defaultBackend();
+    // Only regular files can be mapped
+    if(backend == IO_BACKEND_MMAP && !S_ISREG(st.st_mode)) backend = IO_BACKEND_PREAD;
+
+    switch(backend) {
+    case IO_BACKEND_MMAP:
+        return Ptr(new MmapInputFile(fname, fd, st.st_size));
+    case IO_BACKEND_STREAM:
+        return Ptr(new StreamInputFile(fname, fd, st.st_size));
+    default:
+        return Ptr(new PreadInputFile(fname, fd, st.st_size));
+    }
+}
+
+Compression
+detectCompression(InputFile &file)
+{
+    unsigned char magic[4] = {0, 0, 0, 0};
+    size_t nMagic = file.readAt(0, (char *)magic, sizeof(magic));
+
+    if(nMagic >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return COMPRESSION_GZIP;
+    if(nMagic == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) return COMPRESSION_ZSTD;
+    if(nMagic == 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18) return COMPRESSION_LZ4;
+    return COMPRESSION_NONE;
+}
+
+Compression
+detectCompression(const char *fname)
+{
+    InputFile::Ptr file;
+    try {
+        file = InputFile::open(fname, IO_BACKEND_PREAD);
+    } catch (sfmf::Error &e) {
+        return COMPRESSION_NONE;
+    }
+    return detectCompression(*file);
+}
+
+Compression
+compressionFromFileName(const char *fname)
+{
+    size_t len = strlen(fname);
+    if(len >= 3 && strcmp(fname + len - 3, ".gz") == 0) return COMPRESSION_GZIP;
+    if(len >= 4 && strcmp(fname + len - 4, ".zst") == 0) return COMPRESSION_ZSTD;
+    if(len >= 4 && strcmp(fname + len - 4, ".lz4") == 0) return COMPRESSION_LZ4;
+    return COMPRESSION_NONE;
+}
+
+static
+void
+throwUnsupported(const char *fname, const char *format)
+{
+    std::stringstream errMsg;
+    errMsg << "Can not handle " << fname << ", SfMFiles was built without " << format << " support";
+    throw sfmf::Error(errMsg.str());
+}
+
+static
+void
+checkSupported(const char *fname, Compression compression)
+{
+    const char *missing = NULL;
+    switch(compression) {
+#ifndef SFMF_HAVE_ZSTD
+    case COMPRESSION_ZSTD: missing = "zstd"; break;
+#endif
+#ifndef SFMF_HAVE_LZ4
+    case COMPRESSION_LZ4: missing = "lz4"; break;
+#endif
+    default: break;
+    }
+    if(missing != NULL) throwUnsupported(fname, missing);
+}
+
+// Decompresses a file for which there is no boost::iostreams filter
+class Decoder
+{
+public:
+    Decoder(InputFile::Ptr file):
+        _fname(file->getFileName()), _input(1 << 17), _inPos(0), _inSize(0), _eof(false), _file(file) {}
+
+    virtual ~Decoder() {}
+
+    std::streamsize read(char *s, std::streamsize n)
+    {
+        for(;;) {
+            if(_inPos == _inSize && !_eof) {
+                _inSize = _file->read(_input.data(), _input.size());
+                _inPos = 0;
+                _eof = _inSize == 0;
+            }
+
+            size_t nOut = _decode(s, n);
+            if(nOut) return nOut;
+            if(_eof) {
+                if(!_atFrameEnd()) _error("unexpected end of file");
+                return -1;
+            }
+        }
+    }
+
+protected:
+    std::string _fname;
+    std::vector<char> _input;
+    size_t _inPos, _inSize;
+    bool _eof;
+
+    /// Consumes input from _input[_inPos, _inSize) and writes up to n bytes to s
+    virtual size_t _decode(char *s, size_t n) = 0;
+
+    /// @returns true if the last frame is complete
+    virtual bool _atFrameEnd() const = 0;
+
+    void _error(const char *what) const
+    {
+        std::stringstream errMsg;
+        errMsg << "Could not decompress " << _fname << ": " << what;
+        throw sfmf::Error(errMsg.str());
+    }
+
+private:
+    InputFile::Ptr _file;
+};
+
+#ifdef SFMF_HAVE_ZSTD
+class ZstdDecoder : public Decoder
+{
+public:
+    ZstdDecoder(InputFile::Ptr file): Decoder(file), _frameDone(true) { _ctx = ZSTD_createDCtx(); }
+    ~ZstdDecoder() { ZSTD_freeDCtx(_ctx); }
+
+protected:
+    size_t _decode(char *s, size_t n)
+    {
+        ZSTD_inBuffer in = {_input.data(), _inSize, _inPos};
+        ZSTD_outBuffer out = {s, n, 0};
+        // Concatenated frames are decoded one after the other. Called at
+        // least once, even without input, to flush buffered output.
+        do {
+            size_t inPos = in.pos, outPos = out.pos;
+            size_t ret = ZSTD_decompressStream(_ctx, &out, &in);
+            if(ZSTD_isError(ret)) _error(ZSTD_getErrorName(ret));
+            if(ret == 0) _frameDone = true;
+            else if(in.pos != inPos || out.pos != outPos) _frameDone = false;
+        } while(out.pos == 0 && in.pos < in.size);
+        _inPos = in.pos;
+        return out.pos;
+    }
+
+    bool _atFrameEnd() const { return _frameDone; }
+
+private:
+    ZSTD_DCtx *_ctx;
+    bool _frameDone;
+};
+#endif
+
+#ifdef SFMF_HAVE_LZ4
+class Lz4Decoder : public Decoder
+{
+public:
+    Lz4Decoder(InputFile::Ptr file): Decoder(file), _frameDone(true)
+    {
+        if(LZ4F_isError(LZ4F_createDecompressionContext(&_ctx, LZ4F_VERSION))) _error("could not create context");
+    }
+    ~Lz4Decoder() { LZ4F_freeDecompressionContext(_ctx); }
+
+protected:
+    size_t _decode(char *s, size_t n)
+    {
+        size_t nOut = 0;
+        // A new frame starts automatically after the end of the previous
+        // one. Called at least once, even without input, to flush buffered output.
+        do {
+            size_t dstSize = n, srcSize = _inSize - _inPos;
+            size_t ret = LZ4F_decompress(_ctx, s, &dstSize, _input.data() + _inPos, &srcSize, NULL);
+            if(LZ4F_isError(ret)) _error(LZ4F_getErrorName(ret));
+            if(ret == 0) _frameDone = true;
+            else if(srcSize || dstSize) _frameDone = false;
+            _inPos += srcSize;
+            nOut = dstSize;
+        } while(nOut == 0 && _inPos < _inSize);
+        return nOut;
+    }
+
+    bool _atFrameEnd() const { return _frameDone; }
+
+private:
+    LZ4F_dctx *_ctx;
+    bool _frameDone;
+};
+#endif
+
+// Source device over a Decoder, copies share the decoder
+class DecoderSource
+{
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    DecoderSource(Decoder *decoder): _decoder(decoder) {}
+
+    std::streamsize read(char *s, std::streamsize n) { return _decoder->read(s, n); }
+
+private:
+    boost::shared_ptr<Decoder> _decoder;
+};
+
+// Source device over an InputFile, copies share the file
+class InputFileSource
+{
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    InputFileSource(InputFile::Ptr file): _file(file) {}
+
+    std::streamsize read(char *s, std::streamsize n)
+    {
+        size_t nRead = _file->read(s, n);
+        return nRead ? std::streamsize(nRead) : -1;
+    }
+
+private:
+    InputFile::Ptr _file;
+};
+
+// Sets up in to read the decompressed content of file
+static
+void
+pushDecompressor(boost::iostreams::filtering_istream &in, InputFile::Ptr file, Compression compression)
+{
+    switch(compression) {
+    case COMPRESSION_GZIP:
+        in.push(boost::iostreams::gzip_decompressor());
+        in.push(InputFileSource(file), 1 << 16);
+        break;
+    case COMPRESSION_ZSTD:
+#ifdef SFMF_HAVE_ZSTD
+        in.push(DecoderSource(new ZstdDecoder(file)), 1 << 16);
+#else
+        throwUnsupported(file->getFileName().c_str(), "zstd");
+#endif
+        break;
+    case COMPRESSION_LZ4:
+#ifdef SFMF_HAVE_LZ4
+        in.push(DecoderSource(new Lz4Decoder(file)), 1 << 16);
+#else
+        throwUnsupported(file->getFileName().c_str(), "lz4");
+#endif
+        break;
+    default:
+        in.push(InputFileSource(file), 1 << 16);
+        break;
+    }
+}
+
+// Decompresses a file on its own thread. Buffers are filled by the
+// thread in ring order and handed to read() once full.
+class ReadAheadState
+{
+public:
+    ReadAheadState(InputFile::Ptr file, Compression compression, size_t bufferSize, int nBuffers):
+        _file(file), _compression(compression), _buffers(nBuffers, std::vector<char>(bufferSize)), _sizes(nBuffers, 0),
+        _head(0), _tail(0), _count(0), _pos(0), _done(false), _stop(false)
+    {
+        _thread = std::thread(&ReadAheadState::_run, this);
+    }
+
+    ~ReadAheadState()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _freed.notify_all();
+        _thread.join();
+    }
+
+    std::streamsize read(char *s, std::streamsize n)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _filled.wait(lock, [this] { return _count > 0 || _done; });
+        if(_count == 0) {
+            // Errors are reported to the reader as they would be without
+            // read ahead, the stream turns them into badbit
+            if(_error) std::rethrow_exception(_error);
+            return -1;
+        }
+
+        // The buffer at _tail belongs to the reader until it is released
+        const std::vector<char> &buffer = _buffers[_tail];
+        size_t size = _sizes[_tail];
+        lock.unlock();
+
+        std::streamsize nCopy = std::min<std::streamsize>(n, size - _pos);
+        memcpy(s, buffer.data() + _pos, nCopy);
+        _pos += nCopy;
+
+        if(_pos == size) {
+            lock.lock();
+            _pos = 0;
+            _tail = (_tail + 1) % _buffers.size();
+            _count--;
+            lock.unlock();
+            _freed.notify_one();
+        }
+
+        return nCopy;
+    }
+
+private:
+    static const size_t READ_PIECE_SIZE = 1 << 16;
+
+    InputFile::Ptr _file;
+    Compression _compression;
+    std::vector< std::vector<char> > _buffers;
+    std::vector<size_t> _sizes;
+    size_t _head, _tail, _count, _pos;
+    bool _done, _stop;
+    std::exception_ptr _error;
+
+    std::mutex _mutex;
+    std::condition_variable _filled, _freed;
+    std::thread _thread;
+
+    void _run()
+    {
+        try {
+            boost::iostreams::filtering_istream in;
+            pushDecompressor(in, _file, _compression);
+
+            for(;;) {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _freed.wait(lock, [this] { return _count < _buffers.size() || _stop; });
+                    if(_stop) break;
+                }
+
+                // Slot _head is not visible to the reader until _count grows
+                // Filled in pieces, a read that fails returns nothing
+                std::vector<char> &buffer = _buffers[_head];
+                size_t size = 0;
+                while(size < buffer.size() && in.good()) {
+                    in.read(buffer.data() + size, std::min<size_t>(READ_PIECE_SIZE, buffer.size() - size));
+                    size += in.gcount();
+                }
+
+                // The stream swallows decompression errors and only sets
+                // badbit, data decoded before the error is still handed out
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(size) {
+                    _sizes[_head] = size;
+                    _head = (_head + 1) % _buffers.size();
+                    _count++;
+                }
+                if(in.bad()) {
+                    std::stringstream errMsg;
+                    errMsg << "Could not decompress " << _file->getFileName() << ": data is truncated or corrupt";
+                    _error = std::make_exception_ptr(sfmf::Error(errMsg.str()));
+                }
+                if(!in.good()) {
+                    _done = true;
+                    _filled.notify_one();
+                    break;
+                }
+                _filled.notify_one();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _error = std::current_exception();
+            _done = true;
+            _filled.notify_one();
+        }
+    }
+};
+
+// Source device that reads from a ReadAheadState, copies share the state
+class ReadAheadSource
+{
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    ReadAheadSource(InputFile::Ptr file, Compression compression, size_t bufferSize, int nBuffers):
+        _state(new ReadAheadState(file, compression, bufferSize, nBuffers)) {}
+
+    std::streamsize read(char *s, std::streamsize n) { return _state->read(s, n); }
+
+private:
+    boost::shared_ptr<ReadAheadState> _state;
+};
+
+CompressedFileReader::CompressedFileReader(const char *fname, bool throwException, bool readAhead, IOBackend backend)
+{
+    InputFile::Ptr file;
+    try {
+        file = InputFile::open(fname, backend);
+    } catch (sfmf::Error &e) {
+        if(throwException) throw;
+        return;
+    }
+
+    _open(file, readAhead);
+
     if(!this->good()) {
         if(throwException) {
             std::stringstream err;
@@ -37,4 +658,660 @@ CompressedFileReader::CompressedFileReader(const char *fname, bool throwExceptio
     }
 }
 
-SFMFILES_NAMESPACE_END
\ No newline at end of file
+CompressedFileReader::CompressedFileReader(InputFile::Ptr file, bool readAhead)
+{
+    _open(file, readAhead);
+}
+
+void
+CompressedFileReader::_open(InputFile::Ptr file, bool readAhead)
+{
+    Compression compression = detectCompression(*file);
+    checkSupported(file->getFileName().c_str(), compression);
+    if (compression != COMPRESSION_NONE && readAhead) {
+        this->push(ReadAheadSource(file, compression, READ_AHEAD_BUFFER_SIZE, READ_AHEAD_N_BUFFERS), 1 << 16);
+    } else {
+        pushDecompressor(*this, file, compression);
+    }
+}
+
+void
+readFileIntoBuffer(const char *fname, std::vector<char> &buffer, bool useGzipIndex, IOBackend backend)
+{
+    buffer.clear();
+
+    InputFile::Ptr file = InputFile::open(fname, backend);
+    Compression compression = detectCompression(*file);
+    if(compression == COMPRESSION_NONE) {
+        // Plain file, size is known so read it in one go
+        buffer.resize(file->getSize());
+        if(file->readAt(0, buffer.data(), buffer.size()) != buffer.size()) {
+            std::stringstream err;
+            err << "Could not read file " << fname;
+            throw sfmf::Error(err.str());
+        }
+        return;
+    }
+
+    if(useGzipIndex && compression == COMPRESSION_GZIP) {
+        GzipIndex index;
+        std::string indexFName = GzipIndex::indexFileName(fname);
+        bool haveIndex = false;
+        try {
+            index.readFile(indexFName.c_str());
+            haveIndex = index.isUpToDate(fname, indexFName.c_str());
+        } catch (sfmf::Error &e) {
+            // No index yet
+        }
+
+        if(haveIndex) {
+            index.readAll(file, buffer);
+        } else {
+            index.build(file, GzipIndex::DEFAULT_SPACING, &buffer);
+            try {
+                index.writeFile(indexFName.c_str());
+            } catch (sfmf::Error &e) {
+                LOG_WARN("Could not save gzip index: " << e.what());
+            }
+        }
+        return;
+    }
+
+    CompressedFileReader in(file);
+    const size_t chunkSize = 1 << 22;
+    size_t size = 0;
+    while(in.good()) {
+        buffer.resize(size + chunkSize);
+        in.read(buffer.data() + size, chunkSize);
+        size += in.gcount();
+    }
+    // Decompression errors only set badbit
+    if(in.bad()) {
+        buffer.clear();
+        std::stringstream err;
+        err << "Could not read file " << fname << ": compressed data is truncated or corrupt";
+        throw sfmf::Error(err.str());
+    }
+    buffer.resize(size);
+}
+
+// Collects output in blocks and compresses full batches of blocks in
+// parallel, each block into its own gzip member (zstd or lz4 frame)
+class ParallelCompressBuffer : public std::streambuf
+{
+public:
+    ParallelCompressBuffer(FILE *file, Compression compression, int nThreads, int level, size_t blockSize):
+        _file(file), _compression(compression), _nThreads(nThreads), _level(level), _blockSize(blockSize),
+        _failed(false), _empty(true)
+    {
+        _nextBlock();
+    }
+
+    ~ParallelCompressBuffer()
+    {
+        if(_file != NULL) close();
+    }
+
+    /// @returns false if anything went wrong since the buffer was created
+    bool close()
+    {
+        _finishBlock();
+        // Even an empty file needs one member to be valid
+        if(_empty && _pending.empty()) _pending.push_back(std::vector<char>());
+        _compressPending();
+        if(fclose(_file) != 0) _failed = true;
+        _file = NULL;
+        return !_failed;
+    }
+
+protected:
+    int_type overflow(int_type c)
+    {
+        _finishBlock();
+        if(_pending.size() >= size_t(_nThreads)) _compressPending();
+        _nextBlock();
+
+        if(_failed) return traits_type::eof();
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+private:
+    FILE *_file;
+    Compression _compression;
+    int _nThreads, _level;
+    size_t _blockSize;
+    bool _failed, _empty;
+
+    std::vector<char> _block;
+    std::vector< std::vector<char> > _pending;
+
+    void _nextBlock()
+    {
+        _block.resize(_blockSize);
+        setp(_block.data(), _block.data() + _block.size());
+    }
+
+    void _finishBlock()
+    {
+        size_t used = pptr() - pbase();
+        if(used == 0) return;
+
+        _block.resize(used);
+        _pending.push_back(std::vector<char>());
+        _pending.back().swap(_block);
+        setp(NULL, NULL);
+    }
+
+    void _compressPending()
+    {
+        const int nBlocks = _pending.size();
+        std::vector< std::vector<unsigned char> > members(nBlocks);
+        int nErrors = 0;
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(_nThreads) reduction(+:nErrors)
+        for(int i = 0; i < nBlocks; i++) {
+            bool ok = false;
+            switch(_compression) {
+            case COMPRESSION_ZSTD:
+                ok = _compressZstd(_pending[i], members[i]);
+                break;
+            case COMPRESSION_LZ4:
+                ok = _compressLz4(_pending[i], members[i]);
+                break;
+            default:
+                ok = _compressGzip(_pending[i], members[i]);
+                break;
+            }
+            if(!ok) nErrors++;
+        }
+
+        for(int i = 0; i < nBlocks && !_failed; i++) {
+            if(nErrors || fwrite(members[i].data(), 1, members[i].size(), _file) != members[i].size()) _failed = true;
+        }
+        _pending.clear();
+        if(nBlocks) _empty = false;
+    }
+
+    bool _compressGzip(const std::vector<char> &in, std::vector<unsigned char> &out) const
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // 16 + MAX_WBITS writes a gzip header and trailer
+        int level = _level < 0 ? 6 : _level;
+        if(deflateInit2(&zs, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+        out.resize(deflateBound(&zs, in.size()));
+        zs.next_in = (Bytef *)in.data();
+        zs.avail_in = in.size();
+        zs.next_out = out.data();
+        zs.avail_out = out.size();
+
+        int ret = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+
+#ifdef SFMF_HAVE_ZSTD
+    bool _compressZstd(const std::vector<char> &in, std::vector<unsigned char> &out) const
+    {
+        out.resize(ZSTD_compressBound(in.size()));
+        size_t size = ZSTD_compress(out.data(), out.size(), in.data(), in.size(), _level < 0 ? ZSTD_CLEVEL_DEFAULT : _level);
+        if(ZSTD_isError(size)) return false;
+        out.resize(size);
+        return true;
+    }
+#else
+    bool _compressZstd(const std::vector<char> & /*in*/, std::vector<unsigned char> & /*out*/) const
+    {
+        return false;
+    }
+#endif
+
+#ifdef SFMF_HAVE_LZ4
+    bool _compressLz4(const std::vector<char> &in, std::vector<unsigned char> &out) const
+    {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = _level < 0 ? 0 : _level;
+        prefs.frameInfo.contentSize = in.size();
+
+        out.resize(LZ4F_compressFrameBound(in.size(), &prefs));
+        size_t size = LZ4F_compressFrame(out.data(), out.size(), in.data(), in.size(), &prefs);
+        if(LZ4F_isError(size)) return false;
+        out.resize(size);
+        return true;
+    }
+#else
+    bool _compressLz4(const std::vector<char> & /*in*/, std::vector<unsigned char> & /*out*/) const
+    {
+        return false;
+    }
+#endif
+};
+
+CompressedFileWriter::CompressedFileWriter(const char *fname, int nThreads, int level, size_t blockSize):
+    std::ostream(NULL), _fname(fname), _closed(false)
+{
+    Compression compression = compressionFromFileName(fname);
+    checkSupported(fname, compression);
+    if(compression != COMPRESSION_NONE) {
+        FILE *file = fopen(fname, "wb");
+        if(file == NULL) {
+            std::stringstream errMsg;
+            errMsg << "Could not open file " << fname << " for writting";
+            throw sfmf::Error(errMsg.str());
+        }
+
+        if(nThreads <= 0) {
+            nThreads = 1;
+#ifdef _OPENMP
+            nThreads = omp_get_max_threads();
+#endif
+        }
+        _buffer.reset(new ParallelCompressBuffer(file, compression, nThreads, level, blockSize));
+    } else {
+        std::filebuf *file = new std::filebuf();
+        _buffer.reset(file);
+        if(file->open(fname, std::ios::out | std::ios::binary) == NULL) {
+            std::stringstream errMsg;
+            errMsg << "Could not open file " << fname << " for writting";
+            throw sfmf::Error(errMsg.str());
+        }
+    }
+
+    rdbuf(_buffer.get());
+}
+
+CompressedFileWriter::~CompressedFileWriter()
+{
+    // Destructors should not throw, errors are only reported by close()
+    try {
+        if(!_closed) close();
+    } catch (sfmf::Error &e) {
+        LOG_WARN(e.what());
+    }
+}
+
+void
+CompressedFileWriter::close()
+{
+    _closed = true;
+    flush();
+
+    bool ok = good();
+    ParallelCompressBuffer *compressed = dynamic_cast<ParallelCompressBuffer *>(_buffer.get());
+    if(compressed != NULL) ok = compressed->close() && ok;
+    else ok = (((std::filebuf *)_buffer.get())->close() != NULL) && ok;
+
+    if(!ok) {
+        setstate(std::ios::badbit);
+        std::stringstream errMsg;
+        errMsg << "Could not write file " << _fname;
+        throw sfmf::Error(errMsg.str());
+    }
+}
+
+bool
+CompressedFileWriter::isCompressedFileName(const char *fname)
+{
+    return compressionFromFileName(fname) != COMPRESSION_NONE;
+}
+
+// Size of the history deflate can refer back to
+static const int GZIP_WINDOW_SIZE = 32768;
+static const int GZIP_INPUT_CHUNK = 1 << 16;
+
+static const char GZIP_INDEX_MAGIC[8] = {'S', 'f', 'M', 'F', 'G', 'z', 'i', '\0'};
+static const uint32_t GZIP_INDEX_VERSION = 1;
+
+static
+void
+throwGzipError(const char *fname, const char *what)
+{
+    std::stringstream errMsg;
+    errMsg << "Could not decompress " << fname << ": " << what;
+    throw sfmf::Error(errMsg.str());
+}
+
+void
+GzipIndex::build(InputFile::Ptr file, uint64_t spacing, std::vector<char> *content)
+{
+    const char *gzFName = file->getFileName().c_str();
+    _checkpoints.clear();
+    if(content) content->clear();
+
+    Checkpoint first;
+    first.out = first.in = 0;
+    first.bits = -1;
+    _checkpoints.push_back(first);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    // 32 + MAX_WBITS: expect a gzip (or zlib) header
+    if(inflateInit2(&strm, 32 + MAX_WBITS) != Z_OK) throwGzipError(gzFName, "zlib initialization failed");
+
+    std::vector<unsigned char> input(GZIP_INPUT_CHUNK), window(GZIP_WINDOW_SIZE, 0);
+    uint64_t totIn = 0, totOut = 0, last = 0, memberStart = 0;
+    const char *error = NULL;
+
+    for(;;) {
+        if(strm.avail_in == 0) {
+            try {
+                strm.avail_in = file->readAt(totIn, (char *)input.data(), input.size());
+            } catch (sfmf::Error &e) {
+                inflateEnd(&strm);
+                throw;
+            }
+            strm.next_in = input.data();
+            if(strm.avail_in == 0) {
+                // Input ended in the middle of a member
+                if(totIn != memberStart) error = "unexpected end of file";
+                break;
+            }
+        }
+
+        // There is more input after the end of a member, the next member
+        // can be decompressed on its own
+        if(totIn == memberStart && totIn > 0 && totOut - last > spacing) {
+            Checkpoint cp;
+            cp.out = totOut;
+            cp.in = totIn;
+            cp.bits = -1;
+            _checkpoints.push_back(cp);
+            last = totOut;
+        }
+
+        // Output goes to the circular window, so the last 32 KB are
+        // available when a checkpoint is made
+        if(strm.avail_out == 0) {
+            strm.next_out = window.data();
+            strm.avail_out = window.size();
+        }
+        unsigned char *outBegin = strm.next_out;
+
+        totIn += strm.avail_in;
+        totOut += strm.avail_out;
+        int ret = inflate(&strm, Z_BLOCK);
+        totIn -= strm.avail_in;
+        totOut -= strm.avail_out;
+
+        if(content) content->insert(content->end(), outBegin, strm.next_out);
+
+        if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+            error = strm.msg ? strm.msg : "corrupted data";
+            break;
+        }
+
+        if(ret == Z_STREAM_END) {
+            // Another member might follow
+            inflateReset(&strm);
+            memberStart = totIn;
+            continue;
+        }
+
+        // At the end of a deflate block that is not the last one
+        bool blockEnd = (strm.data_type & 128) && !(strm.data_type & 64);
+        if(blockEnd && totOut - last > spacing) {
+            Checkpoint cp;
+            cp.out = totOut;
+            cp.in = totIn;
+            cp.bits = strm.data_type & 7;
+
+            size_t pos = window.size() - strm.avail_out;
+            cp.window.reserve(window.size());
+            cp.window.insert(cp.window.end(), window.begin() + pos, window.end());
+            cp.window.insert(cp.window.end(), window.begin(), window.begin() + pos);
+
+            _checkpoints.push_back(cp);
+            last = totOut;
+        }
+    }
+
+    inflateEnd(&strm);
+    if(error) throwGzipError(gzFName, error);
+
+    _size = totOut;
+    _compressedSize = totIn;
+}
+
+size_t
+GzipIndex::read(InputFile::Ptr file, uint64_t offset, char *buffer, size_t size) const
+{
+    const char *gzFName = file->getFileName().c_str();
+    if(offset >= _size) return 0;
+    size = std::min<uint64_t>(size, _size - offset);
+
+    // Last checkpoint at or before offset
+    size_t idx = _checkpoints.size() - 1;
+    while(_checkpoints[idx].out > offset) idx--;
+    const Checkpoint &cp = _checkpoints[idx];
+
+    // Compressed input is read with readAt, so several threads can
+    // share the file
+    uint64_t inPos = cp.in;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    bool raw = cp.bits >= 0;
+    bool ok = inflateInit2(&strm, raw ? -MAX_WBITS : 32 + MAX_WBITS) == Z_OK;
+    if(ok && cp.bits > 0) {
+        unsigned char c;
+        try {
+            ok = file->readAt(cp.in - 1, (char *)&c, 1) == 1;
+        } catch (sfmf::Error &e) {
+            inflateEnd(&strm);
+            throw;
+        }
+        ok = ok && inflatePrime(&strm, cp.bits, c >> (8 - cp.bits)) == Z_OK;
+    }
+    if(ok && raw) ok = inflateSetDictionary(&strm, cp.window.data(), cp.window.size()) == Z_OK;
+    if(!ok) {
+        inflateEnd(&strm);
+        throwGzipError(gzFName, "could not restart from checkpoint");
+    }
+
+    std::vector<unsigned char> input(GZIP_INPUT_CHUNK), discard(GZIP_WINDOW_SIZE);
+    uint64_t skip = offset - cp.out;
+    size_t nRead = 0;
+    int trailer = 0; // Bytes of a gzip trailer still to be skipped
+    const char *error = NULL;
+
+    while(nRead < size) {
+        if(strm.avail_in == 0) {
+            try {
+                strm.avail_in = file->readAt(inPos, (char *)input.data(), input.size());
+            } catch (sfmf::Error &e) {
+                inflateEnd(&strm);
+                throw;
+            }
+            inPos += strm.avail_in;
+            strm.next_in = input.data();
+            if(strm.avail_in == 0) {
+                error = "unexpected end of file";
+                break;
+            }
+        }
+
+        if(trailer) {
+            int n = std::min<int>(trailer, strm.avail_in);
+            strm.next_in += n;
+            strm.avail_in -= n;
+            trailer -= n;
+            continue;
+        }
+
+        // Data before offset is decompressed and thrown away
+        if(skip) {
+            strm.next_out = discard.data();
+            strm.avail_out = std::min<uint64_t>(skip, discard.size());
+        } else {
+            strm.next_out = (Bytef *)buffer + nRead;
+            strm.avail_out = std::min<size_t>(size - nRead, 1 << 30);
+        }
+        uInt avail = strm.avail_out;
+
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+            error = strm.msg ? strm.msg : "corrupted data";
+            break;
+        }
+
+        if(skip) skip -= avail - strm.avail_out;
+        else nRead += avail - strm.avail_out;
+
+        if(ret == Z_STREAM_END) {
+            // Raw inflate stops before the trailer (crc and size) of the member
+            if(raw) trailer = 8;
+            raw = false;
+            inflateReset2(&strm, 32 + MAX_WBITS);
+        }
+    }
+
+    inflateEnd(&strm);
+    if(error) throwGzipError(gzFName, error);
+
+    return nRead;
+}
+
+void
+GzipIndex::readAll(InputFile::Ptr file, std::vector<char> &buffer, int nThreads) const
+{
+    buffer.resize(_size);
+
+    if(nThreads <= 0) {
+        nThreads = 1;
+#ifdef _OPENMP
+        nThreads = omp_get_max_threads();
+#endif
+    }
+
+    // Each checkpoint starts an independent piece of work
+    const int nPieces = _checkpoints.size();
+    int nErrors = 0;
+    std::string error;
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads) reduction(+:nErrors)
+    for(int i = 0; i < nPieces; i++) {
+        uint64_t begin = _checkpoints[i].out;
+        uint64_t end = (i + 1 < nPieces) ? _checkpoints[i + 1].out : _size;
+        try {
+            if(read(file, begin, buffer.data() + begin, end - begin) != end - begin) nErrors++;
+        } catch (sfmf::Error &e) {
+            #pragma omp critical
+            error = e.what();
+            nErrors++;
+        }
+    }
+
+    if(nErrors) {
+        if(error.empty()) throwGzipError(file->getFileName().c_str(), "file is shorter than its index");
+        throw sfmf::Error(error);
+    }
+}
+
+// Index files are little endian
+static
+void
+appendLE(std::vector<unsigned char> &out, uint64_t v, int nBytes)
+{
+    for(int i = 0; i < nBytes; i++) out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static
+uint64_t
+readLE(const unsigned char *&p, int nBytes)
+{
+    uint64_t v = 0;
+    for(int i = 0; i < nBytes; i++) v |= uint64_t(*p++) << (8 * i);
+    return v;
+}
+
+void
+GzipIndex::writeFile(const char *indexFName) const
+{
+    std::vector<unsigned char> data(GZIP_INDEX_MAGIC, GZIP_INDEX_MAGIC + sizeof(GZIP_INDEX_MAGIC));
+    appendLE(data, GZIP_INDEX_VERSION, 4);
+    appendLE(data, _size, 8);
+    appendLE(data, _compressedSize, 8);
+    appendLE(data, _checkpoints.size(), 8);
+    for(std::vector<Checkpoint>::const_iterator cp = _checkpoints.begin(); cp != _checkpoints.end(); cp++) {
+        appendLE(data, cp->out, 8);
+        appendLE(data, cp->in, 8);
+        appendLE(data, uint32_t(cp->bits), 4);
+        appendLE(data, cp->window.size(), 4);
+        data.insert(data.end(), cp->window.begin(), cp->window.end());
+    }
+
+    FILE *f = fopen(indexFName, "wb");
+    if(f == NULL || fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0) {
+        std::stringstream errMsg;
+        errMsg << "Could not write gzip index " << indexFName;
+        throw sfmf::Error(errMsg.str());
+    }
+}
+
+void
+GzipIndex::readFile(const char *indexFName)
+{
+    std::vector<char> data;
+    readFileIntoBuffer(indexFName, data);
+
+    const unsigned char *p = (const unsigned char *)data.data(), *end = p + data.size();
+    const size_t headerSize = sizeof(GZIP_INDEX_MAGIC) + 4 + 3 * 8;
+    if(data.size() < headerSize || memcmp(p, GZIP_INDEX_MAGIC, sizeof(GZIP_INDEX_MAGIC)) != 0) {
+        std::stringstream errMsg;
+        errMsg << "Not a gzip index: " << indexFName;
+        throw sfmf::Error(errMsg.str());
+    }
+    p += sizeof(GZIP_INDEX_MAGIC);
+
+    if(readLE(p, 4) != GZIP_INDEX_VERSION) {
+        std::stringstream errMsg;
+        errMsg << "Unsupported gzip index version in " << indexFName;
+        throw sfmf::Error(errMsg.str());
+    }
+    _size = readLE(p, 8);
+    _compressedSize = readLE(p, 8);
+    uint64_t nCheckpoints = readLE(p, 8);
+
+    _checkpoints.clear();
+    for(uint64_t i = 0; i < nCheckpoints; i++) {
+        Checkpoint cp;
+        if(end - p < 24) break;
+        cp.out = readLE(p, 8);
+        cp.in = readLE(p, 8);
+        cp.bits = int32_t(readLE(p, 4));
+        uint32_t windowSize = readLE(p, 4);
+        if(uint64_t(end - p) < windowSize) break;
+        cp.window.assign(p, p + windowSize);
+        p += windowSize;
+        _checkpoints.push_back(cp);
+    }
+
+    if(_checkpoints.size() != nCheckpoints || _checkpoints.empty() || _checkpoints[0].out != 0) {
+        _checkpoints.clear();
+        std::stringstream errMsg;
+        errMsg << "Truncated gzip index " << indexFName;
+        throw sfmf::Error(errMsg.str());
+    }
+}
+
+bool
+GzipIndex::isUpToDate(const char *gzFName, const char *indexFName) const
+{
+    struct stat gzStat, indexStat;
+    if(stat(gzFName, &gzStat) != 0 || stat(indexFName, &indexStat) != 0) return false;
+    return uint64_t(gzStat.st_size) == _compressedSize && gzStat.st_mtime <= indexStat.st_mtime;
+}
+
+std::string
+GzipIndex::indexFileName(const char *gzFName)
+{
+    return std::string(gzFName) + ".gzi";
+}
+
+SFMFILES_NAMESPACE_END
@@ -26,15 +26,197 @@
 
 SFMFILES_NAMESPACE_BEGIN
 
-// This class can read a standard text file or a GZip compressed
-// one. It checks the first few bytes of the file to determine
-// if the file was compressed.
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD, // Needs SFMF_HAVE_ZSTD
+    COMPRESSION_LZ4   // Needs SFMF_HAVE_LZ4 (frame format)
+};
+
+// How InputFile gets data from the disk
+enum IOBackend {
+    IO_BACKEND_DEFAULT, // SFMF_IO_BACKEND environment variable (mmap, pread or stream), pread if unset
+    IO_BACKEND_MMAP,    // Whole file mapped in memory
+    IO_BACKEND_PREAD,   // pread() in blocks of InputFile::PREAD_BLOCK_SIZE bytes
+    IO_BACKEND_STREAM   // Buffered stdio
+};
+
+// Read only file shared by all the readers of this module. The file is
+// opened once and the kernel is told it will be read sequentially
+// (posix_fadvise), the backend decides how data gets to memory. Large
+// reads matter most on network file systems where every request is a
+// round trip.
+class InputFile
+{
+public:
+    typedef boost::shared_ptr<InputFile> Ptr;
+
+    static const size_t PREAD_BLOCK_SIZE = 1 << 22;
+    static const size_t STREAM_BUFFER_SIZE = 1 << 20;
+
+    /// Throws sfmf::Error if the file can not be opened
+    static Ptr open(const char *filename, IOBackend backend = IO_BACKEND_DEFAULT);
+
+    /// Backend selected by the SFMF_IO_BACKEND environment variable
+    static IOBackend defaultBackend();
+
+    /// Second sequential reader over an open file, starting at offset.
+    /// It reads with file->readAt(), so cursors on different parts of
+    /// the same file do not disturb each other.
+    static Ptr cursor(Ptr file, uint64_t offset = 0);
+
+    virtual ~InputFile() {}
+
+    /// Sequential read, @returns number of bytes read, 0 at the end of the file
+    virtual size_t read(char *buffer, size_t size) = 0;
+
+    /// Reads at offset without moving the sequential read position
+    virtual size_t readAt(uint64_t offset, char *buffer, size_t size) = 0;
+
+    /// Content of the file if it is mapped in memory, NULL otherwise
+    virtual const char *data() const { return NULL; }
+
+    uint64_t getSize() const { return _size; }
+    const std::string &getFileName() const { return _fname; }
+
+protected:
+    std::string _fname;
+    int _fd;
+    uint64_t _size;
+
+    InputFile(const char *filename, int fd, uint64_t size): _fname(filename), _fd(fd), _size(size) {}
+
+    /// Error while reading, throws sfmf::Error
+    void _error() const;
+};
+
+/// Looks at the magic number at the beginning of the file
+Compression detectCompression(const char *filename);
+Compression detectCompression(InputFile &file);
+
+/// Compression selected by the file extension (.gz, .zst or .lz4)
+Compression compressionFromFileName(const char *filename);
+
+// This class can read a standard text file or a GZip, zstd or lz4
+// compressed one. It checks the first few bytes of the file to
+// determine if the file was compressed.
+//
+// With readAhead set, compressed files are decompressed on a separate
+// thread into a ring of READ_AHEAD_N_BUFFERS buffers of
+// READ_AHEAD_BUFFER_SIZE bytes, so decompression overlaps with whatever
+// the caller does with the data.
 class CompressedFileReader : public boost::iostreams::filtering_istream
 {
 public:
-    CompressedFileReader(const char *filename, bool throwException = true);
+    static const size_t READ_AHEAD_BUFFER_SIZE = 1 << 22;
+    static const int READ_AHEAD_N_BUFFERS = 4;
+
+    CompressedFileReader(const char *filename, bool throwException = true, bool readAhead = true,
+                         IOBackend backend = IO_BACKEND_DEFAULT);
+
+    /// Reads an already opened file from its current position
+    CompressedFileReader(InputFile::Ptr file, bool readAhead = true);
+
+private:
+    void _open(InputFile::Ptr file, bool readAhead);
+};
+
+// Output counterpart of CompressedFileReader. Files whose name ends in
+// .gz (.zst, .lz4) are written as a sequence of independent gzip members
+// (zstd or lz4 frames), each one holding blockSize bytes of input,
+// compressed nThreads blocks at a time (same idea as pigz).
+// Concatenated members are a valid compressed file and read back with
+// CompressedFileReader or the command line tools. Other files are
+// written as is.
+class CompressedFileWriter : public std::ostream
+{
+public:
+    /// @param nThreads 0 uses all available cores
+    /// @param level compression level, -1 for the default of the format
+    CompressedFileWriter(const char *filename, int nThreads = 0, int level = -1, size_t blockSize = 1 << 20);
+    ~CompressedFileWriter();
+
+    /// Flushes pending data and closes the file, throws on failure
+    void close();
+
+    /// @returns true if filename has an extension that selects compression
+    static bool isCompressedFileName(const char *filename);
+
+private:
+    boost::shared_ptr<std::streambuf> _buffer;
+    std::string _fname;
+    bool _closed;
 };
 
+// Random access into gzip files (same idea as zran.c in the zlib
+// examples). While the file is decompressed once, the state of the
+// decompressor is saved every spacing bytes of output: position in the
+// compressed file, unused bits of the last byte read and the last 32 KB
+// of output. Decompression can then be restarted from any checkpoint,
+// so reads can start anywhere and different parts of the file can be
+// decompressed by different threads. Files made of several gzip members
+// are supported.
+//
+// The index is usually kept next to the file, see indexFileName().
+class GzipIndex
+{
+public:
+    typedef boost::shared_ptr<GzipIndex> Ptr;
+
+    static const uint64_t DEFAULT_SPACING = 1 << 22;
+
+    GzipIndex(): _size(0), _compressedSize(0) {}
+
+    /// Decompresses the whole file recording checkpoints, the output is
+    /// stored in content if it is not NULL.
+    void build(InputFile::Ptr gzFile, uint64_t spacing = DEFAULT_SPACING, std::vector<char> *content = NULL);
+
+    void readFile(const char *indexFName);
+    void writeFile(const char *indexFName) const;
+
+    /// @returns true if the index was built for gzFName as it is now
+    bool isUpToDate(const char *gzFName, const char *indexFName) const;
+
+    uint64_t getUncompressedSize() const { return _size; }
+    size_t getNCheckpoints() const { return _checkpoints.size(); }
+    /// Uncompressed offset at which checkpoint idx starts
+    uint64_t getCheckpointOffset(size_t idx) const { return _checkpoints[idx].out; }
+
+    /// Decompresses up to size bytes starting at uncompressed offset
+    /// @returns number of bytes read (less than size only at the end of the file)
+    /// The compressed file is only accessed with readAt(), the same file
+    /// can be shared by several threads.
+    size_t read(InputFile::Ptr gzFile, uint64_t offset, char *buffer, size_t size) const;
+
+    /// Decompresses the whole file into buffer using nThreads threads (0 for all cores)
+    void readAll(InputFile::Ptr gzFile, std::vector<char> &buffer, int nThreads = 0) const;
+
+    /// Name of the sidecar index of a gzip file
+    static std::string indexFileName(const char *gzFName);
+
+private:
+    class Checkpoint
+    {
+    public:
+        uint64_t out; // Uncompressed offset
+        uint64_t in;  // Compressed offset of the first full byte
+        int bits;     // Bits of the previous byte still to be used, -1 if a gzip member starts here
+        std::vector<unsigned char> window; // Last 32 KB of output (empty at member starts)
+    };
+
+    std::vector<Checkpoint> _checkpoints;
+    uint64_t _size, _compressedSize;
+};
+
+/// Loads the whole content of a file into memory, decompressing it
+/// if necessary (same detection rules as CompressedFileReader).
+///
+/// If useGzipIndex is set gzip files are decompressed in parallel using
+/// their sidecar GzipIndex. If there is no index (or it is older than the
+/// file) it is built while the file is read and saved for the next time.
+void readFileIntoBuffer(const char *filename, std::vector<char> &buffer, bool useGzipIndex = false,
+                        IOBackend backend = IO_BACKEND_DEFAULT);
+
 SFMFILES_NAMESPACE_END
 
 #endif // __SFMF_IO_HPP__
\ No newline at end of file
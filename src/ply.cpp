@@ -1,4 +1,5 @@
 #include "ply.hpp"
+#include "io.hpp"
 
 SFMFILES_NAMESPACE_BEGIN
 
@@ -86,8 +87,8 @@ Ply::addComment(const std::string &comment)
 void
 Ply::writeToFile(const std::string &fname)
 {
-    std::ofstream plyF(fname.c_str());
-    assert(plyF.good());
+    // Compressed if the name ends in .gz
+    CompressedFileWriter plyF(fname.c_str());
 
     plyF << "ply\n"
          << "format ascii 1.0\n";
@@ -162,6 +163,8 @@ Ply::writeToFile(const std::string &fname)
                  << (int)edge->color.r << " " << (int)edge->color.g << " " << (int)edge->color.b << "\n";
         }
     }
+
+    plyF.close();
 }
 
 SFMFILES_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,407 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "projection.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled for that target only and picked at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SFMF_HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+BUNDLER_NAMESPACE_BEGIN
+
+ProjectionParams::ProjectionParams(const Camera &cam, bool applyRadialDistortion, int imWidth, int imHeight)
+{
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 3; j++) rotation[3 * i + j] = cam.rotation(i, j);
+        translation[i] = cam.translation[i];
+    }
+    focalLength = cam.focalLength;
+    k1 = cam.k1;
+    k2 = cam.k2;
+    halfWidth = imWidth / 2.0;
+    halfHeight = imHeight / 2.0;
+    width = imWidth;
+    height = imHeight;
+    checkBounds = imWidth > 0 && imHeight > 0;
+    distort = applyRadialDistortion && (k1 != 0.0 || k2 != 0.0);
+}
+
+static
+size_t
+projectPointsScalar(const ProjectionParams &p, const double *w, size_t n, double *im, uint8_t *visible)
+{
+    size_t nVisible = 0;
+    for(size_t i = 0; i < n; i++) {
+        visible[i] = projectPoint(p, w + 3 * i, im + 2 * i);
+        nVisible += visible[i];
+    }
+    return nVisible;
+}
+
+#if defined(__SSE2__)
+// Two points per iteration, the six coordinates are loaded as three
+// pairs and shuffled into x, y and z
+static
+size_t
+projectPointsSSE2(const ProjectionParams &p, const double *w, size_t n, double *im, uint8_t *visible)
+{
+    __m128d R[9], t[3];
+    for(int i = 0; i < 9; i++) R[i] = _mm_set1_pd(p.rotation[i]);
+    for(int i = 0; i < 3; i++) t[i] = _mm_set1_pd(p.translation[i]);
+    const __m128d f = _mm_set1_pd(p.focalLength), k1 = _mm_set1_pd(p.k1), k2 = _mm_set1_pd(p.k2);
+    const __m128d hw = _mm_set1_pd(p.halfWidth), hh = _mm_set1_pd(p.halfHeight);
+    const __m128d width = _mm_set1_pd(p.width), height = _mm_set1_pd(p.height);
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0), signBit = _mm_set1_pd(-0.0);
+    const __m128d all = _mm_cmpeq_pd(zero, zero);
+
+    size_t nVisible = 0, i = 0;
+    for(; i + 2 <= n; i += 2) {
+        const double *src = w + 3 * i;
+        const __m128d a = _mm_loadu_pd(src), b = _mm_loadu_pd(src + 2), c = _mm_loadu_pd(src + 4);
+        const __m128d x = _mm_shuffle_pd(a, b, 2), y = _mm_shuffle_pd(a, c, 1), z = _mm_shuffle_pd(b, c, 2);
+
+        const __m128d cx = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(R[0], x), _mm_mul_pd(R[1], y)), _mm_mul_pd(R[2], z)), t[0]);
+        const __m128d cy = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(R[3], x), _mm_mul_pd(R[4], y)), _mm_mul_pd(R[5], z)), t[1]);
+        const __m128d cz = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(R[6], x), _mm_mul_pd(R[7], y)), _mm_mul_pd(R[8], z)), t[2]);
+
+        __m128d mask = _mm_cmplt_pd(cz, zero);
+        const __m128d invZ = _mm_div_pd(one, _mm_xor_pd(cz, signBit));
+        const __m128d nx = _mm_mul_pd(cx, invZ), ny = _mm_mul_pd(cy, invZ);
+        __m128d ix = _mm_add_pd(hw, _mm_mul_pd(nx, f));
+        __m128d iy = _mm_add_pd(hh, _mm_mul_pd(ny, f));
+
+        __m128d inside = all;
+        if(p.checkBounds) {
+            inside = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(ix, zero), _mm_cmplt_pd(ix, width)),
+                                _mm_and_pd(_mm_cmpge_pd(iy, zero), _mm_cmplt_pd(iy, height)));
+        }
+        if(p.distort) {
+            const __m128d n2 = _mm_add_pd(_mm_mul_pd(nx, nx), _mm_mul_pd(ny, ny));
+            const __m128d r = _mm_add_pd(_mm_mul_pd(k1, n2), _mm_mul_pd(k2, _mm_mul_pd(n2, n2)));
+            ix = _mm_add_pd(ix, _mm_mul_pd(_mm_mul_pd(r, nx), f));
+            iy = _mm_add_pd(iy, _mm_mul_pd(_mm_mul_pd(r, ny), f));
+            if(p.checkBounds) {
+                inside = _mm_and_pd(inside, _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(ix, zero), _mm_cmplt_pd(ix, width)),
+                                                       _mm_and_pd(_mm_cmpge_pd(iy, zero), _mm_cmplt_pd(iy, height))));
+            }
+        }
+        mask = _mm_and_pd(mask, inside);
+
+        _mm_storeu_pd(im + 2 * i, _mm_unpacklo_pd(ix, iy));
+        _mm_storeu_pd(im + 2 * i + 2, _mm_unpackhi_pd(ix, iy));
+
+        const int bits = _mm_movemask_pd(mask);
+        visible[i] = bits & 1;
+        visible[i + 1] = (bits >> 1) & 1;
+        nVisible += visible[i] + visible[i + 1];
+    }
+
+    return nVisible + projectPointsScalar(p, w + 3 * i, n - i, im + 2 * i, visible + i);
+}
+#endif
+
+#ifdef SFMF_HAVE_AVX2_KERNELS
+// Four points per iteration, loaded as two groups of two (one per 128
+// bit lane) and shuffled like in the SSE2 version
+__attribute__((target("avx2,fma")))
+static
+size_t
+projectPointsAVX2(const ProjectionParams &p, const double *w, size_t n, double *im, uint8_t *visible)
+{
+    __m256d R[9], t[3];
+    for(int i = 0; i < 9; i++) R[i] = _mm256_set1_pd(p.rotation[i]);
+    for(int i = 0; i < 3; i++) t[i] = _mm256_set1_pd(p.translation[i]);
+    const __m256d f = _mm256_set1_pd(p.focalLength), k1 = _mm256_set1_pd(p.k1), k2 = _mm256_set1_pd(p.k2);
+    const __m256d hw = _mm256_set1_pd(p.halfWidth), hh = _mm256_set1_pd(p.halfHeight);
+    const __m256d width = _mm256_set1_pd(p.width), height = _mm256_set1_pd(p.height);
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0), signBit = _mm256_set1_pd(-0.0);
+
+    size_t nVisible = 0, i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const double *src = w + 3 * i;
+        const __m256d a = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(src)), _mm_loadu_pd(src + 6), 1);
+        const __m256d b = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(src + 2)), _mm_loadu_pd(src + 8), 1);
+        const __m256d c = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(src + 4)), _mm_loadu_pd(src + 10), 1);
+        const __m256d x = _mm256_shuffle_pd(a, b, 0xa), y = _mm256_shuffle_pd(a, c, 0x5), z = _mm256_shuffle_pd(b, c, 0xa);
+
+        const __m256d cx = _mm256_add_pd(_mm256_fmadd_pd(R[2], z, _mm256_fmadd_pd(R[1], y, _mm256_mul_pd(R[0], x))), t[0]);
+        const __m256d cy = _mm256_add_pd(_mm256_fmadd_pd(R[5], z, _mm256_fmadd_pd(R[4], y, _mm256_mul_pd(R[3], x))), t[1]);
+        const __m256d cz = _mm256_add_pd(_mm256_fmadd_pd(R[8], z, _mm256_fmadd_pd(R[7], y, _mm256_mul_pd(R[6], x))), t[2]);
+
+        __m256d mask = _mm256_cmp_pd(cz, zero, _CMP_LT_OQ);
+        const __m256d invZ = _mm256_div_pd(one, _mm256_xor_pd(cz, signBit));
+        const __m256d nx = _mm256_mul_pd(cx, invZ), ny = _mm256_mul_pd(cy, invZ);
+        __m256d ix = _mm256_fmadd_pd(nx, f, hw);
+        __m256d iy = _mm256_fmadd_pd(ny, f, hh);
+
+        if(p.checkBounds) {
+            mask = _mm256_and_pd(mask, _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(ix, zero, _CMP_GE_OQ), _mm256_cmp_pd(ix, width, _CMP_LT_OQ)),
+                                                     _mm256_and_pd(_mm256_cmp_pd(iy, zero, _CMP_GE_OQ), _mm256_cmp_pd(iy, height, _CMP_LT_OQ))));
+        }
+        if(p.distort) {
+            const __m256d n2 = _mm256_fmadd_pd(ny, ny, _mm256_mul_pd(nx, nx));
+            const __m256d r = _mm256_fmadd_pd(k2, _mm256_mul_pd(n2, n2), _mm256_mul_pd(k1, n2));
+            ix = _mm256_fmadd_pd(_mm256_mul_pd(r, nx), f, ix);
+            iy = _mm256_fmadd_pd(_mm256_mul_pd(r, ny), f, iy);
+            if(p.checkBounds) {
+                mask = _mm256_and_pd(mask, _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(ix, zero, _CMP_GE_OQ), _mm256_cmp_pd(ix, width, _CMP_LT_OQ)),
+                                                         _mm256_and_pd(_mm256_cmp_pd(iy, zero, _CMP_GE_OQ), _mm256_cmp_pd(iy, height, _CMP_LT_OQ))));
+            }
+        }
+
+        // (x0 y0 x2 y2) and (x1 y1 x3 y3) back to point order
+        const __m256d lo = _mm256_unpacklo_pd(ix, iy), hi = _mm256_unpackhi_pd(ix, iy);
+        _mm256_storeu_pd(im + 2 * i, _mm256_permute2f128_pd(lo, hi, 0x20));
+        _mm256_storeu_pd(im + 2 * i + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+
+        const int bits = _mm256_movemask_pd(mask);
+        for(int k = 0; k < 4; k++) visible[i + k] = (bits >> k) & 1;
+        nVisible += __builtin_popcount(bits);
+    }
+
+    return nVisible + projectPointsScalar(p, w + 3 * i, n - i, im + 2 * i, visible + i);
+}
+#endif
+
+// Undistortion solves for the scale s of the distorted point instead of
+// the radius, s (1 + k1 s^2 rd2 + k2 s^4 rd2^2) = 1, so the center of the
+// image needs no special case. The first guess inverts the distortion
+// at the distorted radius.
+double
+undistortionScale(double k1, double k2, double rd2)
+{
+    double s = 1.0 / (1.0 + k1 * rd2 + k2 * (rd2 * rd2));
+    for(int it = 0; it < UNDISTORT_N_ITERATIONS; it++) {
+        const double q = s * s * rd2;
+        const double g = s * (1.0 + k1 * q + k2 * (q * q)) - 1.0;
+        const double dg = 1.0 + 3.0 * k1 * q + 5.0 * k2 * (q * q);
+        s -= g / dg;
+    }
+    return s;
+}
+
+static
+inline
+void
+undistortPoint(const ProjectionParams &p, const UndistortionTable *table, const double *im, double *c)
+{
+    const double dx = (im[0] - p.halfWidth) / p.focalLength;
+    const double dy = (im[1] - p.halfHeight) / p.focalLength;
+    double s = 1.0;
+    if(p.distort) {
+        const double rd2 = dx * dx + dy * dy;
+        if(table == NULL || !table->lookup(rd2, s)) s = undistortionScale(p.k1, p.k2, rd2);
+    }
+    c[0] = dx * s;
+    c[1] = dy * s;
+    c[2] = -1.0;
+}
+
+static
+void
+undistortPointsScalar(const ProjectionParams &p, const UndistortionTable *table, const double *im, size_t n, double *c)
+{
+    for(size_t i = 0; i < n; i++) undistortPoint(p, table, im + 2 * i, c + 3 * i);
+}
+
+#if defined(__SSE2__)
+static
+void
+undistortPointsSSE2(const ProjectionParams &p, const double *im, size_t n, double *c)
+{
+    const __m128d invF = _mm_set1_pd(1.0 / p.focalLength), k1 = _mm_set1_pd(p.k1), k2 = _mm_set1_pd(p.k2);
+    const __m128d hw = _mm_set1_pd(p.halfWidth), hh = _mm_set1_pd(p.halfHeight);
+    const __m128d one = _mm_set1_pd(1.0), three = _mm_set1_pd(3.0), five = _mm_set1_pd(5.0);
+
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        const __m128d a = _mm_loadu_pd(im + 2 * i), b = _mm_loadu_pd(im + 2 * i + 2);
+        const __m128d dx = _mm_mul_pd(_mm_sub_pd(_mm_unpacklo_pd(a, b), hw), invF);
+        const __m128d dy = _mm_mul_pd(_mm_sub_pd(_mm_unpackhi_pd(a, b), hh), invF);
+
+        const __m128d rd2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        __m128d s = _mm_div_pd(one, _mm_add_pd(_mm_add_pd(one, _mm_mul_pd(k1, rd2)), _mm_mul_pd(k2, _mm_mul_pd(rd2, rd2))));
+        for(int it = 0; it < UNDISTORT_N_ITERATIONS; it++) {
+            const __m128d q = _mm_mul_pd(_mm_mul_pd(s, s), rd2), q2 = _mm_mul_pd(q, q);
+            const __m128d g = _mm_sub_pd(_mm_mul_pd(s, _mm_add_pd(_mm_add_pd(one, _mm_mul_pd(k1, q)), _mm_mul_pd(k2, q2))), one);
+            const __m128d dg = _mm_add_pd(_mm_add_pd(one, _mm_mul_pd(_mm_mul_pd(three, k1), q)), _mm_mul_pd(_mm_mul_pd(five, k2), q2));
+            s = _mm_sub_pd(s, _mm_div_pd(g, dg));
+        }
+
+        const __m128d cx = _mm_mul_pd(dx, s), cy = _mm_mul_pd(dy, s);
+        double *dst = c + 3 * i;
+        _mm_storeu_pd(dst, _mm_unpacklo_pd(cx, cy));
+        _mm_storeu_pd(dst + 3, _mm_unpackhi_pd(cx, cy));
+        dst[2] = dst[5] = -1.0;
+    }
+
+    undistortPointsScalar(p, NULL, im + 2 * i, n - i, c + 3 * i);
+}
+#endif
+
+#ifdef SFMF_HAVE_AVX2_KERNELS
+// Points come in as (x0 y0 x1 y1) (x2 y2 x3 y3), lanes hold points
+// 0 2 1 3 until they are stored back
+__attribute__((target("avx2,fma")))
+static
+void
+undistortPointsAVX2(const ProjectionParams &p, const double *im, size_t n, double *c)
+{
+    const __m256d invF = _mm256_set1_pd(1.0 / p.focalLength), k1 = _mm256_set1_pd(p.k1), k2 = _mm256_set1_pd(p.k2);
+    const __m256d k1x3 = _mm256_set1_pd(3.0 * p.k1), k2x5 = _mm256_set1_pd(5.0 * p.k2);
+    const __m256d hw = _mm256_set1_pd(p.halfWidth), hh = _mm256_set1_pd(p.halfHeight);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const __m256d a = _mm256_loadu_pd(im + 2 * i), b = _mm256_loadu_pd(im + 2 * i + 4);
+        const __m256d dx = _mm256_mul_pd(_mm256_sub_pd(_mm256_unpacklo_pd(a, b), hw), invF);
+        const __m256d dy = _mm256_mul_pd(_mm256_sub_pd(_mm256_unpackhi_pd(a, b), hh), invF);
+
+        const __m256d rd2 = _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx));
+        __m256d s = _mm256_div_pd(one, _mm256_fmadd_pd(k2, _mm256_mul_pd(rd2, rd2), _mm256_fmadd_pd(k1, rd2, one)));
+        for(int it = 0; it < UNDISTORT_N_ITERATIONS; it++) {
+            const __m256d q = _mm256_mul_pd(_mm256_mul_pd(s, s), rd2), q2 = _mm256_mul_pd(q, q);
+            const __m256d g = _mm256_fmsub_pd(s, _mm256_fmadd_pd(k2, q2, _mm256_fmadd_pd(k1, q, one)), one);
+            const __m256d dg = _mm256_fmadd_pd(k2x5, q2, _mm256_fmadd_pd(k1x3, q, one));
+            s = _mm256_sub_pd(s, _mm256_div_pd(g, dg));
+        }
+
+        const __m256d cx = _mm256_mul_pd(dx, s), cy = _mm256_mul_pd(dy, s);
+        const __m256d lo = _mm256_unpacklo_pd(cx, cy), hi = _mm256_unpackhi_pd(cx, cy);
+        double *dst = c + 3 * i;
+        _mm_storeu_pd(dst, _mm256_castpd256_pd128(lo));
+        _mm_storeu_pd(dst + 3, _mm256_extractf128_pd(lo, 1));
+        _mm_storeu_pd(dst + 6, _mm256_castpd256_pd128(hi));
+        _mm_storeu_pd(dst + 9, _mm256_extractf128_pd(hi, 1));
+        dst[2] = dst[5] = dst[8] = dst[11] = -1.0;
+    }
+
+    undistortPointsScalar(p, NULL, im + 2 * i, n - i, c + 3 * i);
+}
+#endif
+
+void
+undistortPoints(const ProjectionParams &params, const double *im, size_t n, double *c,
+                const UndistortionTable *table, SimdLevel level)
+{
+    if(table != NULL && params.distort) {
+        if(table->k1 != params.k1 || table->k2 != params.k2) {
+            throw sfmf::Error("Undistortion table was built for different radial distortion parameters");
+        }
+        undistortPointsScalar(params, table, im, n, c);
+        return;
+    }
+
+    // Without distortion the kernels would only multiply by one
+    if(params.distort) {
+#ifdef SFMF_HAVE_AVX2_KERNELS
+        if(level >= SIMD_AVX2) return undistortPointsAVX2(params, im, n, c);
+#endif
+#if defined(__SSE2__)
+        if(level >= SIMD_SSE2) return undistortPointsSSE2(params, im, n, c);
+#endif
+    }
+    undistortPointsScalar(params, NULL, im, n, c);
+}
+
+UndistortionTable::UndistortionTable(const Camera &cam, int imWidth, int imHeight, int nSamples):
+    k1(cam.k1), k2(cam.k2)
+{
+    if(imWidth <= 0 || imHeight <= 0 || nSamples < 1 || cam.focalLength == 0) {
+        throw sfmf::Error("Undistortion table needs the image size, a focal length and at least one sample");
+    }
+
+    const double halfDiag2 = 0.25 * (double(imWidth) * imWidth + double(imHeight) * imHeight);
+    maxRadius2 = halfDiag2 / (cam.focalLength * cam.focalLength);
+    invStep = nSamples / maxRadius2;
+
+    // One more sample past the end so the corners themselves are covered
+    scales.resize(nSamples + 2);
+    for(int i = 0; i < nSamples + 2; i++) scales[i] = undistortionScale(k1, k2, i / invStep);
+}
+
+Frustum::Frustum(const ProjectionParams &p): _nPlanes(0)
+{
+    // Planes in camera coordinates (camera looks down -z), a point c is
+    // inside if n.c >= 0
+    double camPlanes[5][3] = {{0, 0, -1}};
+    int nPlanes = 1;
+    if(p.checkBounds && p.focalLength != 0) {
+        const double a = p.width / (2 * fabs(p.focalLength)), b = p.height / (2 * fabs(p.focalLength));
+        const double sides[4][3] = {{1, 0, -a}, {-1, 0, -a}, {0, 1, -b}, {0, -1, -b}};
+        for(int i = 0; i < 4; i++) std::copy(sides[i], sides[i] + 3, camPlanes[nPlanes++]);
+    }
+
+    // n.(R w + t) = (R^T n).w + n.t
+    const double *R = p.rotation, *t = p.translation;
+    for(int i = 0; i < nPlanes; i++) {
+        const double *n = camPlanes[i];
+        double *plane = _planes[_nPlanes++];
+        for(int j = 0; j < 3; j++) plane[j] = R[j] * n[0] + R[3 + j] * n[1] + R[6 + j] * n[2];
+        plane[3] = n[0] * t[0] + n[1] * t[1] + n[2] * t[2];
+    }
+}
+
+bool
+Frustum::boxOutside(const double *box) const
+{
+    const double *min = box, *max = box + 3;
+    for(int i = 0; i < _nPlanes; i++) {
+        const double *n = _planes[i];
+
+        // Corner of the box furthest along the normal
+        double d = n[3], scale = fabs(n[3]);
+        for(int j = 0; j < 3; j++) {
+            const double v = n[j] >= 0 ? max[j] : min[j];
+            d += n[j] * v;
+            scale += fabs(n[j] * v);
+        }
+
+        // Points right on a plane might still make it after rounding
+        if(d < -1e-9 * scale) return true;
+    }
+    return false;
+}
+
+size_t
+projectPoints(const ProjectionParams &params, const double *w, size_t n, double *im, uint8_t *visible, SimdLevel level)
+{
+#ifdef SFMF_HAVE_AVX2_KERNELS
+    if(level >= SIMD_AVX2) return projectPointsAVX2(params, w, n, im, visible);
+#endif
+#if defined(__SSE2__)
+    if(level >= SIMD_SSE2) return projectPointsSSE2(params, w, n, im, visible);
+#endif
+    return projectPointsScalar(params, w, n, im, visible);
+}
+
+BUNDLER_NAMESPACE_END
@@ -0,0 +1,119 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <SfMFiles/sfmfiles>
+#include "utils.hpp"
+
+#ifndef __SFMF_PROJECTION_HPP__
+#define __SFMF_PROJECTION_HPP__
+
+BUNDLER_NAMESPACE_BEGIN
+
+// Camera parameters as needed by the batch projection kernels
+class ProjectionParams
+{
+public:
+    double rotation[9]; // Row major
+    double translation[3];
+    double focalLength, k1, k2;
+    double halfWidth, halfHeight; // Image center
+    double width, height;
+    bool checkBounds;
+    bool distort;
+
+    ProjectionParams(const Camera &cam, bool applyRadialDistortion, int imWidth, int imHeight);
+};
+
+// Planes that bound what a camera can see: the half space in front of
+// it and, if the image size is known, the four planes through the
+// center of projection and the image borders. Used to skip whole groups
+// of points before projecting them.
+class Frustum
+{
+public:
+    Frustum(const ProjectionParams &params);
+
+    /// @returns true if no point inside the box (min x, y, z followed by
+    /// max x, y, z) can project inside the image
+    bool boxOutside(const double *box) const;
+
+private:
+    int _nPlanes;
+    double _planes[5][4]; // Normal (pointing inside) and offset, world coordinates
+};
+
+/// Projects one point, same operations as Camera::cam2im() in the same
+/// order (image coordinates in im)
+/// @returns true if the point is visible
+inline
+bool
+projectPoint(const ProjectionParams &p, const double *w, double *im)
+{
+    const double *R = p.rotation;
+    const double cx = R[0] * w[0] + R[1] * w[1] + R[2] * w[2] + p.translation[0];
+    const double cy = R[3] * w[0] + R[4] * w[1] + R[5] * w[2] + p.translation[1];
+    const double cz = R[6] * w[0] + R[7] * w[1] + R[8] * w[2] + p.translation[2];
+
+    const bool isInFrontOfCamera = cz < 0.0;
+    const double nx = cx / -cz, ny = cy / -cz;
+    double ix = p.halfWidth + nx * p.focalLength;
+    double iy = p.halfHeight + ny * p.focalLength;
+
+    bool isInsideImage = !p.checkBounds || (ix >= 0 && ix < p.width && iy >= 0 && iy < p.height);
+    if(p.distort) {
+        const double n2 = nx * nx + ny * ny;
+        const double r = p.k1 * n2 + p.k2 * (n2 * n2);
+        ix += r * nx * p.focalLength;
+        iy += r * ny * p.focalLength;
+        if(p.checkBounds && isInsideImage) isInsideImage = ix >= 0 && ix < p.width && iy >= 0 && iy < p.height;
+    }
+
+    im[0] = ix;
+    im[1] = iy;
+    return isInsideImage && isInFrontOfCamera;
+}
+
+/// Projects n points (x, y, z of each one after the other), see
+/// Camera::world2imBatch()
+/// @returns number of visible points
+size_t projectPoints(const ProjectionParams &params, const double *w, size_t n, double *im, uint8_t *visible,
+                     SimdLevel level = detectSimdLevel());
+
+/// Newton steps taken by undistortPoints(), enough for double
+/// precision wherever the distortion can be inverted
+static const int UNDISTORT_N_ITERATIONS = 8;
+
+/// Undistortion scale s of a point at squared distorted radius rd2
+/// (normalized coordinates), the undistorted point is s times the
+/// distorted one: s (1 + k1 s^2 rd2 + k2 s^4 rd2^2) = 1
+double undistortionScale(double k1, double k2, double rd2);
+
+/// Image to camera coordinates for n points (x, y of each one), c gets
+/// x, y, z of each point, see Camera::im2camBatch(). Points within the
+/// range of the table (if not NULL) are interpolated, the rest goes
+/// through Newton's method.
+void undistortPoints(const ProjectionParams &params, const double *im, size_t n, double *c,
+                     const UndistortionTable *table = NULL, SimdLevel level = detectSimdLevel());
+
+BUNDLER_NAMESPACE_END
+
+#endif // __SFMF_PROJECTION_HPP__
@@ -0,0 +1,185 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <SfMFiles/sfmfiles>
+
+#ifndef __SFMF_SCANNER_HPP__
+#define __SFMF_SCANNER_HPP__
+
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L && !defined(SFMF_HAVE_CHARCONV)
+#define SFMF_HAVE_CHARCONV
+#endif
+
+SFMFILES_NAMESPACE_BEGIN
+
+// Tokenizer for whitespace separated text that works directly on a
+// character buffer. Numbers are converted without going through a
+// stream (no locale, no sentry objects) and nothing is allocated per
+// token. Results are the same as the ones obtained with operator>>.
+//
+// If the buffer only holds part of the input (isFinal = false) a token
+// that touches the end of the buffer might be incomplete, in that case
+// the read fails and starved() returns true so the caller can refill
+// the buffer and try again.
+class TextScanner
+{
+public:
+    TextScanner(const char *begin, const char *end, bool isFinal = true):
+        _cur(begin), _end(end), _final(isFinal), _starved(false) {}
+
+    /// @returns true if the last read failed because the buffer ran out
+    bool starved() const { return _starved; }
+
+    const char *position() const { return _cur; }
+    void seek(const char *pos) { _cur = pos; }
+
+    /// @returns true if only whitespace is left in the buffer
+    bool atEnd()
+    {
+        _skipSpace();
+        return _cur == _end;
+    }
+
+    /// Consumes literal if the buffer starts with it (no whitespace is skipped)
+    bool match(const char *literal)
+    {
+        size_t len = strlen(literal);
+        if(size_t(_end - _cur) < len || memcmp(_cur, literal, len) != 0) return false;
+        _cur += len;
+        return true;
+    }
+
+    void skipLine()
+    {
+        const char *nl = (const char *)memchr(_cur, '\n', _end - _cur);
+        _cur = (nl == NULL) ? _end : nl + 1;
+    }
+
+    bool readInt(int &v)
+    {
+        long long aux;
+        if(!readInt64(aux) || aux != (long long)(int)aux) return false;
+        v = int(aux);
+        return true;
+    }
+
+    bool readInt64(long long &v)
+    {
+        _skipSpace();
+        if(!_final && !_tokenInBuffer()) return _starve();
+
+        const char *p = _cur;
+        bool neg = false;
+        if(p != _end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+        // Leading zeros are fine, values out of range fail like with operator>>
+        const char *digits = p;
+        const unsigned long long limit = (unsigned long long)LLONG_MAX + (neg ? 1 : 0);
+        unsigned long long acc = 0;
+        for(; p != _end && (unsigned)(*p - '0') < 10; p++) {
+            unsigned d = *p - '0';
+            if(acc > (limit - d) / 10) return false;
+            acc = acc * 10 + d;
+        }
+        if(p == digits) return false;
+
+        v = neg ? (long long)(0 - acc) : (long long)acc;
+        _cur = p;
+        return true;
+    }
+
+    bool readDouble(double &v) { return _readReal(v); }
+    bool readFloat(float &v) { return _readReal(v); }
+
+private:
+    const char *_cur, *_end;
+    bool _final, _starved;
+
+    bool _starve()
+    {
+        _starved = true;
+        return false;
+    }
+
+    static bool _isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f'; }
+
+    void _skipSpace()
+    {
+        while(_cur != _end && _isSpace(*_cur)) _cur++;
+    }
+
+    /// @returns true if the token at the current position is followed by whitespace
+    bool _tokenInBuffer() const
+    {
+        for(const char *p = _cur; p != _end; p++) {
+            if(_isSpace(*p)) return true;
+        }
+        return false;
+    }
+
+#ifndef SFMF_HAVE_CHARCONV
+    static void _strtoReal(const char *s, char **end, double &v) { v = strtod(s, end); }
+    static void _strtoReal(const char *s, char **end, float &v) { v = strtof(s, end); }
+#endif
+
+    template<typename T>
+    bool _readReal(T &v)
+    {
+        _skipSpace();
+        if(!_final && !_tokenInBuffer()) return _starve();
+
+        const char *p = _cur;
+        // operator>> accepts an explicit plus sign, from_chars does not
+        if(p != _end && *p == '+') p++;
+
+#ifdef SFMF_HAVE_CHARCONV
+        std::from_chars_result r = std::from_chars(p, _end, v);
+        if(r.ec != std::errc()) return false;
+        _cur = r.ptr;
+#else
+        // strtod needs a terminated string, tokens are short enough to be
+        // copied into a stack buffer.
+        char tok[64];
+        size_t len = 0;
+        while(p + len != _end && !_isSpace(p[len]) && len < sizeof(tok) - 1) len++;
+        memcpy(tok, p, len);
+        tok[len] = '\0';
+
+        char *tokEnd;
+        _strtoReal(tok, &tokEnd, v);
+        if(tokEnd == tok) return false;
+        _cur = p + (tokEnd - tok);
+#endif
+        return true;
+    }
+};
+
+SFMFILES_NAMESPACE_END
+
+#endif // __SFMF_SCANNER_HPP__
@@ -0,0 +1,200 @@
+// Copyright (C) 2011 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <SfMFiles/sfmfiles>
+
+#ifndef __SFMF_SPATIAL_HPP__
+#define __SFMF_SPATIAL_HPP__
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+SFMFILES_NAMESPACE_BEGIN
+
+// Bits per coordinate of the curve codes, three of them fit in 64 bits
+static const int SPATIAL_CODE_BITS = 21;
+
+/// Spreads the lowest 21 bits of v so there are two zeros between them
+inline
+uint64_t
+spreadBits3(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+/// Position along the Z-order curve of a cell (21 bit coordinates)
+inline
+uint64_t
+mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return (spreadBits3(x) << 2) | (spreadBits3(y) << 1) | spreadBits3(z);
+}
+
+/// Position along the Hilbert curve of a cell (21 bit coordinates). The
+/// coordinates are turned into the transposed Hilbert index and its bits
+/// interleaved (J. Skilling, "Programming the Hilbert curve", 2004).
+inline
+uint64_t
+hilbertCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    uint32_t X[3] = {x, y, z};
+    const uint32_t M = 1u << (SPATIAL_CODE_BITS - 1);
+
+    // Inverse undo
+    for(uint32_t Q = M; Q > 1; Q >>= 1) {
+        const uint32_t P = Q - 1;
+        for(int i = 0; i < 3; i++) {
+            if(X[i] & Q) {
+                X[0] ^= P;
+            } else {
+                uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    uint32_t t = 0;
+    for(uint32_t Q = M; Q > 1; Q >>= 1) {
+        if(X[2] & Q) t ^= Q - 1;
+    }
+    for(int i = 0; i < 3; i++) X[i] ^= t;
+
+    return mortonCode(X[0], X[1], X[2]);
+}
+
+class SpatialKey
+{
+public:
+    uint64_t code;
+    int64_t idx;
+
+    bool operator<(const SpatialKey &other) const
+    {
+        return code < other.code || (code == other.code && idx < other.idx);
+    }
+};
+
+/// Sorts keys with one std::sort per thread followed by rounds of
+/// pairwise merges, the result is the same as a single std::sort
+inline
+void
+parallelSort(std::vector<SpatialKey> &keys)
+{
+    int nThreads = 1;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    const size_t n = keys.size();
+    nThreads = std::max(1, std::min<int>(nThreads, n / 65536));
+
+    std::vector<size_t> bounds(nThreads + 1);
+    for(int t = 0; t <= nThreads; t++) bounds[t] = n * t / nThreads;
+
+#pragma omp parallel for num_threads(nThreads) schedule(static, 1)
+    for(int t = 0; t < nThreads; t++) std::sort(keys.begin() + bounds[t], keys.begin() + bounds[t + 1]);
+
+    for(int width = 1; width < nThreads; width *= 2) {
+#pragma omp parallel for schedule(dynamic, 1)
+        for(int t = 0; t < nThreads - width; t += 2 * width) {
+            const size_t begin = bounds[t], middle = bounds[t + width], end = bounds[std::min(t + 2 * width, nThreads)];
+            std::inplace_merge(keys.begin() + begin, keys.begin() + middle, keys.begin() + end);
+        }
+    }
+}
+
+/// Order of n points along a space filling curve through their bounding
+/// box (a cube, so cells have the same size along every axis). pos(i)
+/// returns something indexable with the x, y and z of point i. Points
+/// with non finite coordinates are put in the first cell. Points in the
+/// same cell keep their original order.
+/// @param order the old index of the point at each position of the curve
+template<typename PositionFn>
+void
+spatialOrder(int64_t n, PositionFn pos, SpaceFillingCurve curve, std::vector<int64_t> &order)
+{
+    double minX = std::numeric_limits<double>::max(), minY = minX, minZ = minX;
+    double maxX = -minX, maxY = -minX, maxZ = -minX;
+#pragma omp parallel for schedule(static) reduction(min: minX, minY, minZ) reduction(max: maxX, maxY, maxZ)
+    for(long long i = 0; i < n; i++) {
+        const double x = pos(i)[0], y = pos(i)[1], z = pos(i)[2];
+        if(!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) continue;
+        minX = std::min(minX, x); maxX = std::max(maxX, x);
+        minY = std::min(minY, y); maxY = std::max(maxY, y);
+        minZ = std::min(minZ, z); maxZ = std::max(maxZ, z);
+    }
+
+    const double maxCell = double((1u << SPATIAL_CODE_BITS) - 1);
+    const double extent = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ));
+    const double scale = extent > 0 ? maxCell / extent : 0;
+
+    std::vector<SpatialKey> keys(n);
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < n; i++) {
+        const double x = pos(i)[0], y = pos(i)[1], z = pos(i)[2];
+        keys[i].idx = i;
+        if(!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+            keys[i].code = 0;
+            continue;
+        }
+
+        const uint32_t cx = uint32_t(std::min(maxCell, (x - minX) * scale));
+        const uint32_t cy = uint32_t(std::min(maxCell, (y - minY) * scale));
+        const uint32_t cz = uint32_t(std::min(maxCell, (z - minZ) * scale));
+        keys[i].code = (curve == CURVE_HILBERT) ? hilbertCode(cx, cy, cz) : mortonCode(cx, cy, cz);
+    }
+
+    parallelSort(keys);
+
+    order.resize(n);
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < n; i++) order[i] = keys[i].idx;
+}
+
+/// Inverse of a permutation, table[order[i]] = i
+inline
+void
+invertPermutation(const std::vector<int64_t> &order, std::vector<int64_t> &table)
+{
+    const long long n = order.size();
+    table.resize(n);
+#pragma omp parallel for schedule(static)
+    for(long long i = 0; i < n; i++) table[order[i]] = i;
+}
+
+SFMFILES_NAMESPACE_END
+
+#endif // __SFMF_SPATIAL_HPP__
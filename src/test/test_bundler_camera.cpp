@@ -3,9 +3,12 @@
 #include <SfMFiles/sfmfiles>
 using namespace sfmf;
 #include "../ply.hpp"
+#include "../projection.hpp"
+
+#include <Eigen/Geometry>
 
 int
-test1(int argc, char const *argv[])
+test1(int /*argc*/, char const * /*argv*/[])
 {
     const char *cam1Str = "500.00000000000000000000 0.00000000000000000000 0.00000000000000000000\n"
                           "1.00000000000000000000 -0.00000000000000000000 0.00000000000000000000 \n"
@@ -42,7 +45,7 @@ test1(int argc, char const *argv[])
 }
 
 int
-test2(int argc, char const *argv[])
+test2(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Camera up vector");
     Bundler::Camera cam;
@@ -64,7 +67,7 @@ test2(int argc, char const *argv[])
 }
 
 int
-test3(int argc, char const *argv[])
+test3(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Camera lookAt vector");
 
@@ -77,7 +80,7 @@ test3(int argc, char const *argv[])
 }
 
 int
-test4(int argc, char const *argv[])
+test4(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Testing world2im");
     const char *camStr = "7.0008849479e+02 -7.0992716605e-02 -2.8653295186e-02\n"
@@ -103,7 +106,7 @@ test4(int argc, char const *argv[])
 }
 
 int
-test5(int argc, char const *argv[])
+test5(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Visibility computation");
 
@@ -145,7 +148,7 @@ test5(int argc, char const *argv[])
 }
 
 int
-test6(int argc, char const *argv[])
+test6(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Testing im2world");
     Bundler::Camera cam;
@@ -165,10 +168,10 @@ test6(int argc, char const *argv[])
     };
 
     double trueWorld[4][3] {
-        {  1, -1, -1},
         { -1, -1, -1},
-        { -1,  1, -1},
-        {  1,  1, -1}
+        {  1, -1, -1},
+        {  1,  1, -1},
+        { -1,  1, -1}
     };
 
     for (int i = 0; i < 4; i++) {
@@ -178,11 +181,18 @@ test6(int argc, char const *argv[])
         //LOG_EXPR(world.transpose());
 
         assert((world - Eigen::Vector3d(trueWorld[i][0], trueWorld[i][1], trueWorld[i][2])).norm() < 0.00000001);
+
+        // Back to where it came from
+        Eigen::Vector2d im2;
+        cam.world2im(world, im2, true);
+        assert((im2 - im + Eigen::Vector2d(imWidth, imHeight) / 2).norm() < 0.00000001);
     }
+
+    return EXIT_SUCCESS;
 }
 
 int
-test7(int argc, char const *argv[])
+test7(int /*argc*/, char const * /*argv*/[])
 {
     LOG_INFO("Testing world2cam with 3d and 4d vectors");
 
@@ -211,6 +221,364 @@ test7(int argc, char const *argv[])
     return EXIT_SUCCESS;
 }
 
+// Camera looking at the origin from a random direction, with radial
+// distortion, and random points around the origin (some behind it)
+static
+void
+randomScene(size_t nPoints, Bundler::Camera &cam, std::vector<double> &positions)
+{
+    srand(7);
+    Eigen::Matrix3d Q = Eigen::Matrix3d::Random();
+    Q.col(0).normalize();
+    Q.col(1) -= Q.col(1).dot(Q.col(0)) * Q.col(0);
+    Q.col(1).normalize();
+    Q.col(2) = Q.col(0).cross(Q.col(1));
+    cam.rotation = Q.transpose();
+    cam.translation = Eigen::Vector3d(0.1, -0.2, -2);
+    cam.focalLength = 700;
+    cam.k1 = -0.05;
+    cam.k2 = 0.01;
+
+    positions.resize(3 * nPoints);
+    for(size_t i = 0; i < positions.size(); i++) positions[i] = 5.0 * (rand() / double(RAND_MAX) - 0.5);
+}
+
+int
+test8(int /*argc*/, char const * /*argv*/[])
+{
+    LOG_INFO("Batch projection agrees with world2im");
+
+    Bundler::Camera cam;
+    std::vector<double> positions;
+    const size_t nPoints = 100003; // Not a multiple of the vector width
+    randomScene(nPoints, cam, positions);
+    const int width = 800, height = 600;
+
+    for(int distort = 0; distort < 2; distort++) {
+        for(int bounds = 0; bounds < 2; bounds++) {
+            const int w = bounds ? width : 0, h = bounds ? height : 0;
+
+            std::vector<double> expIm(2 * nPoints);
+            std::vector<uint8_t> expVisible(nPoints);
+            size_t expNVisible = 0;
+            for(size_t i = 0; i < nPoints; i++) {
+                Eigen::Vector2d im;
+                expVisible[i] = cam.world2im(Eigen::Vector3d(&positions[3 * i]), im, distort, w, h);
+                expIm[2 * i] = im[0];
+                expIm[2 * i + 1] = im[1];
+                expNVisible += expVisible[i];
+            }
+            LOG_INFO("distortion " << distort << ", bounds " << bounds << ", " << expNVisible << " visible");
+
+            for(int level = SIMD_NONE; level <= detectSimdLevel(); level++) {
+                std::vector<double> im(2 * nPoints);
+                std::vector<uint8_t> visible(nPoints);
+                Bundler::ProjectionParams params(cam, distort, w, h);
+                size_t nVisible = Bundler::projectPoints(params, positions.data(), nPoints, im.data(), visible.data(), SimdLevel(level));
+
+                size_t nDiff = 0;
+                for(size_t i = 0; i < nPoints; i++) {
+                    for(int k = 0; k < 2; k++) {
+                        assert(fabs(im[2 * i + k] - expIm[2 * i + k]) <= 1e-9 * (1 + fabs(expIm[2 * i + k])));
+                    }
+                    if(visible[i] == expVisible[i]) continue;
+
+                    // Rounding can only matter right at the border
+                    nDiff++;
+                    const double border = std::min(std::min(fabs(expIm[2 * i]), fabs(expIm[2 * i] - w)),
+                                                   std::min(fabs(expIm[2 * i + 1]), fabs(expIm[2 * i + 1] - h)));
+                    assert(border < 1e-6);
+                }
+                assert(nVisible + nDiff >= expNVisible && nVisible <= expNVisible + nDiff);
+            }
+
+            std::vector<double> im(2 * nPoints);
+            std::vector<uint8_t> visible(nPoints);
+            cam.world2imBatch(positions.data(), nPoints, im.data(), visible.data(), distort, w, h);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test9(int argc, char const *argv[])
+{
+    LOG_INFO("Benchmark batch projection against world2im");
+
+    Bundler::Camera cam;
+    std::vector<double> positions;
+    const size_t nPoints = argc > 0 ? atoll(argv[0]) : 4000000;
+    const int nRounds = std::max<size_t>(1, 40000000 / nPoints); // Small sets stay in cache
+    randomScene(nPoints, cam, positions);
+    const int width = 800, height = 600;
+
+    std::vector<double> im(2 * nPoints);
+    std::vector<uint8_t> visible(nPoints);
+    size_t nVisible = 0;
+    {
+        TIMER(t, "world2im loop");
+        for(int r = 0; r < nRounds; r++) {
+            nVisible = 0;
+            for(size_t i = 0; i < nPoints; i++) {
+                Eigen::Vector2d pntIm;
+                visible[i] = cam.world2im(Eigen::Vector3d(&positions[3 * i]), pntIm, true, width, height);
+                im[2 * i] = pntIm[0];
+                im[2 * i + 1] = pntIm[1];
+                nVisible += visible[i];
+            }
+        }
+    }
+    LOG_EXPR(nVisible);
+
+    const char *names[3] = {"batch, no simd", "batch, sse2", "batch, avx2"};
+    for(int level = SIMD_NONE; level <= detectSimdLevel(); level++) {
+        TIMER(t, names[level]);
+        Bundler::ProjectionParams params(cam, true, width, height);
+        for(int r = 0; r < nRounds; r++) {
+            nVisible = Bundler::projectPoints(params, positions.data(), nPoints, im.data(), visible.data(), SimdLevel(level));
+        }
+    }
+    LOG_EXPR(nVisible);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test10(int /*argc*/, char const * /*argv*/[])
+{
+    LOG_INFO("Cached camera quantities match the ones computed on demand");
+
+    Bundler::Camera cam;
+    std::vector<double> positions;
+    randomScene(1000, cam, positions);
+    const int width = 800, height = 600;
+    assert(!cam.cache.initialized);
+
+    // Computed on demand before the refresh, up and the viewing direction
+    // are the camera axes moved to the world
+    Eigen::Vector3d center, up, dir, origin, axis;
+    cam.center(center);
+    cam.up(up);
+    cam.lookingAt(dir);
+    const bool valid = cam.isValid();
+    cam.cam2world(Eigen::Vector3d::Zero(), origin);
+    cam.cam2world(Eigen::Vector3d(0, 1, 0), axis);
+    assert(((axis - origin).normalized() - up).norm() < 1e-9);
+    cam.cam2world(Eigen::Vector3d(0, 0, -1), axis);
+    assert(((axis - origin).normalized() - dir).norm() < 1e-9);
+    Eigen::Matrix3d K, invK;
+    cam.intrinsicMatrix(width, height, K);
+    cam.invIntrinsicMatrix(width, height, invK);
+
+    cam.refreshCache(width, height);
+    assert(cam.cache.initialized);
+    assert(cam.cache.valid == valid);
+    assert(cam.cache.center == center && cam.cache.up == up && cam.cache.direction == dir);
+    assert(cam.cache.K == K && cam.cache.invK == invK);
+
+    // The accessors read the cache, even when it went stale
+    const Eigen::Vector3d translation = cam.translation;
+    cam.translation.setZero();
+    Eigen::Vector3d cached;
+    cam.center(cached);
+    assert(cached == center);
+    cam.translation = translation;
+    cam.rotation *= 2;
+    assert(cam.isValid() == valid);
+    cam.rotation /= 2;
+    cam.up(cached);
+    assert(cached == up);
+    cam.lookingAt(cached);
+    assert(cached == dir);
+    Eigen::Matrix3d cachedK;
+    cam.intrinsicMatrix(width, height, cachedK);
+    assert(cachedK == K);
+    // Other image sizes are computed on demand
+    cam.intrinsicMatrix(2 * width, height, cachedK);
+    assert(cachedK(0, 2) == -width);
+    assert((cam.cache.K * cam.cache.invK - Eigen::Matrix3d::Identity()).norm() < 1e-12);
+
+    // P takes points in front of the camera to the same pixels as
+    // world2im, with the y axis of K pointing down
+    for(size_t i = 0; i < positions.size() / 3; i++) {
+        Eigen::Vector3d pntW(&positions[3 * i]), pntCam;
+        cam.world2cam(pntW, pntCam);
+        if(pntCam[2] >= 0) continue;
+
+        Eigen::Vector2d pntIm;
+        cam.world2im(pntW, pntIm, false, width, height);
+        pntIm[1] = height - pntIm[1];
+        Eigen::Vector3d h = cam.cache.P * pntW.homogeneous();
+        assert((h.hnormalized() - pntIm).norm() < 1e-6);
+        Eigen::Vector3f hf = cam.cache.Pf * pntW.cast<float>().homogeneous();
+        // Single precision is only good far enough from the camera plane
+        if(pntCam[2] < -0.5) assert((hf.hnormalized().cast<double>() - pntIm).norm() < 1e-5 * (width + pntIm.norm()));
+    }
+
+    // Refreshing without a size keeps the previous one
+    cam.focalLength *= 2;
+    cam.refreshCache();
+    assert(cam.cache.imWidth == width && cam.cache.imHeight == height);
+    assert(cam.cache.K(0, 0) == cam.focalLength);
+
+    // Transforming the world does not change where points are seen
+    Eigen::Matrix4d trans = Eigen::Matrix4d::Identity();
+    trans.block<3, 3>(0, 0) = 2.5 * Eigen::AngleAxisd(0.3, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+    trans.block<3, 1>(0, 3) = Eigen::Vector3d(1, -2, 3);
+    Bundler::Camera camT = cam;
+    camT.transform(trans);
+    assert(fabs(camT.rotation.determinant() - 1) < 1e-9);
+    assert((camT.cache.center - (trans * cam.cache.center.homogeneous()).head<3>()).norm() < 1e-9);
+    for(size_t i = 0; i < positions.size() / 3; i++) {
+        Eigen::Vector3d pntW(&positions[3 * i]);
+        Eigen::Vector3d pntWT = (trans * pntW.homogeneous()).head<3>();
+        Eigen::Vector2d pntIm, pntImT;
+        bool vis = cam.world2im(pntW, pntIm, true, width, height);
+        bool visT = camT.world2im(pntWT, pntImT, true, width, height);
+        assert(vis == visT);
+        if(vis) assert((pntIm - pntImT).norm() < 1e-6);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test11(int /*argc*/, char const * /*argv*/[])
+{
+    LOG_INFO("Removing radial distortion inverts cam2im");
+
+    Bundler::Camera cam;
+    std::vector<double> positions;
+    randomScene(100003, cam, positions);
+    const int width = 800, height = 600;
+    const size_t nPoints = positions.size() / 3;
+
+    // Mild and strong barrel distortion, and pincushion
+    const double coeffs[3][2] = {{-0.05, 0.01}, {-0.3, 0.08}, {0.2, 0.05}};
+    for(int k = 0; k < 3; k++) {
+        cam.k1 = coeffs[k][0];
+        cam.k2 = coeffs[k][1];
+
+        // Points that land in the image, and the direction they come from
+        std::vector<double> im, dirs;
+        for(size_t i = 0; i < nPoints; i++) {
+            Eigen::Vector3d pntCam;
+            Eigen::Vector2d pntIm;
+            cam.world2cam(Eigen::Vector3d(&positions[3 * i]), pntCam);
+            if(!cam.cam2im(pntCam, pntIm, true, width, height)) continue;
+            im.push_back(pntIm[0]);
+            im.push_back(pntIm[1]);
+            pntCam /= -pntCam[2];
+            dirs.insert(dirs.end(), pntCam.data(), pntCam.data() + 3);
+        }
+        const size_t n = im.size() / 2;
+        LOG_EXPR(n);
+        assert(n > 1000);
+
+        std::vector<double> c(3 * n);
+        for(size_t i = 0; i < n; i++) {
+            Eigen::Vector3d pntCam;
+            cam.im2cam(Eigen::Vector2d(im[2 * i], im[2 * i + 1]), pntCam, width, height);
+            assert((pntCam - Eigen::Vector3d(&dirs[3 * i])).norm() < 1e-12);
+        }
+
+        Bundler::ProjectionParams params(cam, true, width, height);
+        for(int level = SIMD_NONE; level <= detectSimdLevel(); level++) {
+            Bundler::undistortPoints(params, im.data(), n, c.data(), NULL, SimdLevel(level));
+            for(size_t i = 0; i < 3 * n; i++) assert(fabs(c[i] - dirs[i]) < 1e-12);
+        }
+
+        // Interpolated, error in pixels
+        Bundler::UndistortionTable table(cam, width, height);
+        cam.im2camBatch(im.data(), n, c.data(), width, height, true, &table);
+        double maxErr = 0;
+        for(size_t i = 0; i < 3 * n; i++) maxErr = std::max(maxErr, fabs(c[i] - dirs[i]) * cam.focalLength);
+        LOG_EXPR(maxErr);
+        assert(maxErr < 1e-6);
+
+        // Batch to world agrees with im2world
+        std::vector<double> w(3 * n);
+        cam.im2worldBatch(im.data(), n, w.data(), width, height);
+        for(size_t i = 0; i < n; i += 97) {
+            Eigen::Vector3d pntW;
+            cam.im2world(Eigen::Vector2d(im[2 * i], im[2 * i + 1]), pntW, width, height);
+            assert((pntW - Eigen::Vector3d(&w[3 * i])).norm() < 1e-12);
+        }
+    }
+
+    // Tables only work for the distortion they were built for
+    Bundler::UndistortionTable table(cam, width, height);
+    cam.k1 += 0.01;
+    double im[2] = {0, 0}, c[3];
+    bool thrown = false;
+    try {
+        cam.im2camBatch(im, 1, c, width, height, true, &table);
+    } catch(const sfmf::Error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test12(int argc, char const *argv[])
+{
+    LOG_INFO("Benchmark undistortion of every pixel of an image");
+
+    Bundler::Camera cam;
+    std::vector<double> positions;
+    randomScene(0, cam, positions);
+    const int width = argc > 0 ? atoi(argv[0]) : 2000, height = width * 3 / 4;
+    const size_t nPixels = size_t(width) * height;
+
+    std::vector<double> im(2 * nPixels), c(3 * nPixels);
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            im[2 * (size_t(y) * width + x)] = x + 0.5;
+            im[2 * (size_t(y) * width + x) + 1] = y + 0.5;
+        }
+    }
+
+    {
+        TIMER(t, "im2cam loop");
+        for(size_t i = 0; i < nPixels; i++) {
+            Eigen::Vector3d pntCam;
+            cam.im2cam(Eigen::Vector2d(im[2 * i], im[2 * i + 1]), pntCam, width, height);
+            std::copy(pntCam.data(), pntCam.data() + 3, &c[3 * i]);
+        }
+    }
+    const std::vector<double> expected = c;
+
+    const char *names[3] = {"batch, no simd", "batch, sse2", "batch, avx2"};
+    Bundler::ProjectionParams params(cam, true, width, height);
+    for(int level = SIMD_NONE; level <= detectSimdLevel(); level++) {
+        {
+            TIMER(t, names[level]);
+            Bundler::undistortPoints(params, im.data(), nPixels, c.data(), NULL, SimdLevel(level));
+        }
+        assert(c == expected || level != SIMD_NONE);
+    }
+
+    Bundler::UndistortionTable *table;
+    {
+        TIMER(t, "building the table");
+        table = new Bundler::UndistortionTable(cam, width, height);
+    }
+    {
+        TIMER(t, "batch, table");
+        cam.im2camBatch(im.data(), nPixels, c.data(), width, height, true, table);
+    }
+    delete table;
+
+    double maxErr = 0;
+    for(size_t i = 0; i < c.size(); i++) maxErr = std::max(maxErr, fabs(c[i] - expected[i]) * cam.focalLength);
+    LOG_EXPR(maxErr);
+
+    return EXIT_SUCCESS;
+}
+
 int
 main(int argc, char const *argv[])
 {
@@ -245,6 +613,21 @@ main(int argc, char const *argv[])
     case 7:
         return test7(argc - 2, &argv[2]);
         break;
+    case 8:
+        return test8(argc - 2, &argv[2]);
+        break;
+    case 9:
+        return test9(argc - 2, &argv[2]);
+        break;
+    case 10:
+        return test10(argc - 2, &argv[2]);
+        break;
+    case 11:
+        return test11(argc - 2, &argv[2]);
+        break;
+    case 12:
+        return test12(argc - 2, &argv[2]);
+        break;
     default:
         LOG_WARN("No test " << testNum);
     }
@@ -31,13 +31,13 @@ main(int argc, const char *argv[])
     try {
         LOG_INFO("Loading list file");
         bundler.readListFile(listFName);
-    } catch (sfmf::Error e) {
+    } catch (sfmf::Error &e) {
         LOG_WARN("Caught exception");
         LOG_WARN(" WHAT: " << e.what());
     }
 
     LOG_EXPR(bundler.getListFileName());
-    LOG_EXPR(bundler.getImageFileNames()[camNum]);
+    LOG_EXPR(bundler.getImageFileName(camNum));
 
     // Test transforms
     Point &pntInfo = bundler.getPoints()[0];
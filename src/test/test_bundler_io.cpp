@@ -0,0 +1,1791 @@
+#undef NDEBUG
+
+#include <SfMFiles/sfmfiles>
+using namespace sfmf;
+
+#include "../io.hpp"
+#include "../bundle_binary.hpp"
+#include "../scanner.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <Eigen/Geometry>
+
+#include <boost/filesystem.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Compares every camera, point and view list entry bit by bit
+static
+bool
+sameReconstruction(const Bundler::Reconstruction &a, const Bundler::Reconstruction &b)
+{
+    using namespace Bundler;
+
+    if(a.getNCameras() != b.getNCameras() || a.getNPoints() != b.getNPoints()) return false;
+
+    for(int i = 0; i < a.getNCameras(); i++) {
+        const Camera &ca = a.getCameras()[i], &cb = b.getCameras()[i];
+        if(ca.focalLength != cb.focalLength || ca.k1 != cb.k1 || ca.k2 != cb.k2) return false;
+        if(ca.rotation != cb.rotation || ca.translation != cb.translation) return false;
+    }
+
+    for(int i = 0; i < a.getNPoints(); i++) {
+        const Point &pa = a.getPoints()[i], &pb = b.getPoints()[i];
+        if(pa.position != pb.position) return false;
+        if(pa.color.r != pb.color.r || pa.color.g != pb.color.g || pa.color.b != pb.color.b) return false;
+        if(pa.viewList.size() != pb.viewList.size()) return false;
+
+        for(size_t j = 0; j < pa.viewList.size(); j++) {
+            const ViewListEntry &ea = pa.viewList[j], &eb = pb.viewList[j];
+            if(ea.camera != eb.camera || ea.key != eb.key || ea.keyPosition != eb.keyPosition) return false;
+        }
+    }
+
+    return true;
+}
+
+// Writes a bundle file with the points of inFName repeated nCopies times
+static
+void
+writeScaledBundle(const char *inFName, int nCopies, const char *outFName)
+{
+    using namespace Bundler;
+
+    Reconstruction bundle(inFName);
+    Point::Vector points;
+    points.reserve(bundle.getNPoints() * nCopies);
+    for(int i = 0; i < nCopies; i++) {
+        points.insert(points.end(), bundle.getPoints().begin(), bundle.getPoints().end());
+    }
+
+    Reconstruction scaled(bundle.getCameras(), points);
+    scaled.writeFile(outFName);
+}
+
+int
+test1(int /*argc*/, char **argv)
+{
+    LOG_INFO("Buffer parser gives the same result as the istream parser");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+
+    ReadOptions bufferOpts, istreamOpts;
+    bufferOpts.parser = ReadOptions::PARSER_BUFFER;
+    istreamOpts.parser = ReadOptions::PARSER_ISTREAM;
+
+    Reconstruction a, b;
+    a.readFile(bundleFName, bufferOpts);
+    b.readFile(bundleFName, istreamOpts);
+
+    LOG_EXPR(a.getNCameras());
+    LOG_EXPR(a.getNPoints());
+    assert(sameReconstruction(a, b));
+
+    return EXIT_SUCCESS;
+}
+
+int
+test2(int argc, char **argv)
+{
+    LOG_INFO("Benchmark buffer parser against istream parser");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 1000;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+
+    LOG_INFO("Writing " << scaledFName << " (" << nCopies << " copies of the points)");
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    ReadOptions opts;
+    Reconstruction a, b;
+    {
+        opts.parser = ReadOptions::PARSER_ISTREAM;
+        TIMER(t, "istream parser");
+        b.readFile(scaledFName.c_str(), opts);
+    }
+    {
+        opts.parser = ReadOptions::PARSER_BUFFER;
+        TIMER(t, "buffer parser");
+        a.readFile(scaledFName.c_str(), opts);
+    }
+
+    LOG_EXPR(a.getNPoints());
+    assert(sameReconstruction(a, b));
+
+    return EXIT_SUCCESS;
+}
+
+int
+test3(int argc, char **argv)
+{
+    LOG_INFO("Parallel parser gives the same result as the sequential one");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    ReadOptions opts;
+    opts.nThreads = 1;
+    Reconstruction sequential;
+    sequential.readFile(scaledFName.c_str(), opts);
+
+    int threadCounts[] = {2, 3, 8, 64};
+    for(int i = 0; i < 4; i++) {
+        opts.nThreads = threadCounts[i];
+        LOG_EXPR(opts.nThreads);
+
+        Reconstruction parallel;
+        parallel.readFile(scaledFName.c_str(), opts);
+        assert(sameReconstruction(sequential, parallel));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test4(int argc, char **argv)
+{
+    LOG_INFO("Benchmark parallel parser");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 1000;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    ReadOptions opts;
+    for(int nThreads = 1; nThreads <= 64; nThreads *= 2) {
+        opts.nThreads = nThreads;
+        std::stringstream msg;
+        msg << "buffer parser, " << nThreads << " threads";
+
+        Reconstruction bundle;
+        TIMER(t, msg.str().c_str());
+        bundle.readFile(scaledFName.c_str(), opts);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test5(int argc, char **argv)
+{
+    LOG_INFO("Binary bundle files round trip and load faster than text");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string binaryFName = "/tmp/test_bundler_io_scaled.bin";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    Reconstruction text;
+    {
+        TIMER(t, "text load");
+        text.readFile(scaledFName.c_str());
+    }
+    text.writeFile(binaryFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    Reconstruction binary;
+    {
+        TIMER(t, "binary load");
+        binary.readFile(binaryFName.c_str());
+    }
+    assert(sameReconstruction(text, binary));
+
+    // Signature detection also works with the istream parser
+    ReadOptions opts;
+    opts.parser = ReadOptions::PARSER_ISTREAM;
+    Reconstruction binaryIStream;
+    binaryIStream.readFile(binaryFName.c_str(), opts);
+    assert(sameReconstruction(text, binaryIStream));
+
+    // A header whose observation count wraps the computed file size
+    // around to something smaller than the file is rejected
+    {
+        BinaryHeader header;
+        header.nObservations = std::numeric_limits<uint64_t>::max() / sizeof(BinaryObservation) + 1;
+        BinaryLayout layout(header);
+        assert(layout.fileSize < 128);
+        std::vector<char> file(layout.fileSize, 0);
+        memcpy(file.data(), &header, sizeof(header));
+        std::ofstream f(binaryFName.c_str(), std::ios::binary);
+        f.write(file.data(), file.size());
+        f.close();
+
+        bool thrown = false;
+        try {
+            Reconstruction bad(binaryFName.c_str());
+        } catch(sfmf::Error &e) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            ReconstructionView bad(binaryFName.c_str());
+        } catch(sfmf::Error &e) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test6(int argc, char **argv)
+{
+    LOG_INFO("Memory mapped view matches the loaded reconstruction");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 10;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string cacheFName = scaledFName + ".bin";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+    unlink(cacheFName.c_str());
+
+    Reconstruction bundle(scaledFName.c_str());
+    ReconstructionView view(scaledFName.c_str());
+    assert(cacheFName == view.getMappedFileName());
+    assert(view.getNCameras() == size_t(bundle.getNCameras()));
+    assert(view.getNPoints() == size_t(bundle.getNPoints()));
+
+    Point::Vector points(view.getNPoints());
+    for(size_t i = 0; i < view.getNPoints(); i++) view.getPoint(i, points[i]);
+
+    Camera::Vector cameras(view.getNCameras());
+    for(size_t i = 0; i < view.getNCameras(); i++) cameras[i] = view.getCamera(i);
+
+    assert(sameReconstruction(bundle, Reconstruction(cameras, points)));
+
+    // Second time around the cache is mapped
+    {
+        TIMER(t, "open view from cache");
+        ReconstructionView cached(scaledFName.c_str());
+        assert(cached.getNPoints() == size_t(bundle.getNPoints()));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Collects the points handed to it
+class CollectPoints : public Bundler::PointVisitor
+{
+public:
+    Bundler::Camera::Vector cameras;
+    Bundler::Point::Vector points;
+
+    void visitCameras(const Bundler::Camera::Vector &cams, int64_t nPoints)
+    {
+        cameras = cams;
+        points.reserve(nPoints);
+    }
+
+    void visitPoint(int64_t pntIdx, const Bundler::Point &pnt)
+    {
+        assert(pntIdx == int64_t(points.size()));
+        points.push_back(pnt);
+    }
+};
+
+int
+test7(int argc, char **argv)
+{
+    LOG_INFO("Streaming reader and writer give the same result as loading the whole file");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 10;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string streamedFName = "/tmp/test_bundler_io_streamed.out";
+    std::string binaryFName = "/tmp/test_bundler_io_scaled.bin";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    Reconstruction bundle(scaledFName.c_str());
+
+    // Input file as given (possibly gzipped), text copy, binary copy and
+    // gzipped binary copy
+    std::string binaryGzFName = binaryFName + ".gz";
+    const char *inputs[] = {bundleFName, scaledFName.c_str(), binaryFName.c_str(), binaryGzFName.c_str()};
+    bundle.writeFile(binaryFName.c_str(), Reconstruction::FORMAT_BINARY);
+    bundle.writeFile(binaryGzFName.c_str(), Reconstruction::FORMAT_BINARY);
+    for(int i = 0; i < 4; i++) {
+        LOG_EXPR(inputs[i]);
+        Reconstruction expected(inputs[i]);
+
+        CollectPoints collect;
+        visitPoints(inputs[i], collect);
+        assert(sameReconstruction(expected, Reconstruction(collect.cameras, collect.points)));
+    }
+    // Binary files are streamed as they are, no cache is written
+    assert(!boost::filesystem::exists(binaryGzFName + ".bin"));
+
+    // Stream through a writer, with the point count only known at the end
+    // and given up front, plain and gzipped output
+    const std::string outputs[] = {streamedFName, streamedFName + ".gz"};
+    for(int known = 0; known < 2; known++) {
+        for(int o = 0; o < 2; o++) {
+            {
+                StreamReader reader(scaledFName.c_str());
+                StreamWriter writer(outputs[o].c_str(), reader.getCameras(), known ? reader.getNPoints() : -1);
+                Point pnt;
+                while(reader.readPoint(pnt)) writer.writePoint(pnt);
+                assert(writer.getNPoints() == bundle.getNPoints());
+            }
+
+            assert(detectCompression(outputs[o].c_str()) == (o ? COMPRESSION_GZIP : COMPRESSION_NONE));
+            Reconstruction streamed(outputs[o].c_str());
+            assert(sameReconstruction(bundle, streamed));
+            unlink(outputs[o].c_str());
+        }
+    }
+
+    // A wrong point count is reported
+    {
+        bool thrown = false;
+        StreamWriter writer(streamedFName.c_str(), bundle.getCameras(), bundle.getNPoints() + 1);
+        writer.writePoint(bundle.getPoints()[0]);
+        try {
+            writer.close();
+        } catch(sfmf::Error &e) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    unlink(binaryGzFName.c_str());
+
+    return EXIT_SUCCESS;
+}
+
+int
+test8(int argc, char **argv)
+{
+    LOG_INFO("Written text files read back bit for bit");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string writtenFName = "/tmp/test_bundler_io_written.out";
+
+    // Random values exercise all digits of the formatting
+    Reconstruction bundle(bundleFName);
+    Point::Vector points;
+    for(int i = 0; i < nCopies; i++) {
+        for(int j = 0; j < bundle.getNPoints(); j++) {
+            Point pnt = bundle.getPoints()[j];
+            pnt.position = Eigen::Vector3d::Random() * pow(10.0, (rand() % 40) - 20);
+            for(size_t k = 0; k < pnt.viewList.size(); k++) pnt.viewList[k].keyPosition = Eigen::Vector2d::Random() * 1000;
+            points.push_back(pnt);
+        }
+    }
+    Camera::Vector cameras = bundle.getCameras();
+    cameras[0].k1 = -0.0;
+    cameras[0].k2 = 1e-310; // Subnormal
+    Reconstruction random(cameras, points);
+
+    {
+        TIMER(t, "write text");
+        random.writeFile(writtenFName.c_str());
+    }
+
+    Reconstruction reread(writtenFName.c_str());
+    assert(sameReconstruction(random, reread));
+
+    // Original data goes through unchanged as well
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+    Reconstruction scaled(scaledFName.c_str());
+    scaled.writeFile(writtenFName.c_str());
+    assert(sameReconstruction(scaled, Reconstruction(writtenFName.c_str())));
+
+    return EXIT_SUCCESS;
+}
+
+int
+test9(int argc, char **argv)
+{
+    LOG_INFO("Cameras only load gives the cameras and the point count");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string binaryFName = "/tmp/test_bundler_io_scaled.bin";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    Reconstruction bundle;
+    {
+        TIMER(t, "full load");
+        bundle.readFile(scaledFName.c_str());
+    }
+    bundle.writeFile(binaryFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    ReadOptions opts;
+    opts.camerasOnly = true;
+
+    const char *inputs[] = {scaledFName.c_str(), binaryFName.c_str()};
+    for(int i = 0; i < 2; i++) {
+        Reconstruction cameras;
+        {
+            TIMER(t, "cameras only load");
+            cameras.readFile(inputs[i], opts);
+        }
+
+        assert(cameras.getNPoints() == 0);
+        assert(cameras.getNPointsInFile() == bundle.getNPoints());
+        assert(cameras.getNValidCameras() == bundle.getNValidCameras());
+        assert(sameReconstruction(Reconstruction(bundle.getCameras(), Point::Vector()),
+                                  Reconstruction(cameras.getCameras(), Point::Vector())));
+    }
+
+    // The requested layout is kept even though no point is read
+    opts.pointLayout = POINTS_COMPACT;
+    Reconstruction cameras;
+    cameras.readFile(inputs[0], opts);
+    assert(cameras.getPointLayout() == POINTS_COMPACT && cameras.getNPoints() == 0);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test10(int argc, char **argv)
+{
+    LOG_INFO("Gzipped output, selected by extension, reads back the same");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string scaledFName = "/tmp/test_bundler_io_scaled.out";
+    std::string gzFName = "/tmp/test_bundler_io_scaled.out.gz";
+    std::string binaryGzFName = "/tmp/test_bundler_io_scaled.bin.gz";
+    writeScaledBundle(bundleFName, nCopies, scaledFName.c_str());
+
+    Reconstruction bundle(scaledFName.c_str());
+    {
+        TIMER(t, "write text");
+        bundle.writeFile(scaledFName.c_str());
+    }
+    {
+        TIMER(t, "write gzipped text");
+        bundle.writeFile(gzFName.c_str());
+    }
+    bundle.writeFile(binaryGzFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    assert(sameReconstruction(bundle, Reconstruction(gzFName.c_str())));
+    assert(sameReconstruction(bundle, Reconstruction(binaryGzFName.c_str())));
+
+    ReadOptions opts;
+    opts.parser = ReadOptions::PARSER_ISTREAM;
+    Reconstruction istream;
+    istream.readFile(gzFName.c_str(), opts);
+    assert(sameReconstruction(bundle, istream));
+
+    return EXIT_SUCCESS;
+}
+
+int
+test11(int argc, char **argv)
+{
+    LOG_INFO("Gzipped bundle read through the gzip index");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 100;
+    std::string gzFName = "/tmp/test_bundler_io_scaled.out.gz";
+    std::string indexFName = GzipIndex::indexFileName(gzFName.c_str());
+    writeScaledBundle(bundleFName, nCopies, gzFName.c_str());
+    unlink(indexFName.c_str());
+
+    Reconstruction plain;
+    {
+        TIMER(t, "load without index");
+        plain.readFile(gzFName.c_str());
+    }
+
+    ReadOptions opts;
+    opts.useGzipIndex = true;
+    for(int i = 0; i < 2; i++) {
+        // First time around the index is built
+        Reconstruction indexed;
+        {
+            TIMER(t, i == 0 ? "load building index" : "load with index");
+            indexed.readFile(gzFName.c_str(), opts);
+        }
+        assert(sameReconstruction(plain, indexed));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test12(int /*argc*/, char **argv)
+{
+    LOG_INFO("List file with extra columns, long names and lookups by name");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    Reconstruction bundle(bundleFName);
+    int nCams = bundle.getNCameras();
+
+    // Every other image has a focal length, last line has no newline
+    std::string longDir(3000, 'd');
+    std::string listFName = "/tmp/test_bundler_io_list.txt";
+    {
+        std::ofstream f(listFName.c_str());
+        for(int i = 0; i < nCams; i++) {
+            f << longDir << "/dir" << i % 2 << "/img" << i / 2 << ".jpg";
+            if(i % 2) f << " 0 " << 100.5 * i;
+            if(i < nCams - 1) f << "\n";
+        }
+    }
+
+    bundle.readListFile(listFName.c_str());
+    const ListFile &list = bundle.getImageList();
+    assert(int(list.size()) == nCams);
+    for(int i = 0; i < nCams; i++) {
+        std::stringstream name;
+        name << longDir << "/dir" << i % 2 << "/img" << i / 2 << ".jpg";
+        assert(bundle.getImageFileName(i) == name.str());
+        assert(list.getFocal(i) == ((i % 2) ? 100.5 * i : 0));
+        assert(list.find(name.str()) == i);
+    }
+
+    // Basenames are shared by pairs of images, except for the last one if nCams is odd
+    assert(list.find("img0.jpg") == -1);
+    if(nCams % 2) {
+        std::stringstream other;
+        other << "/other/img" << nCams / 2 << ".jpg";
+        assert(list.find(other.str()) == nCams - 1);
+    }
+    assert(list.find("missing.jpg") == -1);
+
+    // Round trip keeps the extra columns, also compressed
+    std::string outFName = "/tmp/test_bundler_io_list.txt.gz";
+    bundle.writeListFile(outFName.c_str());
+    ListFile reread(outFName.c_str());
+    assert(reread.size() == list.size());
+    for(size_t i = 0; i < list.size(); i++) {
+        assert(reread.getFileName(i) == list.getFileName(i));
+        assert(reread.getExtra(i) == list.getExtra(i));
+    }
+
+    // Subsets and copies have their own lookup tables
+    std::vector<int> idxs;
+    for(int i = nCams - 1; i >= 0; i -= 2) idxs.push_back(i);
+    ListFile subset = list;
+    subset.select(idxs);
+    assert(subset.size() == idxs.size());
+    for(size_t i = 0; i < idxs.size(); i++) {
+        assert(subset.getFileName(i) == list.getFileName(idxs[i]));
+        assert(subset.find(list.getFileName(idxs[i])) == int(i));
+        assert(subset.find(ListFile::basename(list.getFileName(idxs[i]))) == int(i));
+    }
+
+    subset.push_back("new.jpg", "0 42");
+    assert(subset.find("new.jpg") == int(idxs.size()) && subset.getFocal(idxs.size()) == 42);
+
+    // Number of names has to match the number of cameras
+    ListFile shortList;
+    for(int i = 0; i < nCams - 1; i++) shortList.push_back("a.jpg");
+    shortList.writeFile(listFName.c_str());
+    bool failed = false;
+    try {
+        bundle.readListFile(listFName.c_str());
+    } catch (sfmf::Error &e) {
+        failed = true;
+    }
+    assert(failed);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test13(int argc, char **argv)
+{
+    LOG_INFO("Points stored as arrays load, convert and write like a Point::Vector");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+    std::string textFName = "/tmp/test_bundler_io_soa.out";
+    std::string binFName = "/tmp/test_bundler_io_soa.bin";
+    writeScaledBundle(bundleFName, nCopies, textFName.c_str());
+
+    Reconstruction ref(textFName.c_str(), true);
+    ref.writeFile(binFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    const char *fnames[] = {textFName.c_str(), binFName.c_str()};
+    for(int f = 0; f < 2; f++) {
+        for(int parser = 0; parser < 3; parser++) {
+            ReadOptions opts;
+            opts.pointLayout = POINTS_SOA;
+            // More threads than cores so the parallel parser is used
+            opts.nThreads = (parser == 1) ? 4 : 1;
+            if(parser == 2) opts.parser = ReadOptions::PARSER_ISTREAM;
+
+            Reconstruction soa;
+            {
+                TIMER(t, "load as arrays");
+                soa.readFile(fnames[f], opts, true);
+            }
+            assert(soa.getPointLayout() == POINTS_SOA);
+            assert(soa.getNPoints() == ref.getNPoints());
+            assert(soa.getPointArrays().getNObservations() == soa.getPointArrays().observations.size());
+
+            // Index is the same whatever the layout
+            for(int c = 0; c < ref.getNCameras(); c++) {
+                ArrayView<PointVisListIdxs> a = ref.getVisiblePoints(c), b = soa.getVisiblePoints(c);
+                assert(a.size() == b.size());
+                for(size_t i = 0; i < a.size(); i++) {
+                    assert(a[i].pointIdx == b[i].pointIdx && a[i].visibilityListIdx == b[i].visibilityListIdx);
+                }
+            }
+
+            Reconstruction aos = soa;
+            aos.setPointLayout(POINTS_AOS);
+            assert(sameReconstruction(ref, aos));
+        }
+    }
+
+    // Writing from arrays gives the same files
+    ReadOptions opts;
+    opts.pointLayout = POINTS_SOA;
+    Reconstruction soa;
+    soa.readFile(binFName.c_str(), opts);
+    for(int format = 0; format < 2; format++) {
+        std::string outFName = "/tmp/test_bundler_io_soa_out";
+        soa.writeFile(outFName.c_str(), format ? Reconstruction::FORMAT_BINARY : Reconstruction::FORMAT_ASCII);
+        Reconstruction reread(outFName.c_str());
+        assert(sameReconstruction(ref, reread));
+    }
+
+    // Geometry kernels against the same operations done point by point
+    Eigen::Matrix4d trans;
+    trans << 0, -2, 0, 1,
+             2,  0, 0, 2,
+             0,  0, 2, 3,
+             0,  0, 0, 1;
+    PointArrays &arrays = soa.getPointArrays();
+    {
+        TIMER(t, "transform arrays");
+        arrays.transform(trans);
+    }
+
+    Eigen::Vector3d min, max;
+    arrays.boundingBox(min, max);
+    Eigen::Vector3d refMin = Eigen::Vector3d::Constant(1e300), refMax = -refMin;
+    for(int i = 0; i < ref.getNPoints(); i++) {
+        Eigen::Vector4d p;
+        p << ref.getPoints()[i].position, 1;
+        Eigen::Vector3d q = (trans * p).head<3>();
+        assert((arrays.getPosition(i) - q).norm() <= 1e-12 * (1 + q.norm()));
+        refMin = refMin.cwiseMin(arrays.getPosition(i));
+        refMax = refMax.cwiseMax(arrays.getPosition(i));
+    }
+    assert(min == refMin && max == refMax);
+
+    PointArrays empty;
+    empty.boundingBox(min, max);
+    assert(min[0] > max[0]);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test14(int argc, char **argv)
+{
+    LOG_INFO("Camera to point index has every observation once, rows sorted by point");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 50;
+    std::string fname = "/tmp/test_bundler_io_csr.out";
+    writeScaledBundle(bundleFName, nCopies, fname.c_str());
+
+#ifdef _OPENMP
+    // More threads than cores so the ranges are split
+    omp_set_num_threads(4);
+#endif
+
+    for(int layout = 0; layout < 2; layout++) {
+        ReadOptions opts;
+        opts.pointLayout = layout ? POINTS_SOA : POINTS_AOS;
+        Reconstruction bundle;
+        bundle.readFile(fname.c_str(), opts);
+        assert(!bundle.cam2PointIndexBuilt());
+        {
+            TIMER(t, "build index");
+            bundle.buildCam2PointIndex();
+        }
+        assert(bundle.cam2PointIndexBuilt());
+
+        Reconstruction aos = bundle;
+        aos.setPointLayout(POINTS_AOS);
+        const Point::Vector &points = aos.getPoints();
+
+        std::vector<size_t> nSeen(bundle.getNCameras(), 0);
+        size_t nObservations = 0;
+        for(size_t i = 0; i < points.size(); i++) {
+            nObservations += points[i].viewList.size();
+            for(size_t j = 0; j < points[i].viewList.size(); j++) nSeen[points[i].viewList[j].camera]++;
+        }
+
+        size_t nEntries = 0;
+        for(int c = 0; c < bundle.getNCameras(); c++) {
+            ArrayView<PointVisListIdxs> row = bundle.getVisiblePoints(c);
+            assert(row.size() == nSeen[c]);
+            nEntries += row.size();
+            for(size_t k = 0; k < row.size(); k++) {
+                assert(points[row[k].pointIdx].viewList[row[k].visibilityListIdx].camera == c);
+                if(k) assert(row[k - 1].pointIdx < row[k].pointIdx);
+            }
+        }
+        assert(nEntries == nObservations);
+
+        // Reading again drops the index
+        bundle.readFile(fname.c_str(), opts, true);
+        assert(bundle.cam2PointIndexBuilt() && bundle.getVisiblePoints(0).size() == nSeen[0]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Compares a reconstruction loaded with CompactPointArrays to the full precision one
+static
+bool
+withinCompactTolerance(const Bundler::Reconstruction &ref, const Bundler::Reconstruction &compact)
+{
+    using namespace Bundler;
+
+    const CompactPointArrays &points = compact.getCompactPoints();
+    const double tol = CompactPointArrays::TOLERANCE;
+    if(ref.getNPoints() != int(points.size())) return false;
+
+    Point pnt;
+    for(int i = 0; i < ref.getNPoints(); i++) {
+        const Point &refPnt = ref.getPoints()[i];
+        points.getPoint(i, pnt);
+
+        for(int k = 0; k < 3; k++) {
+            double maxErr = tol * fabs(refPnt.position[k] - points.origin[k]) + 1e-15 * fabs(refPnt.position[k]);
+            if(fabs(pnt.position[k] - refPnt.position[k]) > maxErr) return false;
+        }
+        if(pnt.color.r != refPnt.color.r || pnt.color.g != refPnt.color.g || pnt.color.b != refPnt.color.b) return false;
+        if(pnt.viewList.size() != refPnt.viewList.size()) return false;
+
+        for(size_t j = 0; j < pnt.viewList.size(); j++) {
+            const ViewListEntry &a = pnt.viewList[j], &b = refPnt.viewList[j];
+            if(a.camera != b.camera || a.key != b.key) return false;
+            for(int k = 0; k < 2; k++) {
+                if(fabs(a.keyPosition[k] - b.keyPosition[k]) > tol * fabs(b.keyPosition[k])) return false;
+            }
+        }
+    }
+    return true;
+}
+
+int
+test15(int argc, char **argv)
+{
+    LOG_INFO("Compact points stay within the documented tolerance");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+    std::string textFName = "/tmp/test_bundler_io_compact.out";
+    std::string binFName = "/tmp/test_bundler_io_compact.bin";
+    writeScaledBundle(bundleFName, nCopies, textFName.c_str());
+
+    Reconstruction ref(textFName.c_str(), true);
+    ref.writeFile(binFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    ReadOptions opts;
+    opts.pointLayout = POINTS_COMPACT;
+    const char *fnames[] = {textFName.c_str(), binFName.c_str()};
+    for(int f = 0; f < 2; f++) {
+        Reconstruction compact;
+        compact.readFile(fnames[f], opts, true);
+        assert(compact.getPointLayout() == POINTS_COMPACT);
+        assert(!compact.getCompactPoints().wideCameras);
+        assert(withinCompactTolerance(ref, compact));
+
+        for(int c = 0; c < ref.getNCameras(); c++) assert(compact.getVisiblePoints(c).size() == ref.getVisiblePoints(c).size());
+
+        // Written files hold exactly the compact values, so they are
+        // within tolerance of the original
+        for(int format = 0; format < 2; format++) {
+            std::string outFName = "/tmp/test_bundler_io_compact_out";
+            compact.writeFile(outFName.c_str(), format ? Reconstruction::FORMAT_BINARY : Reconstruction::FORMAT_ASCII);
+            Reconstruction reread(outFName.c_str());
+            Reconstruction expanded = compact;
+            expanded.setPointLayout(POINTS_AOS);
+            assert(sameReconstruction(expanded, reread));
+        }
+    }
+
+    // Memory taken by the observations
+    Reconstruction compact;
+    compact.readFile(binFName.c_str(), opts);
+    const CompactPointArrays &points = compact.getCompactPoints();
+    size_t compactBytes = points.cameras16.size() * 2 + points.keys.size() * 4 + points.keyPositions.size() * 4;
+    LOG_INFO("Bytes per observation: " << double(compactBytes) / points.getNObservations() << " instead of " << sizeof(PackedViewListEntry));
+    assert(compactBytes == 14 * points.getNObservations());
+
+    // More cameras than fit in 16 bits
+    Camera::Vector cams(70000);
+    Point::Vector pnts(3);
+    for(int i = 0; i < 3; i++) {
+        pnts[i].position << i, 2 * i, 3 * i;
+        pnts[i].viewList.push_back(ViewListEntry(69999 - i, i, Eigen::Vector2d(0.5 * i, -0.25 * i)));
+    }
+    Reconstruction many(cams, pnts);
+    many.setPointLayout(POINTS_COMPACT);
+    assert(many.getCompactPoints().wideCameras);
+    many.setPointLayout(POINTS_AOS);
+    for(int i = 0; i < 3; i++) {
+        assert(many.getPoints()[i].viewList[0].camera == 69999 - i);
+        assert(many.getPoints()[i].position == pnts[i].position);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test16(int argc, char **argv)
+{
+    LOG_INFO("View lists are allocated from the arena of the reconstruction");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+    std::string textFName = "/tmp/test_bundler_io_arena.out";
+    std::string binFName = "/tmp/test_bundler_io_arena.bin";
+    writeScaledBundle(bundleFName, nCopies, textFName.c_str());
+
+    Reconstruction ref(textFName.c_str());
+    ref.writeFile(binFName.c_str(), Reconstruction::FORMAT_BINARY);
+
+    const char *fnames[] = {textFName.c_str(), binFName.c_str()};
+    for(int f = 0; f < 2; f++) {
+        for(int parser = 0; parser < 2; parser++) {
+            ReadOptions opts;
+            opts.parser = parser ? ReadOptions::PARSER_ISTREAM : ReadOptions::PARSER_BUFFER;
+            opts.nThreads = 4;
+
+            Reconstruction *bundle = new Reconstruction();
+            bundle->readFile(fnames[f], opts);
+            const Point::Vector &points = bundle->getPoints();
+            Arena::Ptr arena = points[0].viewList.get_allocator().getArena();
+            assert(arena);
+            for(size_t i = 0; i < points.size(); i++) assert(points[i].viewList.get_allocator().getArena() == arena);
+            assert(sameReconstruction(ref, *bundle));
+
+            // Copies keep the arena alive
+            Reconstruction copy = *bundle;
+            Point pnt = points[1];
+            {
+                TIMER(t, "Teardown");
+                delete bundle;
+            }
+            assert(sameReconstruction(ref, copy));
+            assert(pnt.viewList.size() == ref.getPoints()[1].viewList.size());
+            pnt.viewList.push_back(ViewListEntry(0));
+        }
+    }
+
+    // Conversion back from the other layouts
+    Reconstruction bundle(binFName.c_str());
+    bundle.setPointLayout(POINTS_SOA);
+    bundle.setPointLayout(POINTS_AOS);
+    assert(bundle.getPoints().back().viewList.get_allocator().getArena());
+    assert(sameReconstruction(ref, bundle));
+
+    // Points built by hand use the heap
+    Point pnt;
+    assert(!pnt.viewList.get_allocator().getArena());
+
+    // Concurrent allocations don't overlap
+    Arena arena(1 << 12);
+    const int nAllocs = 20000;
+    std::vector<uint32_t *> blocks(nAllocs);
+#pragma omp parallel for num_threads(4)
+    for(int i = 0; i < nAllocs; i++) {
+        size_t n = 1 + i % 300;
+        blocks[i] = (uint32_t *)arena.allocate(n * sizeof(uint32_t));
+        assert(size_t(blocks[i]) % Arena::ALIGNMENT == 0);
+        std::fill(blocks[i], blocks[i] + n, uint32_t(i));
+    }
+    for(int i = 0; i < nAllocs; i++) {
+        for(size_t j = 0, n = 1 + i % 300; j < n; j++) assert(blocks[i][j] == uint32_t(i));
+    }
+    LOG_INFO("Arena reserved " << arena.getNBytesReserved() << " bytes");
+
+    return EXIT_SUCCESS;
+}
+
+int
+test17(int argc, char **argv)
+{
+    LOG_INFO("Cameras and points are removed in place in every layout");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+    std::string fname = "/tmp/test_bundler_io_edit.out";
+    std::string listFName = "/tmp/test_bundler_io_edit.txt";
+    writeScaledBundle(bundleFName, nCopies, fname.c_str());
+
+#ifdef _OPENMP
+    omp_set_num_threads(4);
+#endif
+
+    Reconstruction ref(fname.c_str());
+    const int nCams = ref.getNCameras();
+    {
+        std::ofstream f(listFName.c_str());
+        for(int i = 0; i < nCams; i++) f << "img" << i << ".jpg 0 " << 10 * i << "\n";
+    }
+
+    // Cameras in reverse order, one in three removed
+    std::vector<int> table(nCams, -1);
+    std::vector<int> oldIdxs;
+    for(int i = nCams - 1; i >= 0; i--) {
+        if(i % 3 == 1) continue;
+        table[i] = oldIdxs.size();
+        oldIdxs.push_back(i);
+    }
+
+    // Same edit done by hand, points left with fewer than two cameras
+    // and one in five of the others are removed
+    Camera::Vector expCams;
+    for(size_t i = 0; i < oldIdxs.size(); i++) expCams.push_back(ref.getCameras()[oldIdxs[i]]);
+    Point::Vector expPoints;
+    std::vector<bool> rmPoints(ref.getNPoints(), false);
+    for(int i = 0; i < ref.getNPoints(); i++) {
+        Point pnt = ref.getPoints()[i];
+        pnt.viewList.clear();
+        for(size_t j = 0; j < ref.getPoints()[i].viewList.size(); j++) {
+            ViewListEntry entry = ref.getPoints()[i].viewList[j];
+            if(table[entry.camera] < 0) continue;
+            entry.camera = table[entry.camera];
+            pnt.viewList.push_back(entry);
+        }
+        rmPoints[i] = pnt.viewList.size() < 2 || i % 5 == 0;
+        if(!rmPoints[i]) expPoints.push_back(pnt);
+    }
+    Reconstruction expected(expCams, expPoints);
+
+    for(int layout = 0; layout < 3; layout++) {
+        ReadOptions opts;
+        opts.pointLayout = PointLayout(layout);
+        Reconstruction bundle;
+        bundle.readFile(fname.c_str(), opts, true);
+        bundle.readListFile(listFName.c_str());
+
+        {
+            TIMER(t, "remap cameras");
+            bundle.remapCameras(table);
+        }
+        {
+            TIMER(t, "remove points");
+            if(layout == POINTS_AOS) {
+                const Point::Vector &points = bundle.getPoints();
+                bundle.removePoints([&](int i) { return points[i].viewList.size() < 2 || i % 5 == 0; });
+            } else {
+                bundle.removePoints(rmPoints);
+            }
+        }
+        assert(bundle.getPointLayout() == layout);
+
+        if(layout == POINTS_COMPACT) assert(withinCompactTolerance(expected, bundle));
+        Reconstruction aos = bundle;
+        aos.setPointLayout(POINTS_AOS);
+        if(layout != POINTS_COMPACT) assert(sameReconstruction(expected, aos));
+
+        // List file and index follow the cameras
+        assert(int(bundle.getImageList().size()) == bundle.getNCameras());
+        for(int c = 0; c < bundle.getNCameras(); c++) {
+            std::stringstream name;
+            name << "img" << oldIdxs[c] << ".jpg";
+            assert(bundle.getImageFileName(c) == name.str());
+            assert(bundle.getImageList().getFocal(c) == 10 * oldIdxs[c]);
+        }
+
+        assert(bundle.cam2PointIndexBuilt());
+        size_t nEntries = 0, nObservations = 0;
+        for(int i = 0; i < aos.getNPoints(); i++) nObservations += aos.getPoints()[i].viewList.size();
+        for(int c = 0; c < bundle.getNCameras(); c++) {
+            ArrayView<PointVisListIdxs> row = bundle.getVisiblePoints(c);
+            nEntries += row.size();
+            for(size_t k = 0; k < row.size(); k++) {
+                assert(aos.getPoints()[row[k].pointIdx].viewList[row[k].visibilityListIdx].camera == c);
+            }
+        }
+        assert(nEntries == nObservations);
+    }
+
+    // Bad tables
+    Reconstruction bundle(fname.c_str());
+    std::vector<int> bad(nCams, 0);
+    bool thrown = false;
+    try {
+        bundle.remapCameras(bad);
+    } catch(sfmf::Error &e) {
+        thrown = true;
+    }
+    assert(thrown && bundle.getNCameras() == nCams);
+
+    // Removing cameras by mask keeps the order
+    std::vector<bool> rmCams(nCams, false);
+    rmCams[0] = rmCams[nCams - 1] = true;
+    bundle.removeCameras(rmCams);
+    assert(bundle.getNCameras() == nCams - 2);
+    assert(bundle.getCameras()[0].focalLength == ref.getCameras()[1].focalLength);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test18(int argc, char **argv)
+{
+    LOG_INFO("Counts and indexes go past 2^31");
+    using namespace Bundler;
+
+    // More points than fit in an int, the file is sparse (only the
+    // header and the last points are written) and mapped
+    {
+        const int64_t nPoints = (int64_t(1) << 31) + 8;
+        const int nLast = 8;
+        BinaryHeader header;
+        header.nCameras = 2;
+        header.nPoints = nPoints;
+        header.nObservations = nPoints + 2; // Last point has three observations
+        BinaryLayout layout(header);
+
+        std::string fname = "/tmp/test_bundler_io_sparse.bin";
+        {
+            std::ofstream f(fname.c_str(), std::ios::binary | std::ios::trunc);
+            f.write((const char *)&header, sizeof(header));
+            double cams[2 * 15] = {0};
+            cams[0] = cams[15] = 500;
+            for(int c = 0; c < 2; c++) cams[c * 15 + 3] = cams[c * 15 + 7] = cams[c * 15 + 11] = 1;
+            f.write((const char *)cams, sizeof(cams));
+
+            for(int64_t i = nPoints - nLast; i < nPoints; i++) {
+                double pos[3] = {double(i), 1, 2};
+                f.seekp(layout.positions + i * sizeof(pos));
+                f.write((const char *)pos, sizeof(pos));
+                uint8_t color[3] = {1, 2, uint8_t(i)};
+                f.seekp(layout.colors + i * sizeof(color));
+                f.write((const char *)color, sizeof(color));
+            }
+            for(int64_t i = nPoints - nLast; i <= nPoints; i++) {
+                uint64_t offset = (i == nPoints) ? header.nObservations : i;
+                f.seekp(layout.offsets + i * sizeof(uint64_t));
+                f.write((const char *)&offset, sizeof(offset));
+            }
+            for(uint64_t j = nPoints - nLast; j < header.nObservations; j++) {
+                BinaryObservation obs;
+                obs.camera = j % 2;
+                obs.key = int32_t(j % 1000);
+                obs.keyPosition[0] = obs.keyPosition[1] = 0.5;
+                f.seekp(layout.observations + j * sizeof(obs));
+                f.write((const char *)&obs, sizeof(obs));
+            }
+            assert(uint64_t(f.tellp()) == layout.fileSize);
+            assert(f.good());
+        }
+
+        ReconstructionView view(fname.c_str());
+        assert(int64_t(view.getNPoints()) == nPoints);
+        assert(view.getNObservations() == header.nObservations);
+        Point pnt;
+        view.getPoint(nPoints - 1, pnt);
+        assert(pnt.position[0] == double(nPoints - 1) && pnt.color.b == uint8_t(nPoints - 1));
+        assert(pnt.viewList.size() == 3);
+        assert(pnt.viewList[2].camera == int((header.nObservations - 1) % 2));
+        assert(pnt.viewList[2].key == int((header.nObservations - 1) % 1000));
+
+        StreamReader reader(fname.c_str());
+        assert(reader.getNPoints() == nPoints);
+
+        Reconstruction cameras;
+        ReadOptions opts;
+        opts.camerasOnly = true;
+        cameras.readFile(fname.c_str(), opts);
+        assert(cameras.getNCameras() == 2 && cameras.getNPointsInFile() == nPoints);
+
+        unlink(fname.c_str());
+    }
+
+    // More observations than fit in an int in memory (compact layout),
+    // only if there is enough memory. Pass a smaller number of
+    // observations to try the same code on a small model.
+    const int nCams = 8;
+    uint64_t nObservations = argc > 1 ? strtoull(argv[1], NULL, 10) : (uint64_t(1) << 31) + (1 << 20);
+    const int64_t nPoints = nObservations / nCams;
+    nObservations = nPoints * nCams;
+    const uint64_t needed = nObservations * (14 + sizeof(PointVisListIdxs)) * 2 + nPoints * 32;
+    const uint64_t available = uint64_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+    if(needed > available) {
+        LOG_WARN("Skipping in memory test, needs " << (needed >> 30) << " GB (" << (available >> 30) << " GB available)");
+        return EXIT_SUCCESS;
+    }
+
+    Reconstruction bundle((Camera::Vector(nCams)), Point::Vector());
+    {
+        TIMER(t, "build model");
+        CompactPointArrays &points = bundle.getCompactPoints();
+        points.positions.assign(3 * nPoints, 0.0f);
+        points.colors.assign(3 * nPoints, 0);
+        points.offsets.resize(nPoints + 1);
+        points.cameras16.resize(nObservations);
+        points.keys.resize(nObservations);
+        points.keyPositions.assign(2 * nObservations, 0.0f);
+#pragma omp parallel for schedule(static)
+        for(long long i = 0; i <= nPoints; i++) points.offsets[i] = uint64_t(i) * nCams;
+#pragma omp parallel for schedule(static)
+        for(long long j = 0; j < (long long)nObservations; j++) {
+            points.cameras16[j] = j % nCams;
+            points.keys[j] = int32_t(j / nCams);
+        }
+    }
+    assert(bundle.getNPoints() == nPoints);
+
+    {
+        TIMER(t, "build index");
+        bundle.buildCam2PointIndex();
+    }
+    for(int c = 0; c < nCams; c++) {
+        ArrayView<PointVisListIdxs> row = bundle.getVisiblePoints(c);
+        assert(int64_t(row.size()) == nPoints);
+        assert(row[row.size() - 1].pointIdx == nPoints - 1 && row[row.size() - 1].visibilityListIdx == c);
+    }
+
+    {
+        TIMER(t, "remove camera");
+        std::vector<bool> rmCams(nCams, false);
+        rmCams[0] = true;
+        bundle.removeCameras(rmCams);
+    }
+    const CompactPointArrays &points = bundle.getCompactPoints();
+    assert(points.getNObservations() == uint64_t(nPoints) * (nCams - 1));
+    assert(points.offsets[nPoints - 1] == uint64_t(nPoints - 1) * (nCams - 1));
+    assert(points.getCamera(points.getNObservations() - 1) == nCams - 2);
+    assert(points.keys[points.getNObservations() - 1] == int32_t(nPoints - 1));
+    assert(bundle.getVisiblePoints(nCams - 2)[nPoints - 1].pointIdx == nPoints - 1);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test19(int argc, char **argv)
+{
+    LOG_INFO("Points are reordered along a space filling curve in every layout");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+    std::string fname = "/tmp/test_bundler_io_reorder.out";
+
+    // Copies are shifted so they do not all fall in the same cells
+    {
+        Reconstruction bundle(bundleFName);
+        Point::Vector points;
+        for(int i = 0; i < nCopies; i++) {
+            for(int j = 0; j < bundle.getNPoints(); j++) {
+                points.push_back(bundle.getPoints()[j]);
+                points.back().position += Eigen::Vector3d(0.37 * i, -0.11 * i, 0.05 * (i % 7));
+            }
+        }
+        Reconstruction(bundle.getCameras(), points).writeFile(fname.c_str());
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(4);
+#endif
+
+    std::vector<int64_t> aosTable;
+    for(int curve = CURVE_MORTON; curve <= CURVE_HILBERT; curve++) {
+        for(int layout = 0; layout < 3; layout++) {
+            ReadOptions opts;
+            opts.pointLayout = PointLayout(layout);
+            Reconstruction bundle;
+            bundle.readFile(fname.c_str(), opts, true);
+            Reconstruction orig = bundle;
+
+            std::vector<int64_t> table;
+            {
+                TIMER(t, "reorder");
+                table = bundle.reorderSpatially(SpaceFillingCurve(curve));
+            }
+            assert(bundle.getPointLayout() == layout);
+            assert(int64_t(table.size()) == orig.getNPoints());
+
+            // Every point moved as a whole to where the table says
+            orig.setPointLayout(POINTS_AOS);
+            Reconstruction aos = bundle;
+            aos.setPointLayout(POINTS_AOS);
+            std::vector<bool> seen(table.size(), false);
+            for(int64_t i = 0; i < orig.getNPoints(); i++) {
+                assert(!seen[table[i]]);
+                seen[table[i]] = true;
+                const Point &a = orig.getPoints()[i], &b = aos.getPoints()[table[i]];
+                assert(a.position == b.position && a.color.r == b.color.r && a.color.g == b.color.g && a.color.b == b.color.b);
+                assert(a.viewList.size() == b.viewList.size());
+                for(size_t j = 0; j < a.viewList.size(); j++) {
+                    assert(a.viewList[j].camera == b.viewList[j].camera && a.viewList[j].key == b.viewList[j].key);
+                    assert(a.viewList[j].keyPosition == b.viewList[j].keyPosition);
+                }
+            }
+
+            if(layout == POINTS_AOS) aosTable = table;
+            if(layout == POINTS_SOA) assert(table == aosTable);
+
+            // Index was rebuilt
+            assert(bundle.cam2PointIndexBuilt());
+            for(int c = 0; c < bundle.getNCameras(); c++) {
+                ArrayView<PointVisListIdxs> row = bundle.getVisiblePoints(c);
+                for(size_t k = 0; k < row.size(); k++) {
+                    assert(aos.getPoints()[row[k].pointIdx].viewList[row[k].visibilityListIdx].camera == c);
+                }
+            }
+
+            // Points already in order stay where they are
+            table = bundle.reorderSpatially(SpaceFillingCurve(curve));
+            for(size_t i = 0; i < table.size(); i++) assert(table[i] == int64_t(i));
+        }
+    }
+
+    unlink(fname.c_str());
+    return EXIT_SUCCESS;
+}
+
+// Scans that follow spatial neighbourhoods instead of the order of the
+// points, run by test20 before and after reordering
+static
+double
+sumVisiblePositions(const Bundler::Reconstruction &bundle)
+{
+    const Bundler::PointArrays &points = bundle.getPointArrays();
+    double sum = 0;
+    for(int c = 0; c < bundle.getNCameras(); c++) {
+        Bundler::ArrayView<Bundler::PointVisListIdxs> row = bundle.getVisiblePoints(c);
+        for(size_t k = 0; k < row.size(); k++) {
+            const double *p = &points.positions[3 * row[k].pointIdx];
+            sum += p[0] + p[1] + p[2];
+        }
+    }
+    return sum;
+}
+
+static
+uint64_t
+exportTiles(const Bundler::Reconstruction &bundle, int nTilesPerAxis)
+{
+    const Bundler::PointArrays &points = bundle.getPointArrays();
+    const size_t nPoints = points.size();
+    Eigen::Vector3d min, max;
+    points.boundingBox(min, max);
+    const Eigen::Vector3d scale = Eigen::Vector3d::Constant(nTilesPerAxis * 0.999999).cwiseQuotient(max - min);
+
+    // Points of each tile, then every tile is copied out with its view lists
+    const int nTiles = nTilesPerAxis * nTilesPerAxis * nTilesPerAxis;
+    std::vector<uint64_t> offsets(nTiles + 1, 0);
+    std::vector<int> tileOf(nPoints);
+    for(size_t i = 0; i < nPoints; i++) {
+        Eigen::Vector3d t = (points.getPosition(i) - min).cwiseProduct(scale);
+        tileOf[i] = (int(t[2]) * nTilesPerAxis + int(t[1])) * nTilesPerAxis + int(t[0]);
+        offsets[tileOf[i] + 1]++;
+    }
+    for(int t = 0; t < nTiles; t++) offsets[t + 1] += offsets[t];
+    std::vector<int64_t> tilePoints(nPoints);
+    for(size_t i = 0; i < nPoints; i++) tilePoints[offsets[tileOf[i]]++] = i;
+
+    uint64_t checksum = 0;
+    Bundler::PointArrays tile;
+    Bundler::Point pnt;
+    for(size_t i = 0; i < nPoints;) {
+        tile.clear();
+        const int t = tileOf[tilePoints[i]];
+        for(; i < nPoints && tileOf[tilePoints[i]] == t; i++) {
+            points.getPoint(tilePoints[i], pnt);
+            tile.push_back(pnt);
+        }
+        checksum += tile.getNObservations();
+    }
+    return checksum;
+}
+
+int
+test20(int argc, char **argv)
+{
+    LOG_INFO("Benchmark scans over neighbourhoods before and after reordering the points");
+    using namespace Bundler;
+
+    // Points scattered in space as they come out of the solver, each
+    // camera sees the points inside a sphere
+    const int64_t nPoints = argc > 1 ? atoll(argv[1]) : 2000000;
+    const int nCams = 64;
+    srand(42);
+    std::vector<Eigen::Vector3d> centers(nCams);
+    for(int c = 0; c < nCams; c++) centers[c] = Eigen::Vector3d::Random();
+
+    Reconstruction bundle((Camera::Vector(nCams)), Point::Vector());
+    PointArrays &points = bundle.getPointArrays();
+    points.reserve(nPoints, nPoints * 4);
+    Point pnt;
+    while(int64_t(points.size()) < nPoints) {
+        pnt.position = Eigen::Vector3d::Random();
+        pnt.viewList.clear();
+        for(int c = 0; c < nCams; c++) {
+            if((pnt.position - centers[c]).norm() > 0.5) continue;
+            ViewListEntry entry;
+            entry.camera = c;
+            entry.key = points.size();
+            entry.keyPosition = Eigen::Vector2d(pnt.position[0], pnt.position[1]);
+            pnt.viewList.push_back(entry);
+        }
+        if(pnt.viewList.size() >= 2) points.push_back(pnt);
+    }
+    LOG_EXPR(points.getNObservations());
+
+    bundle.buildCam2PointIndex();
+    Reconstruction morton = bundle, hilbert = bundle;
+    {
+        TIMER(t, "morton reorder");
+        morton.reorderSpatially(CURVE_MORTON);
+    }
+    {
+        TIMER(t, "hilbert reorder");
+        hilbert.reorderSpatially(CURVE_HILBERT);
+    }
+
+    const char *names[3] = {"solver order", "morton order", "hilbert order"};
+    const Reconstruction *bundles[3] = {&bundle, &morton, &hilbert};
+    double sums[3];
+    uint64_t checksums[3];
+    for(int k = 0; k < 3; k++) {
+        std::string msg = std::string("camera gather, ") + names[k];
+        {
+            TIMER(t, msg.c_str());
+            sums[k] = sumVisiblePositions(*bundles[k]);
+        }
+        msg = std::string("tile export, ") + names[k];
+        {
+            TIMER(t, msg.c_str());
+            checksums[k] = exportTiles(*bundles[k], 16);
+        }
+    }
+    for(int k = 1; k < 3; k++) {
+        assert(fabs(sums[k] - sums[0]) <= 1e-9 * fabs(sums[0]) + 1e-6);
+        assert(checksums[k] == checksums[0]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test21(int argc, char **argv)
+{
+    LOG_INFO("Visibility of all points in all cameras");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    int nCopies = argc > 1 ? atoi(argv[1]) : 20;
+
+    // List with absolute image paths, images are next to the list file
+    // in the parent directory of the bundle file
+    std::string dataDir = boost::filesystem::absolute(bundleFName).parent_path().parent_path().string();
+    std::string listFName = "/tmp/test_bundler_io_vis.txt";
+    {
+        ListFile list((dataDir + "/list.txt").c_str());
+        std::ofstream f(listFName.c_str());
+        for(size_t i = 0; i < list.size(); i++) f << dataDir << "/" << list.getFileName(i) << "\n";
+    }
+
+    // Shifted copies of the points, cameras see only some of them
+    Reconstruction orig(bundleFName);
+    Point::Vector points;
+    for(int i = 0; i < nCopies; i++) {
+        for(int j = 0; j < orig.getNPoints(); j++) {
+            points.push_back(orig.getPoints()[j]);
+            points.back().position += Eigen::Vector3d(0.2 * (i % 5), 0.1 * (i / 5), 0.05 * i);
+        }
+    }
+    Reconstruction bundle(orig.getCameras(), points);
+    bundle.readListFile(listFName.c_str());
+
+    const int nCams = bundle.getNCameras();
+    std::vector<Eigen::Vector2i> sizes(nCams);
+    for(int c = 0; c < nCams; c++) bundle.getImageSizeForCamera(c, sizes[c][0], sizes[c][1], true);
+
+    Visibility expected;
+    {
+        TIMER(t, "world2im for every pair");
+        for(int c = 0; c < nCams; c++) {
+            const Camera &cam = bundle.getCameras()[c];
+            for(int64_t i = 0; cam.isValid() && i < bundle.getNPoints(); i++) {
+                Eigen::Vector2d im;
+                if(cam.world2im(bundle.getPoints()[i].position, im, true, sizes[c][0], sizes[c][1])) expected.points.push_back(i);
+            }
+            expected.offsets.push_back(expected.points.size());
+        }
+    }
+    LOG_EXPR(expected.size());
+
+#ifdef _OPENMP
+    omp_set_num_threads(4);
+#endif
+
+    for(int layout = 0; layout < 3; layout++) {
+        bundle.setPointLayout(PointLayout(layout));
+        for(int blockSize = 1; blockSize <= 4096; blockSize *= 64) {
+            VisibilityOptions opts;
+            opts.blockSize = blockSize;
+            Visibility vis;
+            {
+                std::stringstream msg;
+                msg << "layout " << layout << ", blocks of " << blockSize;
+                TIMER(t, msg.str().c_str());
+                bundle.computeVisibility(vis, opts);
+            }
+
+            // Compact positions are rounded, a few points near the borders can differ
+            assert(vis.getNCameras() == nCams);
+            if(layout == POINTS_COMPACT) {
+                assert(std::abs(double(vis.size()) - double(expected.size())) <= 1e-3 * expected.size());
+            } else {
+                assert(vis.offsets == expected.offsets && vis.points == expected.points);
+            }
+        }
+    }
+
+    // Sizes given explicitly, without the list file
+    bundle.setPointLayout(POINTS_SOA);
+    Reconstruction noList(bundle.getCameras(), points);
+    VisibilityOptions opts;
+    opts.imageSizes = sizes;
+    Visibility vis;
+    noList.computeVisibility(vis, opts);
+    assert(vis.offsets == expected.offsets && vis.points == expected.points);
+
+    // Unknown sizes, everything in front of the cameras
+    noList.computeVisibility(vis);
+    for(int c = 0; c < nCams; c++) {
+        const Camera &cam = noList.getCameras()[c];
+        int64_t nInFront = 0;
+        for(int64_t i = 0; cam.isValid() && i < noList.getNPoints(); i++) {
+            Eigen::Vector3d pc;
+            cam.world2cam(noList.getPoints()[i].position, pc);
+            nInFront += pc[2] < 0;
+        }
+        assert(int64_t(vis.getVisiblePoints(c).size()) == nInFront);
+    }
+
+    // Culling pays off when neighbouring points are close in space
+    bundle.reorderSpatially();
+    {
+        TIMER(t, "visibility after spatial reordering");
+        bundle.computeVisibility(vis);
+    }
+    assert(vis.size() == expected.size());
+
+    unlink(listFName.c_str());
+    return EXIT_SUCCESS;
+}
+
+// Equal, NaN where the other one is NaN (directions of cameras that were
+// not reconstructed)
+static
+bool
+sameVector(const Eigen::Vector3d &a, const Eigen::Vector3d &b)
+{
+    for(int i = 0; i < 3; i++) {
+        if(a[i] != b[i] && !(std::isnan(a[i]) && std::isnan(b[i]))) return false;
+    }
+    return true;
+}
+
+// The cache holds what the accessors compute without it
+static
+bool
+freshCache(const Bundler::Camera &cam)
+{
+    Bundler::Camera onDemand = cam;
+    onDemand.cache = Bundler::CameraCache();
+
+    Eigen::Vector3d center, up, dir;
+    onDemand.center(center);
+    onDemand.up(up);
+    onDemand.lookingAt(dir);
+    return cam.cache.initialized && cam.cache.valid == onDemand.isValid() &&
+           sameVector(cam.cache.center, center) && sameVector(cam.cache.up, up) && sameVector(cam.cache.direction, dir);
+}
+
+int
+test22(int /*argc*/, char **argv)
+{
+    LOG_INFO("Camera caches after loading and transforming a reconstruction");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    Reconstruction orig(bundleFName);
+    for(int c = 0; c < orig.getNCameras(); c++) assert(freshCache(orig.getCameras()[c]));
+    int nValid = 0;
+    for(int c = 0; c < orig.getNCameras(); c++) nValid += orig.getCameras()[c].isValid();
+    assert(nValid == orig.getNValidCameras());
+
+    // Text and binary streams, and the mapped view
+    std::string binaryFName = "/tmp/test_bundler_io_cache.bin";
+    orig.writeFile(binaryFName.c_str(), Reconstruction::FORMAT_BINARY);
+    const char *inputs[] = {bundleFName, binaryFName.c_str()};
+    for(int i = 0; i < 2; i++) {
+        StreamReader reader(inputs[i]);
+        for(int c = 0; c < reader.getNCameras(); c++) assert(freshCache(reader.getCameras()[c]));
+    }
+    {
+        ReconstructionView view(binaryFName.c_str());
+        for(size_t c = 0; c < view.getNCameras(); c++) assert(freshCache(view.getCamera(c)));
+    }
+    unlink(binaryFName.c_str());
+
+    Eigen::Matrix4d trans = Eigen::Matrix4d::Identity();
+    trans.block<3, 3>(0, 0) = 0.5 * Eigen::AngleAxisd(1.2, Eigen::Vector3d(0, 1, 1).normalized()).toRotationMatrix();
+    trans.block<3, 1>(0, 3) = Eigen::Vector3d(10, 0, -5);
+
+    for(int layout = 0; layout < 3; layout++) {
+        Reconstruction bundle(bundleFName);
+        bundle.setPointLayout(PointLayout(layout));
+        bundle.transform(trans);
+        bundle.setPointLayout(POINTS_AOS);
+        assert(bundle.getNPoints() == orig.getNPoints());
+
+        for(int c = 0; c < bundle.getNCameras(); c++) {
+            const Camera &cam = bundle.getCameras()[c], &camOrig = orig.getCameras()[c];
+            assert(freshCache(cam));
+            assert(cam.isValid() == camOrig.isValid());
+            if(!cam.isValid()) continue;
+
+            // Same observations, compact positions are stored as floats
+            for(int i = 0; i < bundle.getNPoints(); i++) {
+                Eigen::Vector2d im, imOrig;
+                cam.world2im(bundle.getPoints()[i].position, im);
+                camOrig.world2im(orig.getPoints()[i].position, imOrig);
+                assert((im - imOrig).norm() < (layout == POINTS_COMPACT ? 1e-2 : 1e-6));
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test23(int /*argc*/, char **argv)
+{
+    LOG_INFO("Reprojection errors of every observation");
+    using namespace Bundler;
+
+    const char *bundleFName = argv[0];
+    Reconstruction bundle(bundleFName, true);
+    const Point::Vector &points = bundle.getPoints();
+
+    // Errors one by one with world2im, keys are centered on the image
+    std::vector<double> expected;
+    for(size_t i = 0; i < points.size(); i++) {
+        for(size_t j = 0; j < points[i].viewList.size(); j++) {
+            const ViewListEntry &obs = points[i].viewList[j];
+            Eigen::Vector2d im;
+            bool inFront = bundle.getCameras()[obs.camera].world2im(points[i].position, im, true);
+            expected.push_back(inFront ? (im - obs.keyPosition).norm() : std::numeric_limits<double>::infinity());
+        }
+    }
+
+    ReprojectionErrors errors;
+    for(int layout = 0; layout < 3; layout++) {
+        bundle.setPointLayout(PointLayout(layout));
+        bundle.computeReprojectionErrors(errors);
+        assert(errors.size() == expected.size());
+        assert(int64_t(errors.points.size()) == bundle.getNPoints());
+        assert(int(errors.cameras.size()) == bundle.getNCameras());
+
+        // Compact positions and keys are floats
+        const double tol = layout == POINTS_COMPACT ? 1e-2 : 1e-9;
+        for(size_t i = 0; i < expected.size(); i++) {
+            assert(errors.errors[i] == expected[i] || fabs(errors.errors[i] - expected[i]) < tol);
+        }
+
+        // Summaries add up
+        uint64_t nObs = 0, nCamObs = 0;
+        double sum = 0;
+        for(size_t i = 0; i < errors.points.size(); i++) {
+            const ReprojectionErrors::Summary &s = errors.points[i];
+            ArrayView<double> pntErrors = errors.getErrors(i);
+            assert(s.nObservations + s.nBehind == pntErrors.size());
+            assert(s.max == *std::max_element(pntErrors.begin(), pntErrors.end()));
+            nObs += s.nObservations;
+            sum += s.mean * s.nObservations;
+        }
+        for(size_t c = 0; c < errors.cameras.size(); c++) nCamObs += errors.cameras[c].nObservations;
+        assert(nObs == errors.total.nObservations && nCamObs == nObs);
+        assert(fabs(sum / nObs - errors.total.mean) < 1e-9 * errors.total.mean);
+    }
+    LOG_EXPR(errors.total.nObservations);
+    LOG_EXPR(errors.total.nBehind);
+    LOG_EXPR(errors.total.mean);
+    LOG_EXPR(errors.total.rms);
+    LOG_EXPR(errors.total.max);
+    // The solution Bundler found agrees with its own keys
+    assert(errors.total.rms < 2.0);
+
+    // Observations above the median are removed in every layout
+    std::vector<double> sorted = expected;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    const double threshold = sorted[sorted.size() / 2];
+    std::vector<bool> remove(expected.size());
+    size_t nKept = 0;
+    for(size_t i = 0; i < expected.size(); i++) {
+        remove[i] = expected[i] > threshold;
+        nKept += !remove[i];
+    }
+    for(int layout = 0; layout < 3; layout++) {
+        Reconstruction filtered(bundleFName, true);
+        filtered.setPointLayout(PointLayout(layout));
+        filtered.removeObservations(remove);
+        filtered.computeReprojectionErrors(errors);
+        assert(errors.size() == nKept);
+        assert(errors.total.max <= threshold + (layout == POINTS_COMPACT ? 1e-2 : 0.0));
+
+        uint64_t nIndexed = 0;
+        for(int c = 0; c < filtered.getNCameras(); c++) nIndexed += filtered.getVisiblePoints(c).size();
+        assert(nIndexed == nKept);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test24(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("Integers cover the whole int64 range, with or without leading zeros");
+
+    const char text[] = "9223372036854775807 -9223372036854775808 0000000000000000000000042 -007 "
+                        "9223372036854775808 -9223372036854775809 99999999999999999999";
+    TextScanner in(text, text + sizeof(text) - 1);
+    long long v;
+    assert(in.readInt64(v) && v == LLONG_MAX);
+    assert(in.readInt64(v) && v == LLONG_MIN);
+    assert(in.readInt64(v) && v == 42);
+    int i;
+    assert(in.readInt(i) && i == -7);
+
+    // Out of range values fail, the tokens are skipped by hand
+    for(int j = 0; j < 3; j++) {
+        assert(!in.readInt64(v));
+        const char *next = strchr(in.position(), ' ');
+        in.seek(next ? next : text + sizeof(text) - 1);
+    }
+    assert(in.atEnd());
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+    cmdc::Logger::setLogLevels(cmdc::LOGLEVEL_DEBUG);
+
+    if(argc < 3) {
+        std::cout << "Usage:\n\t" << argv[0] << " <in: testNum> <in: bundle.out> [<in: nCopies>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int testNum = atoi(argv[1]);
+    switch(testNum) {
+    case 1:
+        return test1(argc - 2, &argv[2]);
+        break;
+    case 2:
+        return test2(argc - 2, &argv[2]);
+        break;
+    case 3:
+        return test3(argc - 2, &argv[2]);
+        break;
+    case 4:
+        return test4(argc - 2, &argv[2]);
+        break;
+    case 5:
+        return test5(argc - 2, &argv[2]);
+        break;
+    case 6:
+        return test6(argc - 2, &argv[2]);
+        break;
+    case 7:
+        return test7(argc - 2, &argv[2]);
+        break;
+    case 8:
+        return test8(argc - 2, &argv[2]);
+        break;
+    case 9:
+        return test9(argc - 2, &argv[2]);
+        break;
+    case 10:
+        return test10(argc - 2, &argv[2]);
+        break;
+    case 11:
+        return test11(argc - 2, &argv[2]);
+        break;
+    case 12:
+        return test12(argc - 2, &argv[2]);
+        break;
+    case 13:
+        return test13(argc - 2, &argv[2]);
+        break;
+    case 14:
+        return test14(argc - 2, &argv[2]);
+        break;
+    case 15:
+        return test15(argc - 2, &argv[2]);
+        break;
+    case 16:
+        return test16(argc - 2, &argv[2]);
+        break;
+    case 17:
+        return test17(argc - 2, &argv[2]);
+        break;
+    case 18:
+        return test18(argc - 2, &argv[2]);
+        break;
+    case 19:
+        return test19(argc - 2, &argv[2]);
+        break;
+    case 20:
+        return test20(argc - 2, &argv[2]);
+        break;
+    case 21:
+        return test21(argc - 2, &argv[2]);
+        break;
+    case 22:
+        return test22(argc - 2, &argv[2]);
+        break;
+    case 23:
+        return test23(argc - 2, &argv[2]);
+        break;
+    case 24:
+        return test24(argc - 2, &argv[2]);
+        break;
+    default:
+        LOG_WARN("No test " << testNum);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -6,7 +6,7 @@ using namespace sfmf;
 #include "../io.hpp"
 
 int
-test1(int argc, char **argv)
+test1(int /*argc*/, char **argv)
 {
     std::string siftFName = argv[0];
     LOG_INFO("Will load descriptors from file " << siftFName);
@@ -5,7 +5,7 @@ using namespace sfmf;
 #include "../io.hpp"
 
 int
-test1(int argc, char **argv)
+test1(int /*argc*/, char ** /*argv*/)
 {
     CompressedFileReader f("/tmp/bla.gz");
     int x, y, z;
@@ -13,6 +13,383 @@ test1(int argc, char **argv)
     LOG_EXPR(x);
     LOG_EXPR(y);
     LOG_EXPR(z);
+
+    return EXIT_SUCCESS;
+}
+
+int
+test2(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("Multi-member gzip output reads back through CompressedFileReader");
+
+    // Small blocks so there are many members, more than one batch of them
+    std::string fname = "/tmp/test_io_members.gz";
+    std::stringstream expected;
+    {
+        CompressedFileWriter f(fname.c_str(), 3, 6, 1000);
+        for(int i = 0; i < 100000; i++) {
+            f << i << " " << i * 0.5 << "\n";
+            expected << i << " " << i * 0.5 << "\n";
+        }
+        f.close();
+    }
+
+    std::vector<char> buffer;
+    readFileIntoBuffer(fname.c_str(), buffer);
+    assert(std::string(buffer.begin(), buffer.end()) == expected.str());
+
+    // Empty file is still valid gzip
+    {
+        CompressedFileWriter f(fname.c_str());
+    }
+    readFileIntoBuffer(fname.c_str(), buffer);
+    assert(buffer.empty());
+
+    return EXIT_SUCCESS;
+}
+
+int
+test3(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("Gzip index gives random access and parallel decompression");
+
+    std::string expected;
+    for(int i = 0; i < 300000; i++) {
+        std::stringstream line;
+        line << i << " " << (i * 7919LL) % 1000 << " " << i * 0.25 << "\n";
+        expected += line.str();
+    }
+
+    // Single member and many members
+    size_t blockSizes[] = {1 << 24, 100000};
+    for(int b = 0; b < 2; b++) {
+        std::string fname = "/tmp/test_io_index.gz";
+        {
+            CompressedFileWriter f(fname.c_str(), 0, 6, blockSizes[b]);
+            f << expected;
+        }
+
+        InputFile::Ptr file = InputFile::open(fname.c_str());
+        GzipIndex index;
+        std::vector<char> content;
+        index.build(file, 50000, &content);
+        LOG_EXPR(index.getNCheckpoints());
+        assert(index.getNCheckpoints() > 10);
+        assert(index.getUncompressedSize() == expected.size());
+        assert(std::string(content.begin(), content.end()) == expected);
+
+        // Reads starting before, at and after checkpoints
+        for(size_t i = 0; i < index.getNCheckpoints(); i++) {
+            uint64_t offsets[] = {index.getCheckpointOffset(i), index.getCheckpointOffset(i) + 1, index.getCheckpointOffset(i) + 9999};
+            for(int j = 0; j < 3; j++) {
+                char buffer[40000];
+                size_t n = index.read(file, offsets[j], buffer, sizeof(buffer));
+                if(offsets[j] >= expected.size()) {
+                    assert(n == 0);
+                    continue;
+                }
+                assert(n == std::min(sizeof(buffer), expected.size() - offsets[j]));
+                assert(expected.compare(offsets[j], n, buffer, n) == 0);
+            }
+        }
+
+        // Saved index, parallel decompression
+        std::string indexFName = GzipIndex::indexFileName(fname.c_str());
+        index.writeFile(indexFName.c_str());
+        GzipIndex loaded;
+        loaded.readFile(indexFName.c_str());
+        assert(loaded.isUpToDate(fname.c_str(), indexFName.c_str()));
+        loaded.readAll(file, content, 4);
+        assert(std::string(content.begin(), content.end()) == expected);
+
+        readFileIntoBuffer(fname.c_str(), content, true);
+        assert(std::string(content.begin(), content.end()) == expected);
+        unlink(indexFName.c_str());
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test4(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("Read ahead gives the same data as reading on the calling thread");
+
+    std::string fname = "/tmp/test_io_read_ahead.gz";
+    std::string expected;
+    for(int i = 0; i < 2000000; i++) {
+        std::stringstream line;
+        line << i << " " << i * 0.125 << "\n";
+        expected += line.str();
+    }
+    {
+        CompressedFileWriter f(fname.c_str());
+        f << expected;
+    }
+
+    for(int readAhead = 0; readAhead < 2; readAhead++) {
+        std::string content;
+        {
+            TIMER(t, readAhead ? "with read ahead" : "without read ahead");
+            CompressedFileReader f(fname.c_str(), true, readAhead);
+            int i;
+            double v;
+            std::stringstream lines;
+            while(f >> i >> v) lines << i << " " << v << "\n";
+            content = lines.str();
+        }
+        assert(content == expected);
+    }
+
+    // Reader goes away before the end of the file
+    {
+        CompressedFileReader f(fname.c_str());
+        int i;
+        f >> i;
+        assert(i == 0);
+    }
+
+    // Corrupted data is reported
+    {
+        std::string badFName = "/tmp/test_io_bad.gz";
+        std::ofstream bad(badFName.c_str());
+        bad << "\x1f\x8b" << std::string(1000, 'x');
+        bad.close();
+
+        CompressedFileReader f(badFName.c_str());
+        std::string token;
+        f >> token;
+        assert(f.bad());
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test5(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("zstd and lz4 output reads back through CompressedFileReader");
+
+    std::string expected;
+    for(int i = 0; i < 500000; i++) {
+        std::stringstream line;
+        line << i << " " << i * 0.125 << "\n";
+        expected += line.str();
+    }
+
+    const char *fnames[] = {"/tmp/test_io_compressed.zst", "/tmp/test_io_compressed.lz4", "/tmp/test_io_compressed.gz"};
+    Compression compressions[] = {COMPRESSION_ZSTD, COMPRESSION_LZ4, COMPRESSION_GZIP};
+    for(int i = 0; i < 3; i++) {
+        const char *fname = fnames[i];
+        LOG_EXPR(fname);
+        assert(compressionFromFileName(fname) == compressions[i]);
+
+        try {
+            CompressedFileWriter f(fname, 0, -1, 100000);
+            f << expected;
+            f.close();
+        } catch (sfmf::Error &e) {
+            // Built without support for this format
+            LOG_WARN(e.what());
+            continue;
+        }
+        assert(detectCompression(fname) == compressions[i]);
+
+        for(int readAhead = 0; readAhead < 2; readAhead++) {
+            std::vector<char> content;
+            {
+                TIMER(t, readAhead ? "read with read ahead" : "read");
+                CompressedFileReader f(fname, true, readAhead);
+                std::stringstream all;
+                all << f.rdbuf();
+                std::string str = all.str();
+                content.assign(str.begin(), str.end());
+            }
+            assert(std::string(content.begin(), content.end()) == expected);
+        }
+
+        std::vector<char> content;
+        readFileIntoBuffer(fname, content);
+        assert(std::string(content.begin(), content.end()) == expected);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+test6(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("All I/O backends read the same content");
+
+    std::string expected;
+    for(int i = 0; i < 1000000; i++) {
+        std::stringstream line;
+        line << i << " " << i * 0.5 << "\n";
+        expected += line.str();
+    }
+
+    const char *fnames[] = {"/tmp/test_io_backend.txt", "/tmp/test_io_backend.gz"};
+    for(int i = 0; i < 2; i++) {
+        {
+            CompressedFileWriter f(fnames[i]);
+            f << expected;
+            f.close();
+        }
+
+        IOBackend backends[] = {IO_BACKEND_MMAP, IO_BACKEND_PREAD, IO_BACKEND_STREAM};
+        for(int b = 0; b < 3; b++) {
+            LOG_INFO(fnames[i] << " backend " << backends[b]);
+
+            // Sequential reads of odd sizes cross the block boundaries
+            InputFile::Ptr file = InputFile::open(fnames[i], backends[b]);
+            std::string raw;
+            std::vector<char> chunk(12345);
+            size_t n;
+            while((n = file->read(chunk.data(), chunk.size())) > 0) raw.append(chunk.data(), n);
+            assert(raw.size() == file->getSize());
+            assert((backends[b] == IO_BACKEND_MMAP) == (file->data() != NULL));
+
+            char magic[2];
+            assert(file->readAt(0, magic, 2) == 2 && memcmp(magic, raw.data(), 2) == 0);
+            assert(file->readAt(file->getSize(), magic, 2) == 0);
+
+            std::vector<char> content;
+            readFileIntoBuffer(fnames[i], content, false, backends[b]);
+            assert(std::string(content.begin(), content.end()) == expected);
+
+            CompressedFileReader f(fnames[i], true, true, backends[b]);
+            std::stringstream all;
+            all << f.rdbuf();
+            assert(all.str() == expected);
+        }
+    }
+
+    // Truncated compressed files fail through every backend
+    {
+        std::ifstream in(fnames[1], std::ios::binary);
+        std::string compressed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string truncatedFName = "/tmp/test_io_backend_truncated.gz";
+        std::ofstream out(truncatedFName.c_str(), std::ios::binary);
+        out << compressed.substr(0, compressed.size() / 3);
+        out.close();
+
+        IOBackend backends[] = {IO_BACKEND_MMAP, IO_BACKEND_PREAD, IO_BACKEND_STREAM};
+        for(int b = 0; b < 3; b++) {
+            bool failed = false;
+            try {
+                std::vector<char> content;
+                readFileIntoBuffer(truncatedFName.c_str(), content, false, backends[b]);
+            } catch (sfmf::Error &e) {
+                failed = true;
+            }
+            assert(failed);
+        }
+        unlink(truncatedFName.c_str());
+    }
+
+    // Environment variable selects the default
+    setenv("SFMF_IO_BACKEND", "mmap", 1);
+    assert(InputFile::defaultBackend() == IO_BACKEND_MMAP);
+    assert(InputFile::open(fnames[0])->data() != NULL);
+    setenv("SFMF_IO_BACKEND", "stream", 1);
+    assert(InputFile::defaultBackend() == IO_BACKEND_STREAM);
+    unsetenv("SFMF_IO_BACKEND");
+    assert(InputFile::defaultBackend() == IO_BACKEND_PREAD);
+
+    bool failed = false;
+    try {
+        InputFile::open("/tmp/test_io_does_not_exist");
+    } catch (sfmf::Error &e) {
+        failed = true;
+    }
+    assert(failed);
+
+    return EXIT_SUCCESS;
+}
+
+// Reads the whole stream in chunks the way the parsers do
+static
+size_t
+readAll(CompressedFileReader &f)
+{
+    std::vector<char> chunk(1 << 16);
+    size_t size = 0;
+    while(f.good()) {
+        f.read(chunk.data(), chunk.size());
+        size += f.gcount();
+    }
+    return size;
+}
+
+int
+test7(int /*argc*/, char ** /*argv*/)
+{
+    LOG_INFO("Truncated and corrupt compressed input is reported, with and without read ahead");
+
+    std::string expected;
+    for(int i = 0; i < 1000000; i++) {
+        std::stringstream line;
+        line << i << " " << i * 0.25 << "\n";
+        expected += line.str();
+    }
+
+    const char *fnames[] = {"/tmp/test_io_damaged.gz", "/tmp/test_io_damaged.zst", "/tmp/test_io_damaged.lz4"};
+    for(size_t i = 0; i < sizeof(fnames) / sizeof(fnames[0]); i++) {
+        try {
+            CompressedFileWriter f(fnames[i], 0, -1, 1 << 22);
+            f << expected;
+            f.close();
+        } catch (sfmf::Error &e) {
+            // Built without support for this format
+            LOG_WARN(e.what());
+            continue;
+        }
+        std::ifstream in(fnames[i], std::ios::binary);
+        std::string compressed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        // Cut in half, and garbage in the middle
+        std::string damaged[2] = {compressed.substr(0, compressed.size() / 2), compressed};
+        for(size_t j = compressed.size() / 2; j < compressed.size() / 2 + 64; j++) damaged[1][j] ^= 0x5a;
+
+        // Only gzip has a checksum that is sure to catch garbage
+        const int nDamages = compressionFromFileName(fnames[i]) == COMPRESSION_GZIP ? 2 : 1;
+        for(int d = 0; d < nDamages; d++) {
+            std::string damagedFName = std::string(fnames[i]) + (d == 0 ? ".truncated" : ".corrupt");
+            {
+                std::ofstream out(damagedFName.c_str(), std::ios::binary);
+                out << damaged[d];
+            }
+            LOG_INFO(damagedFName);
+
+            size_t sizes[2];
+            for(int readAhead = 0; readAhead < 2; readAhead++) {
+                CompressedFileReader f(damagedFName.c_str(), true, readAhead);
+                sizes[readAhead] = readAll(f);
+                LOG_EXPR(sizes[readAhead]);
+                assert(f.bad());
+                assert(sizes[readAhead] < expected.size());
+            }
+            // Data decoded before the error is not lost
+            assert(sizes[0] == sizes[1]);
+            if(d == 0) assert(sizes[0] > 0);
+
+            // Whole file loads fail instead of coming back short
+            bool failed = false;
+            try {
+                std::vector<char> content;
+                readFileIntoBuffer(damagedFName.c_str(), content);
+            } catch (sfmf::Error &e) {
+                LOG_INFO(e.what());
+                failed = true;
+            }
+            assert(failed);
+
+            unlink(damagedFName.c_str());
+        }
+        unlink(fnames[i]);
+    }
+
+    return EXIT_SUCCESS;
 }
 
 int
@@ -30,6 +407,24 @@ main(int argc, char **argv)
     case 1:
         return test1(argc - 1, &argv[1]);
         break;
+    case 2:
+        return test2(argc - 1, &argv[1]);
+        break;
+    case 3:
+        return test3(argc - 1, &argv[1]);
+        break;
+    case 4:
+        return test4(argc - 1, &argv[1]);
+        break;
+    case 5:
+        return test5(argc - 1, &argv[1]);
+        break;
+    case 6:
+        return test6(argc - 1, &argv[1]);
+        break;
+    case 7:
+        return test7(argc - 1, &argv[1]);
+        break;
     default:
         LOG_WARN("No test " << testNum);
         return EXIT_FAILURE;
@@ -6,7 +6,7 @@ using namespace sfmf;
 #include <iostream>
 
 int
-test1(int argc, char **argv)
+test1(int /*argc*/, char **argv)
 {
     LOG_INFO("Project 3D points from bundler reconstruction");
 
@@ -69,7 +69,7 @@ test1(int argc, char **argv)
 }
 
 int
-test2(int argc, char **argv)
+test2(int /*argc*/, char **argv)
 {
     LOG_INFO("Project 3D points from PMVS reconstruction");
 
@@ -96,7 +96,7 @@ test2(int argc, char **argv)
     for(int patchIdx = 0; patch != pmvs.getPatches().end(); patch++, patchIdx++) {
         //LOG_EXPR(patchIdx);
 
-        vector<uint32_t> camIdxs = patch->goodCameras;
+        vector<uint32_t> camIdxs(patch->goodCameras.begin(), patch->goodCameras.end());
         //camIdxs.insert(camIdxs.end(), patch->badCameras.begin(), patch->badCameras.end());
 
         for(vector<uint32_t>::iterator camIdx = camIdxs.begin(); camIdx != camIdxs.end(); camIdx++) {
@@ -120,6 +120,41 @@ test2(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+int
+test3(int /*argc*/, char **argv)
+{
+    LOG_INFO("Reorder patches along a space filling curve");
+
+    const char *patchFName = argv[1];
+    PMVS::Reconstruction pmvs(patchFName, false);
+    const PMVS::Patch::Vector orig = pmvs.getPatches();
+
+    // Where each original patch is now, tables are relative to the
+    // previous order
+    std::vector<int64_t> where(orig.size());
+    for(size_t i = 0; i < where.size(); i++) where[i] = i;
+
+    for(int curve = CURVE_MORTON; curve <= CURVE_HILBERT; curve++) {
+        std::vector<int64_t> table = pmvs.reorderSpatially(SpaceFillingCurve(curve));
+        assert(table.size() == pmvs.getNPatches());
+
+        std::vector<bool> seen(table.size(), false);
+        for(size_t i = 0; i < orig.size(); i++) {
+            assert(!seen[table[i]]);
+            seen[table[i]] = true;
+            where[i] = table[where[i]];
+        }
+        for(size_t i = 0; i < orig.size(); i++) {
+            const PMVS::Patch &a = orig[i], &b = pmvs.getPatches()[where[i]];
+            assert(a.position == b.position && a.normal == b.normal && a.score == b.score && a.color == b.color);
+            assert(a.goodCameras.size() == b.goodCameras.size() && std::equal(a.goodCameras.begin(), a.goodCameras.end(), b.goodCameras.begin()));
+            assert(a.badCameras.size() == b.badCameras.size() && std::equal(a.badCameras.begin(), a.badCameras.end(), b.badCameras.begin()));
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -138,6 +173,9 @@ main(int argc, char **argv)
     case 2:
         return test2(argc - 1, &argv[1]);
         break;
+    case 3:
+        return test3(argc - 1, &argv[1]);
+        break;
     default:
         LOG_ERROR("Test case " << testNum << " not recognized");
         return EXIT_FAILURE;
@@ -4,9 +4,10 @@
 using namespace sfmf;
 
 #include <utils.hpp>
+#include <spatial.hpp>
 
 int
-test1(int argc, char const *argv[])
+test1(int /*argc*/, char const *argv[])
 {
     LOG_INFO("Test get image size");
 
@@ -23,6 +24,47 @@ test1(int argc, char const *argv[])
     return EXIT_SUCCESS;
 }
 
+int
+test2(int /*argc*/, char const * /*argv*/[])
+{
+    LOG_INFO("Test space filling curves");
+
+    // Bits of x, y and z interleaved, x being the most significant
+    assert(mortonCode(1, 0, 0) == 4 && mortonCode(0, 1, 0) == 2 && mortonCode(0, 0, 1) == 1);
+    assert(mortonCode(0x1fffff, 0x1fffff, 0x1fffff) == (uint64_t(1) << 63) - 1);
+    assert(mortonCode(3, 5, 6) == 0xee);
+
+    // The first 8^3 positions of the Hilbert curve fill the cube at the
+    // origin and consecutive cells are neighbours
+    const int side = 8;
+    std::vector<Eigen::Vector3i> cells(side * side * side, Eigen::Vector3i::Constant(-1));
+    for(int x = 0; x < side; x++) {
+        for(int y = 0; y < side; y++) {
+            for(int z = 0; z < side; z++) {
+                uint64_t code = hilbertCode(x, y, z);
+                assert(code < cells.size() && cells[code][0] == -1);
+                cells[code] = Eigen::Vector3i(x, y, z);
+            }
+        }
+    }
+    assert(cells[0] == Eigen::Vector3i::Zero());
+    for(size_t i = 1; i < cells.size(); i++) assert((cells[i] - cells[i - 1]).cwiseAbs().sum() == 1);
+
+    // Ordering points, ties keep their order
+    std::vector<Eigen::Vector3d> pnts;
+    pnts.push_back(Eigen::Vector3d(1, 1, 1));
+    pnts.push_back(Eigen::Vector3d(0, 0, 0));
+    pnts.push_back(Eigen::Vector3d(1, 1, 1));
+    pnts.push_back(Eigen::Vector3d(0, 0, 1));
+    std::vector<int64_t> order, table;
+    spatialOrder(pnts.size(), [&](int64_t i) -> const Eigen::Vector3d & { return pnts[i]; }, CURVE_MORTON, order);
+    assert(order[0] == 1 && order[1] == 3 && order[2] == 0 && order[3] == 2);
+    invertPermutation(order, table);
+    for(size_t i = 0; i < order.size(); i++) assert(table[order[i]] == int64_t(i));
+
+    return EXIT_SUCCESS;
+}
+
 int
 main(int argc, char const *argv[])
 {
@@ -39,6 +81,9 @@ main(int argc, char const *argv[])
     case 1:
         return test1(argc - 2, &argv[2]);
         break;
+    case 2:
+        return test2(argc - 2, &argv[2]);
+        break;
     default:
         LOG_WARN("No test " << testNum);
     }
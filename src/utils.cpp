@@ -204,4 +204,34 @@ colormapValues(const std::vector<double> &values,
     }
 }
 
-SFMFILES_NAMESPACE_END
\ No newline at end of file
+static
+SimdLevel
+detectSimdLevelOnce()
+{
+    SimdLevel level = SIMD_NONE;
+#if defined(__SSE2__)
+    level = SIMD_SSE2;
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) level = SIMD_AVX2;
+#endif
+
+    const char *env = getenv("SFMF_SIMD");
+    if(env != NULL) {
+        std::string name(env);
+        if(name == "none") level = SIMD_NONE;
+        else if(name == "sse2" && level > SIMD_SSE2) level = SIMD_SSE2;
+        else if(name != "avx2" && name != "sse2") LOG_WARN("Unknown SFMF_SIMD value " << name << ", use none, sse2 or avx2");
+    }
+    return level;
+}
+
+SimdLevel
+detectSimdLevel()
+{
+    static const SimdLevel level = detectSimdLevelOnce();
+    return level;
+}
+
+SFMFILES_NAMESPACE_END
@@ -45,6 +45,17 @@ void colormapValues(const std::vector<double> &values,
                     std::vector<Eigen::Vector3f> &colors,
                     std::string *mapping = NULL);
 
+// Instruction sets the batch kernels can use, see detectSimdLevel()
+enum SimdLevel {
+    SIMD_NONE, // Plain C++
+    SIMD_SSE2, // 2 doubles at a time
+    SIMD_AVX2  // 4 doubles at a time, with FMA
+};
+
+/// Best instruction set supported by both the build and the processor,
+/// SFMF_SIMD (none, sse2 or avx2) in the environment can lower it
+SimdLevel detectSimdLevel();
+
 SFMFILES_NAMESPACE_END
 
 #endif // __SFMF_UTILS_HPP__
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include <SfMFiles/sfmfiles>
 #include "ply.hpp"
 #include "utils.hpp"
+#include "io.hpp"
 using namespace sfmf;
 using namespace sfmf::Bundler;
 #include <CMDCore/optparser>
@@ -75,15 +76,52 @@ colorPointsSeenByCameraProj(Bundler::Reconstruction &bundler, int camIdx, std::s
     bundler.getImageSizeForCamera(camIdx, width, height, true);
     const Bundler::Camera &cam = bundler.getCameras()[camIdx];
 
-    for(Point::Vector::iterator it = bundler.getPoints().begin(), itEnd = bundler.getPoints().end(); it != itEnd; it++) {
-        Eigen::Vector2d im;
-        bool proj = cam.world2im(it->position, im, true, width, height);
+    Point::Vector &points = bundler.getPoints();
+    const size_t nPoints = points.size();
+    std::vector<double> positions(3 * nPoints), im(2 * nPoints);
+    for(size_t i = 0; i < nPoints; i++) std::copy(points[i].position.data(), points[i].position.data() + 3, &positions[3 * i]);
 
-        if(proj) it->color = green;
-        else it->color = red;
-    }
+    std::vector<uint8_t> visible(nPoints);
+    cam.world2imBatch(positions.data(), nPoints, im.data(), visible.data(), true, width, height);
+
+    for(size_t i = 0; i < nPoints; i++) points[i].color = visible[i] ? green : red;
 }
 
+// Writes the points straight to the ply file as they are read, used
+// when no recoloring is needed
+class PlyPointWriter : public PointVisitor
+{
+public:
+    PlyPointWriter(const std::string &plyFName, const std::string &comments): _plyF(plyFName.c_str()), _comments(comments) {}
+
+    void close() { _plyF.close(); }
+
+    void visitCameras(const Camera::Vector & /*cameras*/, int64_t nPoints)
+    {
+        _plyF << "ply\n"
+              << "format ascii 1.0\n"
+              << "comment " << _comments
+              << "element vertex " << nPoints << "\n"
+              << "property float x\n"
+              << "property float y\n"
+              << "property float z\n"
+              << "property uchar red\n"
+              << "property uchar green\n"
+              << "property uchar blue\n"
+              << "end_header\n";
+    }
+
+    void visitPoint(int64_t /*pntIdx*/, const Point &pnt)
+    {
+        _plyF << pnt.position[0] << " " << pnt.position[1] << " " << pnt.position[2] << " "
+              << (int)pnt.color.r << " " << (int)pnt.color.g << " " << (int)pnt.color.b << "\n";
+    }
+
+private:
+    CompressedFileWriter _plyF;
+    std::string _comments;
+};
+
 int
 main(int argc, const char *argv[])
 {
@@ -121,6 +159,18 @@ main(int argc, const char *argv[])
 
     std::string listFName = opts["listFName"];
 
+    // Plain conversion, points are streamed to the output
+    if(!colorByNCams && camIdx < 0) {
+        std::stringstream comments;
+        comments << "Input filename: " << bundleFName << "\n";
+
+        PlyPointWriter writer(plyFName, comments.str());
+        visitPoints(bundleFName.c_str(), writer);
+        writer.close();
+
+        return EXIT_SUCCESS;
+    }
+
     Reconstruction bundler(bundleFName.c_str());
     if(listFName.size() > 0) {
         bundler.readListFile(listFName.c_str());
@@ -0,0 +1,57 @@
+// Copyright (C) 2013 by Daniel Hauagge
+//
+// Permission is hereby granted, free  of charge, to any person obtaining
+// a  copy  of this  software  and  associated  documentation files  (the
+// "Software"), to  deal in  the Software without  restriction, including
+// without limitation  the rights to  use, copy, modify,  merge, publish,
+// distribute,  sublicense, and/or sell  copies of  the Software,  and to
+// permit persons to whom the Software  is furnished to do so, subject to
+// the following conditions:
+//
+// The  above  copyright  notice  and  this permission  notice  shall  be
+// included in all copies or substantial portions of the Software.
+//
+// THE  SOFTWARE IS  PROVIDED  "AS  IS", WITHOUT  WARRANTY  OF ANY  KIND,
+// EXPRESS OR  IMPLIED, INCLUDING  BUT NOT LIMITED  TO THE  WARRANTIES OF
+// MERCHANTABILITY,    FITNESS    FOR    A   PARTICULAR    PURPOSE    AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE,  ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <SfMFiles/sfmfiles>
+using namespace sfmf;
+#include <CMDCore/optparser>
+
+int
+main(int argc, char const *argv[])
+{
+    cmdc::Logger::setLogLevels(cmdc::LOGLEVEL_DEBUG);
+
+    using namespace Bundler;
+    using namespace cmdc;
+
+    OptionParser::Arguments args;
+    OptionParser::Options opts;
+
+    OptionParser optParser(&args, &opts);
+    optParser.addUsage("<in:bundle.out> <out:bundle.bin>");
+    optParser.addDescription("Converts bundle files between the text and the binary formats (input format is detected automatically).");
+    optParser.addFlag("binary", "-b", "--binary", "Write the output in the binary format (text is written otherwise).");
+    optParser.setNArguments(2, 2);
+    optParser.parse(argc, argv);
+
+    std::string inBundleFName  = args[0];
+    std::string outBundleFName = args[1];
+
+    Reconstruction::FileFormat format = Reconstruction::FORMAT_ASCII;
+    if(opts["binary"].asBool()) format = Reconstruction::FORMAT_BINARY;
+
+    LOG_INFO("Loading " << inBundleFName);
+    Reconstruction bundle(inBundleFName.c_str());
+
+    LOG_INFO("Writing output to " << outBundleFName);
+    bundle.writeFile(outBundleFName.c_str(), format);
+
+    return EXIT_SUCCESS;
+}
@@ -31,23 +31,70 @@ filterByNCams(Bundler::Reconstruction &bundler, int minNCams)
 {
     using namespace Bundler;
 
-    Point::Vector newPnts;
+    const Point::Vector &points = bundler.getPoints();
+    int64_t nPnts = bundler.getNPoints();
+    bundler.removePoints([&](int64_t pntIdx) { return int(points[pntIdx].viewList.size()) < minNCams; });
+
+    LOG_INFO(nPnts - bundler.getNPoints() << "/" << nPnts << " points were removed");
+}
+
+// Same as filterByNCams but points are streamed from inBundleFName to
+// outBundleFName without loading the whole reconstruction
+void
+streamFilterByNCams(const std::string &inBundleFName, const std::string &outBundleFName, int minNCams)
+{
+    using namespace Bundler;
+
+    StreamReader reader(inBundleFName.c_str());
+    StreamWriter writer(outBundleFName.c_str(), reader.getCameras());
+
     PROGBAR_START("Processing points");
-    int idx = 0;
-    int nPnts = bundler.getNPoints();
-    int nCulled = 0;
-    for(Point::Vector::iterator it = bundler.getPoints().begin(), itEnd = bundler.getPoints().end(); it != itEnd; it++, idx++) {
+    Point pnt;
+    int64_t nPnts = reader.getNPoints();
+    int64_t nCulled = 0;
+    for(int64_t idx = 0; reader.readPoint(pnt); idx++) {
         PROGBAR_UPDATE(idx, nPnts);
-        if(it->viewList.size() >= minNCams) {
-            newPnts.push_back(*it);
+        if(int64_t(pnt.viewList.size()) >= minNCams) {
+            writer.writePoint(pnt);
         } else {
             nCulled++;
         }
     }
+    writer.close();
 
-    LOG_INFO(nCulled << "/" << bundler.getNPoints() << " points were removed");
+    LOG_INFO(nCulled << "/" << nPnts << " points were removed");
+}
 
-    bundler.getPoints() = newPnts;
+// Both filters look at the errors before anything is removed, a point
+// that is removed is judged by all its observations
+void
+filterByReprojectionError(Bundler::Reconstruction &bundler, double maxObsError, double maxPntError)
+{
+    using namespace Bundler;
+
+    ReprojectionErrors errors;
+    bundler.computeReprojectionErrors(errors);
+    LOG_INFO("Reprojection error of " << errors.total.nObservations << " observations: mean " << errors.total.mean
+             << ", RMS " << errors.total.rms << ", max " << errors.total.max << " pixels");
+    if(errors.total.nBehind > 0) LOG_WARN(errors.total.nBehind << " observations are behind their camera");
+
+    if(maxObsError >= 0) {
+        std::vector<bool> remove(errors.size());
+        uint64_t nRemoved = 0;
+        for(uint64_t i = 0; i < errors.size(); i++) {
+            remove[i] = errors.errors[i] > maxObsError;
+            nRemoved += remove[i];
+        }
+        bundler.removeObservations(remove);
+        LOG_INFO(nRemoved << "/" << errors.size() << " observations were removed");
+    }
+
+    if(maxPntError >= 0) {
+        int64_t nPnts = bundler.getNPoints();
+        const std::vector<ReprojectionErrors::Summary> &pntErrors = errors.points;
+        bundler.removePoints([&](int64_t pntIdx) { return pntErrors[pntIdx].rms > maxPntError || pntErrors[pntIdx].nBehind > 0; });
+        LOG_INFO(nPnts - bundler.getNPoints() << "/" << nPnts << " points were removed");
+    }
 }
 
 void
@@ -61,80 +108,19 @@ removeCameras(const std::string &rmCamsFName, Bundler::Reconstruction &bundler)
         exit(EXIT_FAILURE);
     }
 
-    set<int> rmCamIdxs;
-    while(f.good()) {
-        int camIdx;
-        f >> camIdx;
-        rmCamIdxs.insert(camIdx);
-    }
-
-    LOG_INFO(rmCamIdxs.size() << " indexes in file");
-    // sort(rmCamIdxs.begin(), rmCamIdxs.end());
-
-    Bundler::Camera::Vector newCams;
-    Bundler::Camera::Vector &cams = bundler.getCameras();
-
-    vector<string> &imgFNames = bundler.getImageFileNames();
-    vector<string> newImgFNames;
-
-    // vector<int>::iterator rmIdx = rmCamIdxs.end();
-    // int currIdx = 0;
-
-    PROGBAR_START("Filtering cameras");
-    map<uint32_t, uint32_t> newCamIdxs;
-    uint32_t newIdx = 0;
-    for (int i = 0; i < cams.size(); i++) {
-        PROGBAR_UPDATE(i, cams.size());
-        if(rmCamIdxs.count(i)) continue;
-
-        newCamIdxs[i] = newIdx;
-
-        newCams.push_back(cams[i]);
-        if(bundler.listFileLoaded()) newImgFNames.push_back(imgFNames[i]);
-
-        newIdx++;
-    }
-
-    LOG_INFO("newIdx = " << newIdx);
-
-    PROGBAR_START("Processing points");
-    Bundler::Point::Vector &points = bundler.getPoints();
-    Bundler::Point::Vector newPoints(points.size());
-    for (int i = 0; i < points.size(); i++) {
-        PROGBAR_UPDATE(i, points.size());
-
-        newPoints[i].position = points[i].position;
-        newPoints[i].color = points[i].color;
-
-        for (int j = 0; j < points[i].viewList.size(); j++) {
-            if(rmCamIdxs.count(points[i].viewList[j].camera)) continue;
-
-            Bundler::ViewListEntry entry = points[i].viewList[j];
-            entry.camera = newCamIdxs[entry.camera];
-
-            newPoints[i].viewList.push_back(entry);
-        }
+    vector<bool> rmCams(bundler.getNCameras(), false);
+    int nIdxs = 0, camIdx;
+    while(f >> camIdx) {
+        nIdxs++;
+        if(camIdx >= 0 && camIdx < bundler.getNCameras()) rmCams[camIdx] = true;
+        else LOG_WARN("Camera index " << camIdx << " is out of range");
     }
 
-    // while(true) {
-    //     for(; rmIdx != rmCamIdxs.end() && (*rmIdx) >= currIdx; rmIdx++);
-    //     if(rmIdx == rmCamIdxs.end()) break;
-
-    //     for(; currIdx < cams.size() && currIdx < (*rmIdx); currIdx++) {
-    //         newCams.push_back(cams[currIdx]);
-
-    //         if(bundler.listFileLoaded()) newImgFNames.push_back(imgFNames[currIdx]);
-    //     }
-    //     if(currIdx == cams.size()) break;
-    // }
+    LOG_INFO(nIdxs << " indexes in file");
 
-    LOG_INFO(newCams.size() << " cameras left in the end");
-    bundler.getCameras() = newCams;
-    bundler.getPoints() = newPoints;
+    bundler.removeCameras(rmCams);
 
-    if(bundler.listFileLoaded()) {
-        bundler.getImageFileNames() = newImgFNames;
-    }
+    LOG_INFO(bundler.getNCameras() << " cameras left in the end");
 }
 
 int
@@ -156,6 +142,11 @@ main(int argc, char const *argv[])
                         "Keep all points that are seen by at least N cameras", "-1");
     optParser.addOption("rmCamsFName", "-r", "FNAME", "--rm-cams",
                         "Remove cameras listed in file FNAME (one camera per line, zero indexed)");
+    optParser.addOption("maxObsError", "-e", "E", "--max-error",
+                        "Remove observations whose reprojection error is above E pixels", "-1");
+    optParser.addOption("maxPntError", "", "E", "--max-point-error",
+                        "Remove points whose RMS reprojection error is above E pixels or that are behind "
+                        "a camera that sees them", "-1");
     optParser.addOption("inListFName", "", "FNAME", "--in-list", "Input list filename");
     optParser.addOption("outListFName", "", "FNAME", "--out-list", "Output list filename");
     optParser.setNArguments(2, 2);
@@ -165,14 +156,39 @@ main(int argc, char const *argv[])
     std::string outBundleFName = args[1];
 
     int minNCams = opts["minNCams"].asInt();
+    double maxObsError = opts["maxObsError"].asFloat();
+    double maxPntError = opts["maxPntError"].asFloat();
     std::string rmCamsFName = opts["rmCamsFName"];
     std::string inListFName = opts["inListFName"];
     std::string outListFName = opts["outListFName"];
 
+    // Filtering by number of cameras alone does not need the whole
+    // reconstruction in memory
+    if(minNCams >= 0 && rmCamsFName.empty() && maxObsError < 0 && maxPntError < 0) {
+        LOG_INFO("Writing output to " << outBundleFName);
+        streamFilterByNCams(inBundleFName, outBundleFName, minNCams);
+
+        if(outListFName.size()) {
+            if(!inListFName.size()) {
+                LOG_ERROR("No list file loaded but output list filename specified");
+                return EXIT_FAILURE;
+            }
+
+            // No camera was removed, the list is copied as is
+            LOG_INFO("Writing list to " << outListFName);
+            std::ifstream inList(inListFName.c_str());
+            std::ofstream outList(outListFName.c_str());
+            outList << inList.rdbuf();
+        }
+
+        return EXIT_SUCCESS;
+    }
+
     Reconstruction bundler(inBundleFName.c_str());
     if(inListFName.size()) bundler.readListFile(inListFName.c_str());
 
     if(rmCamsFName.size()) removeCameras(rmCamsFName, bundler);
+    if(maxObsError >= 0 || maxPntError >= 0) filterByReprojectionError(bundler, maxObsError, maxPntError);
     if(minNCams >= 0) filterByNCams(bundler, minNCams);
 
     LOG_INFO("Writing output to " << outBundleFName);
@@ -43,7 +43,12 @@ main(int argc, char const *argv[])
     std::string inListFName = args[1];
     std::string outListFName = args[2];
 
-    Bundler::Reconstruction bundler(bundleFName.c_str());
+    // Only the cameras are needed
+    Bundler::ReadOptions readOpts;
+    readOpts.camerasOnly = true;
+
+    Bundler::Reconstruction bundler;
+    bundler.readFile(bundleFName.c_str(), readOpts);
     bundler.readListFile(inListFName.c_str());
 
     std::ofstream outList(outListFName.c_str());
@@ -58,7 +63,7 @@ main(int argc, char const *argv[])
         double focal = 0.0;
         if(cam->isValid()) focal = cam->focalLength;
 
-        outList << bundler.getImageFileNames()[camIdx] << " 0 " << focal << "\n";
+        outList << bundler.getImageFileName(camIdx) << " 0 " << focal << "\n";
     }
 
     return EXIT_SUCCESS;
@@ -68,7 +68,7 @@ mainCameraMode(const Bundler::Reconstruction bundle,
 
         // Focal length
         if ( (selFields.count("im") || selFields.count("all") ) && bundle.listFileLoaded() ) {
-            std::cout << std::setw(w) << "Image: " << bundle.getImageFileNames()[camIdx] << std::endl;
+            std::cout << std::setw(w) << "Image: " << bundle.getImageFileName(camIdx) << std::endl;
         }
 
         // Camera center in world coordinates
@@ -109,6 +109,36 @@ mainCameraMode(const Bundler::Reconstruction bundle,
     return EXIT_SUCCESS;
 }
 
+void
+printPoint(const Bundler::Point &pnt, const std::set<std::string> &selFields)
+{
+    if ( selFields.count("pos") || selFields.count("all") ) {
+        std::cout << " Position: " << pnt.position.transpose() << "\n";
+    }
+
+    if ( selFields.count("color") || selFields.count("all") ) {
+        std::cout << "    Color: ["
+                  << int(pnt.color.r) << ","
+                  << int(pnt.color.g) << ","
+                  << int(pnt.color.b) << "]\n";
+    }
+
+    if ( selFields.count("viewlist") || selFields.count("all") ) {
+        Bundler::ViewListEntry::Vector::const_iterator vl = pnt.viewList.begin();
+        Bundler::ViewListEntry::Vector::const_iterator vlEnd = pnt.viewList.end();
+
+        std::cout << "View List:\n";
+        std::string sepCam = "";
+        for(; vl != vlEnd; vl++) {
+            std::cout << sepCam;
+            std::cout << "\t camera: " << vl->camera      << "\n";
+            std::cout << "\t    key: " << vl->key         << "\n";
+            std::cout << "\tkey pos: " << vl->keyPosition.transpose() << "\n";
+            sepCam = "\n";
+        }
+    }
+}
+
 int
 mainPointMode(const Bundler::Reconstruction bundle,
               const OptionParser::Arguments &args,
@@ -124,7 +154,7 @@ mainPointMode(const Bundler::Reconstruction bundle,
 
     Bundler::Point::Vector::iterator pnt = points.begin();
     Bundler::Point::Vector::iterator pntEnd = points.end();
-    int pntIdx = 0;
+    int64_t pntIdx = 0;
 
     if(opts.count("selIdx")) {
         pntIdx  = opts.at("selIdx").asInt();
@@ -137,34 +167,51 @@ mainPointMode(const Bundler::Reconstruction bundle,
         std::cout << sep << "Point " << pntIdx << std::endl;
         sep = "\n";
 
-        if ( selFields.count("pos") || selFields.count("all") ) {
-            std::cout << " Position: " << pnt->position.transpose() << "\n";
-        }
+        printPoint(*pnt, selFields);
+    }
 
-        if ( selFields.count("color") || selFields.count("all") ) {
-            std::cout << "    Color: ["
-                      << int(pnt->color.r) << ","
-                      << int(pnt->color.g) << ","
-                      << int(pnt->color.b) << "]\n";
-        }
+    return EXIT_FAILURE;
+}
 
-        if ( selFields.count("viewlist") || selFields.count("all") ) {
-            Bundler::ViewListEntry::Vector::iterator vl = pnt->viewList.begin();
-            Bundler::ViewListEntry::Vector::iterator vlEnd = pnt->viewList.end();
-
-            std::cout << "View List:\n";
-            std::string sepCam = "";
-            for(; vl != vlEnd; vl++) {
-                std::cout << sepCam;
-                std::cout << "\t camera: " << vl->camera      << "\n";
-                std::cout << "\t    key: " << vl->key         << "\n";
-                std::cout << "\tkey pos: " << vl->keyPosition.transpose() << "\n";
-                sepCam = "\n";
-            }
-        }
+// Prints a single point without loading the whole file
+int
+mainSinglePointMode(const std::string &bundleFName,
+                    const OptionParser::Arguments &args,
+                    const OptionParser::Options &opts)
+{
+    std::set<std::string> selFields;
+    for(size_t i = 2; i < args.size(); i++) {
+        selFields.insert(args[i]);
+    }
+    if(selFields.size() == 0) selFields.insert("all");
+
+    const char *cacheFName = opts.count("cacheFName") ? opts.at("cacheFName").c_str() : NULL;
+    int64_t pntIdx = opts.at("selIdx").asInt();
+    int64_t nPoints = 0;
+    Bundler::Point pnt;
+
+    // Text files are viewed through a binary copy, if it can not be
+    // written (e.g. read-only directory) the whole file is read instead
+    try {
+        Bundler::ReconstructionView view(bundleFName.c_str(), cacheFName);
+        nPoints = view.getNPoints();
+        if(pntIdx >= 0 && pntIdx < nPoints) view.getPoint(pntIdx, pnt);
+    } catch (std::exception &e) {
+        LOG_WARN("Could not view " << bundleFName << " through a binary cache (" << e.what() << "), reading the whole file");
+        Bundler::Reconstruction bundle(bundleFName.c_str());
+        nPoints = bundle.getNPoints();
+        if(pntIdx >= 0 && pntIdx < nPoints) pnt = bundle.getPoints()[pntIdx];
     }
 
-    return EXIT_FAILURE;
+    if(pntIdx < 0 || pntIdx >= nPoints) {
+        LOG_ERROR("Point index " << pntIdx << " out of range (" << nPoints << " points)");
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Point " << pntIdx << std::endl;
+    printPoint(pnt, selFields);
+
+    return EXIT_SUCCESS;
 }
 
 int
@@ -183,14 +230,24 @@ main(int argc, const char **argv)
 
     optParser.addOption("listFName", "-l", "F", "--list", "Bundler list filename");
     optParser.addOption("selIdx", "-i", "IDX", "--sel-idx", "Only print information from selected camera or point");
+    optParser.addOption("cacheFName", "-c", "F", "--cache", "Binary copy of a text bundle file used to look up a single point (default <bundle>.bin)");
 
     optParser.parse(argc, argv);
 
     std::string bundleFName = args[0];
     std::string mode = args[1];
 
-    // Load bundle file
-    Reconstruction bundle(bundleFName.c_str());
+    // A single point can be read from a memory mapped binary version of the file
+    if (strcasecmp(mode.c_str(), "pnt") == 0 && opts.count("selIdx")) {
+        return mainSinglePointMode(bundleFName, args, opts);
+    }
+
+    // Load bundle file, points are skipped if only cameras are printed
+    ReadOptions readOpts;
+    readOpts.camerasOnly = (strcasecmp(mode.c_str(), "cam") == 0);
+
+    Reconstruction bundle;
+    bundle.readFile(bundleFName.c_str(), readOpts);
     if(opts.count("listFName")) {
         bundle.readListFile(opts["listFName"].c_str());
     }
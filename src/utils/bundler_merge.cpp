@@ -74,7 +74,7 @@ main(int argc, char const *argv[])
 
     LOG_INFO("Merging " << inBundleFNames.size() << " bundle files");
 
-    std::vector<std::string> outImageList;
+    ListFile outImageList;
     Camera::Vector outCams;
     Point::Vector outPoints;
 
@@ -82,7 +82,8 @@ main(int argc, char const *argv[])
     // we've seen.
     std::set<std::string> imgsSeen;
 
-    for (int bun = 0, nPoints = -1; bun < inBundleFNames.size(); bun++) {
+    int64_t nPoints = -1;
+    for (size_t bun = 0; bun < inBundleFNames.size(); bun++) {
         LOG_INFO("[" << std::setw(4) << bun << "/" << inBundleFNames.size() << "] Loading " << inBundleFNames[bun]);
         Reconstruction bundle(inBundleFNames[bun].c_str());
         bundle.readListFile(inListFNames[bun].c_str());
@@ -98,8 +99,8 @@ main(int argc, char const *argv[])
             outCams = bundle.getCameras();
 
             for (int i = 0; i < bundle.getNCameras(); i++) {
-                imgsSeen.insert(basename(bundle.getImageFileNames()[i]));
-                outImageList.push_back(bundle.getImageFileNames()[i]);
+                imgsSeen.insert(basename(bundle.getImageFileName(i)));
+                outImageList.push_back(bundle.getImageList().getFileName(i), bundle.getImageList().getExtra(i));
             }
             continue;
         }
@@ -110,12 +111,12 @@ main(int argc, char const *argv[])
             return EXIT_FAILURE;
         }
 
-        std::vector<std::string> &imageList = bundle.getImageFileNames();
+        const ListFile &imageList = bundle.getImageList();
         const Camera::Vector &cams = bundle.getCameras();
 
         int nAdded = 0;
         for (int imgIdx = 0; imgIdx < bundle.getNCameras(); imgIdx++) {
-            std::string imgFName = imageList[imgIdx];
+            std::string imgFName = bundle.getImageFileName(imgIdx);
 
             // Make sure we're not trying to insert something we've seen already
             std::string imgBName = basename(imgFName);
@@ -128,12 +129,13 @@ main(int argc, char const *argv[])
 
             // Add the new camera
             outCams.push_back(cams[imgIdx]);
-            outImageList.push_back(imageList[imgIdx]);
+            outImageList.push_back(imageList.getFileName(imgIdx), imageList.getExtra(imgIdx));
             int newCamIdx = outCams.size() - 1;
 
             // Udate the visibility lists
             if (updateVizList) {
-                for (std::vector<PointVisListIdxs>::const_iterator it = cams[imgIdx].visiblePoints.begin(); it != cams[imgIdx].visiblePoints.end(); it++) {
+                ArrayView<PointVisListIdxs> visiblePoints = bundle.getVisiblePoints(imgIdx);
+                for (ArrayView<PointVisListIdxs>::const_iterator it = visiblePoints.begin(); it != visiblePoints.end(); it++) {
                     outPoints[it->pointIdx].viewList.push_back(ViewListEntry(newCamIdx));
                 }
             }
@@ -148,10 +150,7 @@ main(int argc, char const *argv[])
     outBundle.writeFile(outBundleFName.c_str());
 
     LOG_INFO("Writing image list to " << outListFName);
-    std::ofstream outListF(outListFName.c_str());
-    for (int i = 0; i < outImageList.size(); i++) {
-        outListF << outImageList[i] << std::endl;
-    }
+    outImageList.writeFile(outListFName.c_str());
 
     return EXIT_SUCCESS;
 }
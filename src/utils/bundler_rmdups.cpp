@@ -70,18 +70,12 @@ main(int argc, const char **argv)
 
     // Find out which are the repeated images
     map<string, int> selectedCams; // For each image basename what is the index in the original bundle that we should keep
-    set<int> camIdxsToKeep;        // Indexes of the cameras that will be remomoved from viewlists
-    map<int, int> newCamMapping;   // Mapping old to new camera indexes
-    vector<string> newImageList;
-    Camera::Vector newCameras;
-    Camera::Vector &oldCameras = bundle.getCameras();
-    Camera::Vector::iterator oldCam = oldCameras.begin();
-    for(int camIdx = 0; camIdx < bundle.getNCameras(); camIdx++, oldCam++) {
-        string bname = getBasename(bundle.getImageFileNames()[camIdx]);
+    for(int camIdx = 0; camIdx < bundle.getNCameras(); camIdx++) {
+        string bname = getBasename(bundle.getImageFileName(camIdx));
 
         if(selectedCams.find(bname) != selectedCams.end()) {
             // Keep the camera that sees more points
-            if(oldCam->visiblePoints.size() > oldCameras[selectedCams[bname]].visiblePoints.size()) {
+            if(bundle.getVisiblePoints(camIdx).size() > bundle.getVisiblePoints(selectedCams[bname]).size()) {
                 selectedCams[bname] = camIdx;
             }
             continue;
@@ -90,37 +84,18 @@ main(int argc, const char **argv)
         selectedCams[bname] = camIdx;
     }
 
+    // Cameras end up sorted by image basename
+    vector<int> newCamIdxs(bundle.getNCameras(), -1);
+    int nKept = 0;
     for(map<string, int>::iterator it = selectedCams.begin(); it != selectedCams.end(); it++) {
-        newImageList.push_back(bundle.getImageFileNames()[it->second]);
-        newCameras.push_back(oldCameras[it->second]);
-        newCamMapping[it->second] = newImageList.size() - 1;
-        camIdxsToKeep.insert(it->second);
+        newCamIdxs[it->second] = nKept++;
     }
 
-    LOG_INFO("Keeping " << camIdxsToKeep.size() << " of " << bundle.getNCameras() << " cameras");
+    LOG_INFO("Keeping " << nKept << " of " << bundle.getNCameras() << " cameras");
 
-    Point::Vector newPoints;
-    for(int pntIdx = 0; pntIdx < bundle.getNPoints(); pntIdx++) {
-        const Point &pntInfo = bundle.getPoints()[pntIdx];
-        Point newPntInfo(pntInfo);
-
-        newPntInfo.viewList.resize(0);
-
-        for(int i = 0; i < pntInfo.viewList.size(); i++) {
-            if( camIdxsToKeep.count( pntInfo.viewList[i].camera ) == 0) continue;
-            ViewListEntry pntEntry = pntInfo.viewList[i];
-            pntEntry.camera = newCamMapping[pntEntry.camera];
-
-            newPntInfo.viewList.push_back( pntEntry );
-        }
-
-        newPoints.push_back(newPntInfo);
-    }
-
-    Reconstruction outBundle(newCameras, newPoints);
-    outBundle.getImageFileNames() = newImageList;
-    outBundle.writeFile(outBundleFName.c_str());
-    outBundle.writeListFile(outListFName.c_str());
+    bundle.remapCameras(newCamIdxs);
+    bundle.writeFile(outBundleFName.c_str());
+    bundle.writeListFile(outListFName.c_str());
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
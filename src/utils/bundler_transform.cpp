@@ -87,47 +87,35 @@ main(int argc, char const *argv[])
         trans *= transF;
     }
 
-    LOG_INFO("Loading bundle file");
-    Bundler::Reconstruction bundle(inBundleFName.c_str());
+    // Points are streamed from the input to the output, only the cameras
+    // are kept in memory
+    LOG_INFO("Reading cameras from " << inBundleFName);
+    Bundler::StreamReader reader(inBundleFName.c_str());
 
-    PROGBAR_START("Applying transform to all points");
-    Bundler::Point::Vector &pnts = bundle.getPoints();
-    Bundler::Point::Vector::iterator pnt = pnts.begin();
-    for (int i = 0, iEnd = bundle.getNPoints(); i < iEnd; i++, pnt++) {
+    PROGBAR_START("Applying transform to all cameras");
+    Bundler::Camera::Vector cams = reader.getCameras();
+    for (int i = 0, iEnd = cams.size(); i < iEnd; i++) {
         PROGBAR_UPDATE(i, iEnd);
-
-        Eigen::Vector4d p(pnt->position[0], pnt->position[1], pnt->position[2], 1.0);
-        p = trans * p;
-
-        for (int j = 0; j < 3; j++) {
-            pnt->position[j] = p[j];
-        }
+        cams[i].transform(trans);
     }
 
-    Eigen::MatrixXd transInv = trans.inverse();
-    Eigen::Matrix3d transRot = transInv.block(0, 0, 3, 3);
-    double scale = std::pow(transRot.determinant(), 1.0 / 3.0);
-    transInv.block(0, 0, 3, 3) /= scale;
+    LOG_INFO("Writing output to " << outBundleFName);
+    Bundler::StreamWriter writer(outBundleFName.c_str(), cams, reader.getNPoints());
 
-    PROGBAR_START("Applying transform to all cameras");
-    Bundler::Camera::Vector &cams = bundle.getCameras();
-    Bundler::Camera::Vector::iterator cam = cams.begin();
-    for (int i = 0, iEnd = bundle.getNCameras(); i < iEnd; i++, cam++) {
+    PROGBAR_START("Applying transform to all points");
+    Bundler::Point pnt;
+    for (int64_t i = 0, iEnd = reader.getNPoints(); reader.readPoint(pnt); i++) {
         PROGBAR_UPDATE(i, iEnd);
-        Eigen::MatrixXd camT(4, 4);
-        camT.block(0, 0, 3, 3) = cam->rotation;
-        camT.block(0, 3, 3, 1) = cam->translation;
-        camT.block(3, 0, 1, 3).setZero();
-        camT(3, 3) = 1;
 
-        camT *= transInv;
+        Eigen::Vector4d p(pnt.position[0], pnt.position[1], pnt.position[2], 1.0);
+        p = trans * p;
 
-        cam->rotation = camT.block(0, 0, 3, 3);
-        cam->translation = camT.block(0, 3, 3, 1) / scale;
+        for (int j = 0; j < 3; j++) {
+            pnt.position[j] = p[j];
+        }
+        writer.writePoint(pnt);
     }
-
-    LOG_INFO("Writing output to " << outBundleFName);
-    bundle.writeFile(outBundleFName.c_str());
+    writer.close();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -65,7 +65,7 @@ main(int argc, const char *argv[])
 
     bundle->getPoints().resize(0);
 
-    for(int i = 0; i < pmvs->getNPatches(); i++, patch++) {
+    for(size_t i = 0; i < pmvs->getNPatches(); i++, patch++) {
         Bundler::Point pinfo;
 
         // Position
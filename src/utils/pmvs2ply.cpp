@@ -119,7 +119,7 @@ main(int argc, const char *argv[])
     ply.addComment(comments.str());
 
     PMVS::Patch::Vector::iterator patch = pmvs.getPatches().begin();;
-    for(int i = 0; i < pmvs.getNPatches(); i++, patch++) {
+    for(size_t i = 0; i < pmvs.getNPatches(); i++, patch++) {
         Eigen::Vector3d p(patch->position[0], patch->position[1], patch->position[2]);
         Eigen::Vector3d n(patch->normal[0], patch->normal[1], patch->normal[2]);
         Ply::Color c(patch->color[0] * 255, patch->color[1] * 255, patch->color[2] * 255);
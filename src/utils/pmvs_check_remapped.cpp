@@ -61,7 +61,7 @@ main(int argc, char const *argv[])
     LOG_INFO("gather all camera indexes in reconstruction");
     std::set<uint32_t> goodCamIdxs;
     for(PMVS::Patch::Vector::const_iterator patch = pmvs.getPatches().begin(); patch != pmvs.getPatches().end(); patch++) {
-        for(std::vector<uint32_t>::const_iterator cam = patch->goodCameras.begin(); cam != patch->goodCameras.end(); cam++) {
+        for(PMVS::Patch::CameraList::const_iterator cam = patch->goodCameras.begin(); cam != patch->goodCameras.end(); cam++) {
             goodCamIdxs.insert(*cam);
         }
     }
@@ -110,7 +110,7 @@ main(int argc, const char *argv[])
 
     LOG_INFO("Processing data");
     PMVS::Patch::Vector &patchFiltered = pmvsFiltered.getPatches();
-    for(int i = 0; i < pmvs.getNPatches(); i++) {
+    for(size_t i = 0; i < pmvs.getNPatches(); i++) {
         //if(i%1000 == 0) {
         //  LOG_INFO(i << "/" << pmvs.getNPatches());
         //}
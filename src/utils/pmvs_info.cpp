@@ -60,7 +60,7 @@ mainPointMode(const PMVS::Reconstruction pmvs,
 
     PMVS::Patch::Vector::iterator patch = patches.begin();
     PMVS::Patch::Vector::iterator patchEnd = patches.end();
-    int pntIdx = 0;
+    int64_t pntIdx = 0;
 
     if(opts.count("selIdx")) {
         pntIdx  = opts.at("selIdx").asInt();
@@ -158,7 +158,7 @@ mainCameraIndexes(const PMVS::Reconstruction pmvs,
     PMVS::Patch::Vector::const_iterator patch = patches.begin();
     PMVS::Patch::Vector::const_iterator patchEnd = patches.end();
     for (; patch != patchEnd; patch++) {
-        for(std::vector<uint32_t>::const_iterator idx = patch->goodCameras.begin(); idx != patch->goodCameras.end(); idx++) {
+        for(PMVS::Patch::CameraList::const_iterator idx = patch->goodCameras.begin(); idx != patch->goodCameras.end(); idx++) {
             camIdxs.push_back(*idx);
         }
     }
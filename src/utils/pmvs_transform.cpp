@@ -93,7 +93,7 @@ main(int argc, char const *argv[])
     PROGBAR_START("Applying transform to all points");
     PMVS::Patch::Vector &patches = pmvs.getPatches();
     PMVS::Patch::Vector::iterator patch = patches.begin();
-    for (int i = 0, iEnd = pmvs.getNPatches(); i < iEnd; i++, patch++) {
+    for (size_t i = 0, iEnd = pmvs.getNPatches(); i < iEnd; i++, patch++) {
         PROGBAR_UPDATE(i, iEnd);
 
         patch->position = trans * patch->position;